@@ -0,0 +1,270 @@
+#include "access_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/lexical_cast.hpp>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace eiptnd {
+
+namespace {
+
+std::size_t block_bytes(std::size_t records_count, std::size_t strings_size)
+{
+  std::size_t size = sizeof(access_block_header) +
+      records_count * sizeof(access_record) + strings_size;
+  return size + access_block_padding(size);
+}
+
+} // namespace
+
+access_log::buffer::buffer(access_log& log)
+  : log_(log)
+{
+  records_.reserve(block_size / sizeof(access_record));
+  strings_.reserve(block_size);
+}
+
+void
+access_log::buffer::append(access_record record, boost::string_ref url)
+{
+  url = url.substr(0, max_url_size);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if (block_bytes(records_.size() + 1, strings_.size() + url.size())
+        > block_size) {
+    write_records();
+  }
+
+  record.url_offset = static_cast<boost::uint32_t>(strings_.size());
+  record.url_size = static_cast<boost::uint32_t>(url.size());
+  strings_.append(url.data(), url.size());
+  records_.push_back(record);
+}
+
+void
+access_log::buffer::flush()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  write_records();
+}
+
+void
+access_log::buffer::write_records()
+{
+  if (records_.empty()) {
+    return;
+  }
+
+  log_.write_block(records_, strings_);
+  records_.clear();
+  strings_.clear();
+}
+
+access_log::access_log(std::string const& directory, std::size_t file_size)
+  : log_(boost::log::keywords::channel = "access-log")
+  , directory_(directory)
+  , file_size_(std::max<std::size_t>(file_size,
+                                     sizeof(access_file_header) + block_size))
+  , position_(0)
+  , files_count_(0)
+  , written_(0)
+  , dropped_(0)
+{
+  boost::filesystem::create_directories(directory_);
+  open_file();
+}
+
+access_log::~access_log()
+{
+  close();
+}
+
+void
+access_log::set_endpoint(access_record& record,
+                         boost::asio::ip::tcp::endpoint const& endpoint)
+{
+  std::memset(record.address, 0, sizeof(record.address));
+  boost::asio::ip::address const address = endpoint.address();
+  if (address.is_v6()) {
+    boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+    std::copy(bytes.begin(), bytes.end(), record.address);
+    record.flags |= access_record::ipv6_flag;
+  }
+  else {
+    boost::asio::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+    std::copy(bytes.begin(), bytes.end(), record.address);
+  }
+  record.port = endpoint.port();
+}
+
+access_method
+access_log::method_code(boost::string_ref method)
+{
+  for (unsigned int i = other_method + 1; i < methods_count; ++i) {
+    if (method == access_method_name(i)) {
+      return static_cast<access_method>(i);
+    }
+  }
+  return other_method;
+}
+
+boost::uint64_t
+access_log::now()
+{
+  return static_cast<boost::uint64_t>(
+      boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+        boost::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+void
+access_log::close()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  close_file();
+}
+
+void
+access_log::write_block(std::vector<access_record> const& records,
+                        std::string const& strings)
+{
+  std::size_t size = block_bytes(records.size(), strings.size());
+
+  boost::mutex::scoped_lock lock(mutex_);
+  try {
+    if (!region_ || position_ + size > file_size_) {
+      close_file();
+      open_file();
+    }
+  }
+  catch (std::exception const& e) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Failed to rotate the access log: " << e.what();
+    region_.reset();
+    dropped_.fetch_add(records.size(), boost::memory_order_relaxed);
+    return;
+  }
+
+  char* out = static_cast<char*>(region_->get_address()) + position_;
+
+  access_block_header header;
+  header.records_count = static_cast<boost::uint32_t>(records.size());
+  header.strings_size = static_cast<boost::uint32_t>(strings.size());
+  std::memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+
+  std::memcpy(out, records.data(), records.size() * sizeof(access_record));
+  out += records.size() * sizeof(access_record);
+
+  // The padding is already zeroed by the file creation
+  std::memcpy(out, strings.data(), strings.size());
+
+  position_ += size;
+  written_.fetch_add(records.size(), boost::memory_order_relaxed);
+}
+
+void
+access_log::open_file()
+{
+  namespace ipc = boost::interprocess;
+
+  std::string const started = boost::posix_time::to_iso_string(
+      boost::posix_time::second_clock::universal_time());
+
+  // A file of the previous run, restarted within the same second,
+  // is never overwritten: the next index is taken instead
+  for (;;) {
+    boost::filesystem::path path(directory_);
+    path /= "access-" + started + "-" +
+        boost::lexical_cast<std::string>(files_count_++) + ".bin";
+    file_name_ = path.string();
+    if (create_file()) {
+      break;
+    }
+  }
+
+  ipc::file_mapping mapping(file_name_.c_str(), ipc::read_write);
+  region_.reset(new ipc::mapped_region(mapping, ipc::read_write, 0, file_size_));
+
+  access_file_header header;
+  std::memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+  header.version = access_file_header::current_version;
+  header.record_size = sizeof(access_record);
+  std::memcpy(region_->get_address(), &header, sizeof(header));
+  position_ = sizeof(header);
+
+  BOOST_LOG_SEV(log_, logging::info) << "Writing access log to " << file_name_;
+}
+
+bool
+access_log::create_file()
+{
+#if defined(__linux__)
+  int fd = ::open(file_name_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                  0644);
+  if (fd == -1) {
+    if (errno == EEXIST) {
+      return false;
+    }
+    throw std::runtime_error("Unable to create " + file_name_ + ": " +
+                             std::strerror(errno));
+  }
+
+  // Blocks are written through the mapping, where a full disk raises
+  // SIGBUS instead of an error, so the space is allocated beforehand
+  int err = ::posix_fallocate(fd, 0, static_cast<off_t>(file_size_));
+  ::close(fd);
+  if (err) {
+    boost::system::error_code ignored_ec;
+    boost::filesystem::remove(file_name_, ignored_ec);
+    throw std::runtime_error("Unable to allocate " +
+                             boost::lexical_cast<std::string>(file_size_) +
+                             " bytes for " + file_name_ + ": " +
+                             std::strerror(err));
+  }
+#else
+  if (boost::filesystem::exists(file_name_)) {
+    return false;
+  }
+  {
+    std::ofstream create(file_name_.c_str(), std::ios::binary);
+    if (!create.is_open()) {
+      throw std::runtime_error("Unable to create " + file_name_);
+    }
+  }
+  boost::filesystem::resize_file(file_name_, file_size_);
+#endif
+  return true;
+}
+
+void
+access_log::close_file()
+{
+  if (!region_) {
+    return;
+  }
+
+  region_->flush();
+  region_.reset();
+
+  boost::system::error_code ec;
+  boost::filesystem::resize_file(file_name_, position_, ec);
+  if (ec) {
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Failed to truncate " << file_name_ << ": " << ec.message();
+  }
+}
+
+} // namespace eiptnd
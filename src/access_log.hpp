@@ -0,0 +1,124 @@
+#ifndef ACCESS_LOG_HPP
+#define ACCESS_LOG_HPP
+
+#include "access_log_format.hpp"
+#include "log.hpp"
+
+#include <string>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility/string_ref.hpp>
+
+namespace boost {
+namespace interprocess {
+class mapped_region;
+} // namespace interprocess
+} // namespace boost
+
+
+namespace eiptnd {
+
+/// Writer of binary access log files. Requests are collected into blocks
+/// by per-thread buffers, and a full block, or whatever is collected when
+/// the flush timer ticks, is copied into a file mapped to memory. Files
+/// are rotated when the next block does not fit.
+class access_log
+  : private boost::noncopyable
+{
+public:
+  /// Size limit of a block collected by a buffer.
+  enum { block_size = 64 * 1024 };
+
+  /// Longer URLs are truncated, so a record always fits into a block.
+  enum { max_url_size = 4 * 1024 };
+
+  /// Records of a single thread, which are not written yet.
+  class buffer
+    : private boost::noncopyable
+  {
+  public:
+    explicit buffer(access_log& log);
+
+    /// Add a record of the request, the block is written when it is full.
+    void append(access_record record, boost::string_ref url);
+
+    /// Write collected records. Shards call it by a timer, so records
+    /// of an idle thread are not kept in memory.
+    void flush();
+
+  private:
+    void write_records();
+
+    access_log& log_;
+
+    /// Taken by the owning thread and the flush timer only,
+    /// so it is not contended in general.
+    boost::mutex mutex_;
+    std::vector<access_record> records_;
+    std::string strings_;
+  };
+
+  /// Files are created in `directory`, each of `file_size` bytes
+  /// until it is closed.
+  access_log(std::string const& directory, std::size_t file_size);
+  ~access_log();
+
+  /// Fill network related fields of a record.
+  static void set_endpoint(access_record& record,
+                           boost::asio::ip::tcp::endpoint const& endpoint);
+
+  /// Method code of the request.
+  static access_method method_code(boost::string_ref method);
+
+  /// Current time in the format of records.
+  static boost::uint64_t now();
+
+  /// Truncate the current file to its content.
+  void close();
+
+  /// Count of records lost because of file errors.
+  std::size_t dropped() const
+  { return dropped_.load(boost::memory_order_relaxed); }
+
+  std::size_t written() const
+  { return written_.load(boost::memory_order_relaxed); }
+
+private:
+  /// Copy a block into the current file, rotating it if needed.
+  void write_block(std::vector<access_record> const& records,
+                   std::string const& strings);
+
+  /// Map a new file, the previous one must be closed.
+  void open_file();
+
+  /// Create the file named `file_name_` with space for `file_size_`
+  /// bytes, false if it exists. Errors are thrown.
+  bool create_file();
+
+  /// Unmap the current file and cut off its unused tail.
+  void close_file();
+
+  /// Logger instance and attributes.
+  logging::logger log_;
+
+  std::string directory_;
+  std::size_t file_size_;
+
+  /// Writes and rotations are serialized.
+  boost::mutex mutex_;
+  boost::scoped_ptr<boost::interprocess::mapped_region> region_;
+  std::string file_name_;
+  std::size_t position_;
+  std::size_t files_count_;
+
+  boost::atomic<std::size_t> written_;
+  boost::atomic<std::size_t> dropped_;
+};
+
+} // namespace eiptnd
+
+#endif // ACCESS_LOG_HPP
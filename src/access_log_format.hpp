@@ -0,0 +1,108 @@
+#ifndef ACCESS_LOG_FORMAT_HPP
+#define ACCESS_LOG_FORMAT_HPP
+
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+
+
+/// Layout of binary access log files. It is shared by the server and
+/// the offline decoder, values are stored in the native byte order.
+///
+/// A file starts with `access_file_header` followed by blocks. Every
+/// block is `access_block_header`, `records_count` records and a table
+/// of `strings_size` bytes which records refer to. Blocks are padded to
+/// 8 bytes. The unused tail of a file is zeroed, so a block with no
+/// records ends the file even if it was not closed properly.
+
+namespace eiptnd {
+
+/// Signature of an access log file.
+#define ACCESS_LOG_MAGIC "EIPTALOG"
+
+struct access_file_header
+{
+  enum { current_version = 1 };
+
+  char magic[8];
+  boost::uint32_t version;
+  boost::uint32_t record_size;
+};
+
+struct access_block_header
+{
+  boost::uint32_t records_count;
+  boost::uint32_t strings_size;
+};
+
+/// Request methods, unknown ones are stored as `other_method`.
+enum access_method
+{
+  other_method,
+  get_method,
+  head_method,
+  post_method,
+  put_method,
+  delete_method,
+  connect_method,
+  options_method,
+  trace_method,
+  patch_method,
+  methods_count
+};
+
+/// Names of methods indexed by `access_method`.
+inline const char* access_method_name(unsigned int method)
+{
+  static const char* const names[methods_count] = {
+    "OTHER", "GET", "HEAD", "POST", "PUT",
+    "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"
+  };
+  return method < methods_count ? names[method] : names[other_method];
+}
+
+/// A single served request.
+struct access_record
+{
+  enum flags_type
+  {
+    ipv6_flag = 1,   ///< address holds 16 bytes, otherwise only 4
+    http11_flag = 2  ///< the request was HTTP/1.1, otherwise HTTP/1.0
+  };
+
+  /// Completion time, nanoseconds since the Unix epoch.
+  boost::uint64_t timestamp;
+
+  /// Time from receiving the request head to sending the response.
+  boost::uint64_t latency;
+
+  /// Response size including the status line and header fields.
+  boost::uint64_t bytes_sent;
+
+  /// Remote endpoint, the address is in the network byte order.
+  boost::uint8_t address[16];
+  boost::uint16_t port;
+
+  boost::uint16_t status;
+  boost::uint8_t method;
+  boost::uint8_t flags;
+  boost::uint16_t reserved;
+
+  /// URL location in the string table of the block.
+  boost::uint32_t url_offset;
+  boost::uint32_t url_size;
+};
+
+BOOST_STATIC_ASSERT(sizeof(access_file_header) == 16);
+BOOST_STATIC_ASSERT(sizeof(access_block_header) == 8);
+BOOST_STATIC_ASSERT(sizeof(access_record) == 56);
+
+/// Blocks are aligned, so records can be read in place.
+inline std::size_t access_block_padding(std::size_t size)
+{
+  return (8 - size % 8) % 8;
+}
+
+} // namespace eiptnd
+
+#endif // ACCESS_LOG_FORMAT_HPP
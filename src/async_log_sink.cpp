@@ -0,0 +1,220 @@
+#include "async_log_sink.hpp"
+
+#include <boost/chrono/duration.hpp>
+#include <boost/log/utility/formatting_ostream.hpp>
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Records passed to backends between two flushes.
+const std::size_t max_batch = 1024;
+
+/// Guards against a lost wake up of the writer.
+const boost::chrono::milliseconds wait_period(100);
+
+} // namespace
+
+async_log_sink::async_log_sink(std::size_t capacity, overflow_policy policy)
+  : boost::log::sinks::sink(true)
+  , mask_(1)
+  , policy_(policy)
+  , tail_(0)
+  , head_(0)
+  , written_(0)
+  , dropped_(0)
+  , writer_waits_(false)
+  , stopping_(false)
+{
+  while (mask_ < capacity) {
+    mask_ <<= 1;
+  }
+  slots_.reset(new slot[mask_]);
+  for (std::size_t i = 0; i < mask_; ++i) {
+    slots_[i].sequence.store(i, boost::memory_order_relaxed);
+  }
+  --mask_;
+}
+
+async_log_sink::~async_log_sink()
+{
+  stop();
+}
+
+void
+async_log_sink::start()
+{
+  writer_ = boost::thread(&async_log_sink::run, this);
+}
+
+void
+async_log_sink::stop()
+{
+  if (!writer_.joinable()) {
+    return;
+  }
+
+  stopping_.store(true);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    writer_cond_.notify_one();
+  }
+  writer_.join();
+}
+
+bool
+async_log_sink::will_consume(boost::log::attribute_value_set const&)
+{
+  // Severity is checked before records are opened
+  return true;
+}
+
+void
+async_log_sink::consume(boost::log::record_view const& rec)
+{
+  while (!try_push(rec)) {
+    if (policy_ == drop_on_overflow || !writer_.joinable() ||
+        stopping_.load(boost::memory_order_relaxed)) {
+      dropped_.fetch_add(1, boost::memory_order_relaxed);
+      return;
+    }
+    notify_writer();
+    boost::this_thread::yield();
+  }
+  notify_writer();
+}
+
+bool
+async_log_sink::try_consume(boost::log::record_view const& rec)
+{
+  if (!try_push(rec)) {
+    return false;
+  }
+  notify_writer();
+  return true;
+}
+
+void
+async_log_sink::flush()
+{
+  if (!writer_.joinable()) {
+    return;
+  }
+
+  std::size_t target = tail_.load(boost::memory_order_acquire);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  writer_cond_.notify_one();
+  while (written_.load(boost::memory_order_acquire) < target &&
+         !stopping_.load(boost::memory_order_relaxed)) {
+    flushed_cond_.wait_for(lock, wait_period);
+  }
+}
+
+bool
+async_log_sink::try_push(boost::log::record_view const& rec)
+{
+  std::size_t pos = tail_.load(boost::memory_order_relaxed);
+  for (;;) {
+    slot& s = slots_[pos & mask_];
+    std::size_t seq = s.sequence.load(boost::memory_order_acquire);
+    if (seq == pos) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      boost::memory_order_relaxed)) {
+        s.record = rec;
+        s.sequence.store(pos + 1, boost::memory_order_release);
+        return true;
+      }
+    }
+    else if (seq < pos) {
+      // The slot is still filled from the previous lap
+      return false;
+    }
+    else {
+      pos = tail_.load(boost::memory_order_relaxed);
+    }
+  }
+}
+
+bool
+async_log_sink::try_pop(boost::log::record_view& rec)
+{
+  slot& s = slots_[head_ & mask_];
+  if (s.sequence.load(boost::memory_order_acquire) != head_ + 1) {
+    return false;
+  }
+
+  rec.swap(s.record);
+  s.record = boost::log::record_view();
+  s.sequence.store(head_ + mask_ + 1, boost::memory_order_release);
+  ++head_;
+  return true;
+}
+
+void
+async_log_sink::notify_writer()
+{
+  // Pairs with the writer, which sets the flag and checks the queue again
+  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+  if (writer_waits_.load(boost::memory_order_relaxed)) {
+    boost::mutex::scoped_lock lock(mutex_);
+    writer_cond_.notify_one();
+  }
+}
+
+void
+async_log_sink::run()
+{
+  for (;;) {
+    if (write_batch()) {
+      continue;
+    }
+
+    if (stopping_.load()) {
+      break;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    flushed_cond_.notify_all();
+
+    writer_waits_.store(true);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (slots_[head_ & mask_].sequence.load(boost::memory_order_acquire)
+          != head_ + 1) {
+      writer_cond_.wait_for(lock, wait_period);
+    }
+    writer_waits_.store(false, boost::memory_order_relaxed);
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  flushed_cond_.notify_all();
+}
+
+std::size_t
+async_log_sink::write_batch()
+{
+  boost::log::record_view rec;
+  std::size_t count = 0;
+  while (count < max_batch && try_pop(rec)) {
+    for (output& out : outputs_) {
+      boost::log::formatting_ostream strm(message_);
+      message_.clear();
+      out.format(rec, strm);
+      strm.flush();
+      out.consume(rec, message_);
+    }
+    ++count;
+  }
+
+  if (count) {
+    for (output& out : outputs_) {
+      out.flush();
+    }
+    written_.store(head_, boost::memory_order_release);
+  }
+
+  return count;
+}
+
+} // namespace eiptnd
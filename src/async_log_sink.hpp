@@ -0,0 +1,131 @@
+#ifndef ASYNC_LOG_SINK_HPP
+#define ASYNC_LOG_SINK_HPP
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/log/core/record_view.hpp>
+#include <boost/log/expressions/formatter.hpp>
+#include <boost/log/sinks/sink.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+
+namespace eiptnd {
+
+/// Sink which hands records over to a dedicated writer thread through
+/// a bounded lock-free queue. The writer formats records in batches and
+/// flushes backends once per batch, so io_service threads never wait
+/// for the output and do not serialize on a sink mutex.
+class async_log_sink
+  : public boost::log::sinks::sink
+  , private boost::noncopyable
+{
+public:
+  /// What a logging thread does when the queue is full.
+  enum overflow_policy
+  {
+    block_on_overflow, ///< wait until the writer frees a slot
+    drop_on_overflow   ///< discard the record, it is counted as dropped
+  };
+
+  /// Queue capacity is rounded up to a power of two.
+  async_log_sink(std::size_t capacity, overflow_policy policy);
+  ~async_log_sink();
+
+  /// Add an output. Backends are called from the writer thread only,
+  /// so they should be added before start().
+  template <typename Backend>
+  void add_backend(boost::shared_ptr<Backend> const& backend,
+                   boost::log::formatter const& format)
+  {
+    output out;
+    out.format = format;
+    out.consume = [backend](boost::log::record_view const& rec,
+                            std::string const& message) {
+      backend->consume(rec, message);
+    };
+    out.flush = [backend]() { backend->flush(); };
+    outputs_.push_back(out);
+  }
+
+  /// Start the writer thread.
+  void start();
+
+  /// Write all queued records and stop the writer thread.
+  void stop();
+
+  /// Count of records discarded because of the queue overflow.
+  std::size_t dropped() const
+  { return dropped_.load(boost::memory_order_relaxed); }
+
+  // boost::log::sinks::sink
+  bool will_consume(boost::log::attribute_value_set const&);
+  void consume(boost::log::record_view const& rec);
+  bool try_consume(boost::log::record_view const& rec);
+  void flush();
+
+private:
+  struct output
+  {
+    boost::log::formatter format;
+    boost::function<void(boost::log::record_view const&,
+                         std::string const&)> consume;
+    boost::function<void()> flush;
+  };
+
+  /// Cell of the queue. Its sequence tells whether it is free
+  /// for the producer or filled for the consumer at this position.
+  struct slot
+  {
+    boost::atomic<std::size_t> sequence;
+    boost::log::record_view record;
+  };
+
+  /// Multiple producers, single consumer.
+  bool try_push(boost::log::record_view const& rec);
+  bool try_pop(boost::log::record_view& rec);
+
+  /// Wake the writer if it waits for records.
+  void notify_writer();
+
+  /// Writer thread loop.
+  void run();
+
+  /// Pass up to `max_batch` records to backends, return count of them.
+  std::size_t write_batch();
+
+  std::vector<output> outputs_;
+  std::string message_;
+
+  boost::scoped_array<slot> slots_;
+  std::size_t mask_;
+  overflow_policy policy_;
+
+  /// Producers' position, and consumer's one which is owned by the writer.
+  char pad0_[64];
+  boost::atomic<std::size_t> tail_;
+  char pad1_[64];
+  std::size_t head_;
+  /// Position up to which records are passed to backends and flushed.
+  boost::atomic<std::size_t> written_;
+  char pad2_[64];
+
+  boost::atomic<std::size_t> dropped_;
+
+  boost::mutex mutex_;
+  boost::condition_variable writer_cond_;
+  boost::condition_variable flushed_cond_;
+  boost::atomic<bool> writer_waits_;
+  boost::atomic<bool> stopping_;
+  boost::thread writer_;
+};
+
+} // namespace eiptnd
+
+#endif // ASYNC_LOG_SINK_HPP
@@ -2,9 +2,10 @@
 
 #include "core.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <boost/asio/read.hpp>
 #include <boost/asio/read_until.hpp>
-#include <boost/asio/write.hpp>
 #include <boost/bind.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 #include <boost/lexical_cast.hpp>
@@ -13,6 +14,12 @@
 
 #include "http/http_connection.hpp"
 
+#ifdef ENABLE_SENDFILE_TRANSFER
+#include <cerrno>
+#include <cstring>
+#include <sys/sendfile.h>
+#endif
+
 
 namespace eiptnd {
 
@@ -20,38 +27,140 @@ std::string const& connection::get_webroot() const
 { return core_.get_webroot(); }
 
 
-connection::connection(core const& core)
+connection::connection(core const& core, boost::shared_ptr<io_shard> const& shard)
   : log_(boost::log::keywords::channel = "connection")
+  , net_raddr_(std::string())
   , core_(core)
-  , io_service_(core_.get_ios())
-  , strand_(*io_service_)
+  , shard_(shard.get())
+  , io_service_(shard->get_ios())
+  , strand_(shard->is_multithreaded()
+            ? new boost::asio::io_service::strand(*io_service_) : 0)
   , socket_(*io_service_)
+  , timer_wheel_(shard->get_timer_wheel())
+  , read_timeout_(core_.get_header_timeout())
+  , output_head_(0)
+  , output_buffers_head_(0)
+  , write_buffers_head_(0)
+  , writing_entries_(0)
+  , output_active_(false)
+  , output_bytes_(0)
+  , response_start_pending_(false)
+#ifdef ENABLE_IO_URING
+  , receiving_(false)
+  , receive_key_(0)
+  , read_kind_(no_read)
+  , read_sbuf_(0)
+  , read_minimum_(0)
+  , read_transferred_(0)
+#endif
   , sent_bytes_(0)
   , recieved_bytes_(0)
   , reads_count_(0)
   , writes_count_(0)
 {
   /// NOTE: There is no real conection here, only waiting for it.
+  log_.add_attribute("RemoteAddress", net_raddr_);
 }
 
 connection::~connection()
 {
+  timer_wheel_->cancel(timeout_entry_);
   BOOST_LOG_SEV(log_, logging::info) << "Session is destroyed";
 }
 
+boost::shared_ptr<connection>
+connection::create(core const& core, boost::shared_ptr<io_shard> const& shard)
+{
+  connection* raw = 0;
+  if (io_shard::thread_context* context = shard->this_thread_context()) {
+    raw = context->connections.acquire();
+  }
+  if (!raw) {
+    raw = new connection(core, shard);
+  }
+
+  boost::shared_ptr<connection> p(raw, &connection::recycle);
+  p->weak_this_ = p;
+  boost::weak_ptr<connection> weak = p;
+  p->timeout_entry_.on_expire = [weak]() {
+    if (auto self = weak.lock()) {
+      self->post_in_strand(boost::bind(&connection::handle_timeout, self));
+    }
+  };
+  return p;
+}
+
+void
+connection::recycle(connection* p)
+{
+  p->reset();
+
+  // Only the threads of the connection's shard may reuse it, because
+  // the strand, the socket and the timer wheel are bound to the shard.
+  io_shard::thread_context* context = p->shard_->this_thread_context();
+  if (!context || !context->connections.release(p)) {
+    delete p;
+  }
+}
+
+void
+connection::reset()
+{
+  timer_wheel_->cancel(timeout_entry_);
+  timeout_entry_.on_expire.clear();
+
+  // The last reference may be dropped by another thread, e.g. a gzip
+  // worker, so the socket is closed here only if it is not closed yet
+  close_socket();
+
+  // Objects which never got a connection (e.g. spares of the acceptor)
+  // are recycled quietly
+  if (remote_endpoint_.port()) {
+    BOOST_LOG_SEV(log_, logging::info) << "Session is finished";
+  }
+
+  process_handler_.reset();
+  abort_output();
+#ifdef ENABLE_IO_URING
+  received_.clear();
+  receive_error_ = boost::system::error_code();
+  receiving_ = false;
+  read_kind_ = no_read;
+  read_sbuf_ = 0;
+  read_handler_.reset();
+#endif
+  weak_this_.reset();
+  remote_endpoint_ = boost::asio::ip::tcp::endpoint();
+  net_raddr_.set(std::string());
+  read_timeout_ = core_.get_header_timeout();
+  sent_bytes_ = recieved_bytes_ = 0;
+  reads_count_ = writes_count_ = 0;
+}
+
 void
 connection::on_connection()
 {
-  remote_endpoint_ = socket_.remote_endpoint();
+  boost::system::error_code ec;
+  remote_endpoint_ = socket_.remote_endpoint(ec);
+  if (ec) {
+    // Client could have gone before the connection was set up
+    BOOST_LOG_SEV(log_, logging::debug)
+      << "Connection is lost: " << ec.message() << " (" << ec.value() << ")";
+    close();
+    return;
+  }
 
-  boost::log::attributes::constant<std::string> addr(
-      boost::lexical_cast<std::string>(remote_endpoint_));
-  net_raddr_ = log_.add_attribute("RemoteAddress", addr).first;
+  std::string addr = boost::lexical_cast<std::string>(remote_endpoint_);
+  net_raddr_.set(addr);
 
-  BOOST_LOG_CHANNEL_SEV(log_, "connection@" + addr.get(), logging::info)
+  if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+    metrics->connections_opened.inc();
+  }
+
+  BOOST_LOG_CHANNEL_SEV(log_, "connection@" + addr, logging::info)
     << "Connection accepted";
 
-  auto ptr = boost::make_shared<process_handler_t>(shared_from_this());
+  auto ptr = process_handler_t::create(shared_from_this());
   process_handler_ = ptr;
   ptr->handle_start();
 }
@@ -63,7 +172,7 @@ connection::post_in_strand(boost::function<void()> f)
     << "post_in_strand()";
 
   /// TODO: Maybe add inderection level with exception catching for safety?
-  io_service_->post(strand_.wrap(f));
+  io_service_->post(wrap(f));
 }
 
 void
@@ -73,7 +182,21 @@ connection::dispatch_in_strand(boost::function<void()> f)
     << "dispatch_in_strand()";
 
   /// TODO: Maybe add inderection level with exception catching for safety?
-  io_service_->dispatch(strand_.wrap(f));
+  io_service_->dispatch(wrap(f));
+}
+
+template <typename Read>
+bool
+connection::defer_read_if_congested(Read read)
+{
+  // A client which does not read responses is not read from either.
+  // The read is started again when the output drains below the low
+  // watermark, see complete_output().
+  if (!is_output_congested()) {
+    return false;
+  }
+  deferred_read_ = read;
+  return true;
 }
 
 void
@@ -82,8 +205,59 @@ connection::do_read_at_least(boost::asio::streambuf& sbuf, std::size_t minimum)
   BOOST_LOG_SEV(log_, logging::flood)
     << "do_read_at_least(): " << minimum << " bytes";
 
+  if (defer_read_if_congested(
+        boost::bind(&connection::do_read_at_least, this, boost::ref(sbuf), minimum))) {
+    return;
+  }
+
+  start_timeout(read_timeout_);
+
+#ifdef ENABLE_IO_URING
+  if (shard_->get_uring()) {
+    read_sbuf_ = &sbuf;
+    start_received_read(read_at_least, minimum);
+    return;
+  }
+#endif
+
   boost::asio::async_read(socket_, sbuf, boost::asio::transfer_at_least(minimum),
-      strand_.wrap(
+      wrap(
+        boost::bind(&connection::handle_read, shared_from_this(), process_handler_.lock(), _1, _2)));
+}
+
+void
+connection::start_read_deadline(timer_wheel::duration timeout)
+{
+  start_timeout(timeout);
+}
+
+void
+connection::start_response_deadline()
+{
+  start_timeout(core_.get_write_timeout());
+}
+
+void
+connection::do_read_more(boost::asio::streambuf& sbuf, std::size_t minimum)
+{
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "do_read_more(): " << minimum << " bytes";
+
+  if (defer_read_if_congested(
+        boost::bind(&connection::do_read_more, this, boost::ref(sbuf), minimum))) {
+    return;
+  }
+
+#ifdef ENABLE_IO_URING
+  if (shard_->get_uring()) {
+    read_sbuf_ = &sbuf;
+    start_received_read(read_at_least, minimum);
+    return;
+  }
+#endif
+
+  boost::asio::async_read(socket_, sbuf, boost::asio::transfer_at_least(minimum),
+      wrap(
         boost::bind(&connection::handle_read, shared_from_this(), process_handler_.lock(), _1, _2)));
 }
 
@@ -93,8 +267,24 @@ connection::do_read_until(boost::asio::streambuf& sbuf, const std::string& delim
   BOOST_LOG_SEV(log_, logging::flood)
     << "do_read_until(): " << boost::log::dump(delim.data(), delim.size());
 
+  if (defer_read_if_congested(
+        boost::bind(&connection::do_read_until, this, boost::ref(sbuf), delim))) {
+    return;
+  }
+
+  start_timeout(read_timeout_);
+
+#ifdef ENABLE_IO_URING
+  if (shard_->get_uring()) {
+    read_sbuf_ = &sbuf;
+    read_delim_ = delim;
+    start_received_read(read_until, 0);
+    return;
+  }
+#endif
+
   boost::asio::async_read_until(socket_, sbuf, delim,
-      strand_.wrap(
+      wrap(
         boost::bind(&connection::handle_read, shared_from_this(), process_handler_.lock(), _1, _2)));
 }
 
@@ -104,8 +294,23 @@ connection::do_read_some(const boost::asio::mutable_buffer& buffers)
   BOOST_LOG_SEV(log_, logging::flood)
     << "do_read_some(): " << boost::asio::buffer_size(buffers) << " bytes";
 
+  if (defer_read_if_congested(
+        boost::bind(&connection::do_read_some, this, buffers))) {
+    return;
+  }
+
+  start_timeout(read_timeout_);
+
+#ifdef ENABLE_IO_URING
+  if (shard_->get_uring()) {
+    read_buffer_ = buffers;
+    start_received_read(read_some, 0);
+    return;
+  }
+#endif
+
   socket_.async_read_some(boost::asio::mutable_buffers_1(buffers),
-      strand_.wrap(
+      wrap(
         boost::bind(&connection::handle_read, shared_from_this(), process_handler_.lock(), _1, _2)));
 }
 
@@ -115,10 +320,27 @@ connection::do_write(const boost::asio::const_buffer& buffers)
   BOOST_LOG_SEV(log_, logging::flood)
     << "do_write(): " << boost::asio::buffer_size(buffers) << " bytes";
 
-  boost::asio::async_write(socket_,
-      boost::asio::const_buffers_1(buffers),
-      strand_.wrap(
-        boost::bind(&connection::handle_write, shared_from_this(), process_handler_.lock(), _1, _2)));
+  boost::shared_ptr<process_handler_t> handler = process_handler_.lock();
+  enqueue_output(&buffers, &buffers + 1, [handler]() {
+    if (handler) {
+      handler->handle_write();
+    }
+  });
+}
+
+void
+connection::do_write(std::vector<boost::asio::const_buffer> const& buffers)
+{
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "do_write(): " << boost::asio::buffer_size(buffers) << " bytes in "
+    << buffers.size() << " buffers";
+
+  boost::shared_ptr<process_handler_t> handler = process_handler_.lock();
+  enqueue_output(buffers.begin(), buffers.end(), [handler]() {
+    if (handler) {
+      handler->handle_write();
+    }
+  });
 }
 
 void
@@ -127,10 +349,141 @@ connection::do_write_cb(const boost::asio::const_buffer& buffers, boost::functio
   BOOST_LOG_SEV(log_, logging::flood)
     << "do_write_cb(): " << boost::asio::buffer_size(buffers) << " bytes";
 
-  boost::asio::async_write(socket_,
-      boost::asio::const_buffers_1(buffers),
-      strand_.wrap(
-        boost::bind(&connection::handle_write_cb, shared_from_this(), process_handler_.lock(), f, _1, _2)));
+  enqueue_output(&buffers, &buffers + 1, boost::move(f));
+}
+
+void
+connection::do_write_cb(std::vector<boost::asio::const_buffer> const& buffers,
+                        boost::function<void()> f)
+{
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "do_write_cb(): " << boost::asio::buffer_size(buffers) << " bytes in "
+    << buffers.size() << " buffers";
+
+  enqueue_output(buffers.begin(), buffers.end(), boost::move(f));
+}
+
+#ifdef ENABLE_SENDFILE_TRANSFER
+void
+connection::do_sendfile(int fd, boost::uint64_t offset, boost::uint64_t count,
+                        boost::function<void()> f)
+{
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "do_sendfile(): " << count << " bytes from " << offset;
+
+  output_entry entry;
+  entry.buffers_count = 0;
+  entry.bytes = 0;
+  entry.fd = fd;
+  entry.offset = offset;
+  entry.count = count;
+  take_response_start(entry);
+  entry.callback.swap(f);
+  output_entries_.push_back(boost::move(entry));
+
+  start_output();
+}
+#endif
+
+void
+connection::take_response_start(output_entry& entry)
+{
+  entry.first_of_response = response_start_pending_;
+  entry.response_start = response_start_;
+  response_start_pending_ = false;
+}
+
+template <typename Iterator>
+void
+connection::enqueue_output(Iterator first, Iterator last,
+                           boost::function<void()> f)
+{
+  output_entry entry;
+  entry.buffers_count = 0;
+  entry.bytes = 0;
+  entry.fd = -1;
+  entry.offset = entry.count = 0;
+  take_response_start(entry);
+  entry.callback.swap(f);
+  for (; first != last; ++first) {
+    output_buffers_.push_back(*first);
+    entry.bytes += boost::asio::buffer_size(*first);
+    ++entry.buffers_count;
+  }
+
+  output_bytes_ += entry.bytes;
+  output_entries_.push_back(boost::move(entry));
+
+  start_output();
+}
+
+bool
+connection::is_output_congested() const
+{
+  return output_bytes_ > core_.get_write_high_watermark();
+}
+
+void
+connection::on_writable(boost::function<void()> f)
+{
+  if (!is_output_congested()) {
+    post_in_strand(f);
+    return;
+  }
+  writable_callback_.swap(f);
+}
+
+void
+connection::start_output()
+{
+  if (output_active_ || output_head_ == output_entries_.size()) {
+    return;
+  }
+
+  output_active_ = true;
+  start_timeout(core_.get_write_timeout());
+
+#ifdef ENABLE_SENDFILE_TRANSFER
+  output_entry const& head = output_entries_[output_head_];
+  if (head.fd != -1) {
+    writing_entries_ = 1;
+    dispatch_in_strand(
+        boost::bind(&connection::handle_sendfile, shared_from_this(),
+                    process_handler_.lock(), head.fd, head.offset, head.count,
+                    boost::system::error_code()));
+    return;
+  }
+#endif
+
+  // Consecutive buffer entries are gathered up to a file region
+  write_buffers_.clear();
+  writing_entries_ = 0;
+  std::size_t next_buffer = output_buffers_head_;
+  for (std::size_t i = output_head_; i < output_entries_.size(); ++i) {
+    output_entry const& entry = output_entries_[i];
+    if (entry.fd != -1 || (writing_entries_ &&
+        write_buffers_.size() + entry.buffers_count > max_gathered_buffers)) {
+      break;
+    }
+    write_buffers_.insert(write_buffers_.end(),
+                          output_buffers_.begin() + next_buffer,
+                          output_buffers_.begin() + next_buffer +
+                            entry.buffers_count);
+    next_buffer += entry.buffers_count;
+    ++writing_entries_;
+  }
+
+  write_buffers_head_ = 0;
+  write_gathered();
+}
+
+void
+connection::write_gathered()
+{
+  gathered_buffers buffers = { &write_buffers_, write_buffers_head_ };
+  socket_.async_write_some(buffers,
+      wrap(
+        boost::bind(&connection::handle_output, shared_from_this(), process_handler_.lock(), _1, _2)));
 }
 
 void
@@ -145,6 +498,9 @@ connection::handle_read(
 
     ++reads_count_;
     recieved_bytes_ += bytes_transferred;
+    if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+      metrics->bytes_received.add(bytes_transferred);
+    }
     try {
       process_handler->handle_read(bytes_transferred);
     }
@@ -169,46 +525,224 @@ connection::handle_read(
   }
 }
 
+#ifdef ENABLE_IO_URING
 void
-connection::handle_write(
-    boost::shared_ptr<process_handler_t> process_handler,
-    const boost::system::error_code& ec,
-    std::size_t bytes_transferred)
+connection::start_received_read(read_kind kind, std::size_t minimum)
 {
-  if (!ec) {
-    BOOST_LOG_SEV(log_, logging::flood)
-      << "handle_write(): " << bytes_transferred << " bytes";
+  read_kind_ = kind;
+  read_minimum_ = minimum;
+  read_transferred_ = 0;
+  read_handler_ = process_handler_.lock();
+  deliver_received();
+}
 
-    ++writes_count_;
-    sent_bytes_ += bytes_transferred;
-    try {
-      process_handler->handle_write();
+void
+connection::start_receiving()
+{
+  receiving_ = true;
+  receive_key_ = shard_->get_uring()->async_receive(socket_.native_handle(),
+      wrap(
+        boost::bind(&connection::handle_received, shared_from_this(),
+                    _1, _2, _3, _4, _5)));
+}
+
+void
+connection::handle_received(const boost::system::error_code& ec,
+                            const char* data, std::size_t size, int buffer,
+                            bool more)
+{
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "handle_received(): " << size << " bytes";
+
+  if (size) {
+    // Data goes to the pending read, unless older data is waiting
+    std::size_t taken = received_.empty() ? take_received(data, size) : 0;
+    received_.insert(received_.end(), data + taken, data + size);
+  }
+  if (buffer >= 0) {
+    shard_->get_uring()->release_buffer(buffer);
+  }
+
+  if (!more) {
+    receiving_ = false;
+    if (ec == boost::asio::error::operation_aborted) {
+      // It is stopped by the limit unless the connection is closed
+      if (!socket_.is_open()) {
+        receive_error_ = ec;
+      }
     }
-    catch (...) {
-      BOOST_LOG_SEV(log_, logging::critical)
-        << "Exception in translator handle_write(): "
-        << boost::current_exception_diagnostic_information();
-      close();
+    else if (ec && ec != boost::asio::error::no_buffer_space) {
+      receive_error_ = ec;
     }
   }
-  else {
+  else if (received_.size() > max_received_size) {
+    // A client which does not read responses is not read from either
+    shard_->get_uring()->cancel_receive(receive_key_);
+  }
+
+  deliver_received();
+}
+
+std::size_t
+connection::take_received(const char* data, std::size_t size)
+{
+  std::size_t taken = 0;
+  switch (read_kind_) {
+  case read_some:
+    taken = std::min(size,
+        boost::asio::buffer_size(read_buffer_) - read_transferred_);
+    std::memcpy(boost::asio::buffer_cast<char*>(read_buffer_) +
+                  read_transferred_, data, taken);
+    break;
+  case read_at_least:
+  case read_until:
+    taken = std::min(size, read_sbuf_->max_size() - read_sbuf_->size());
+    boost::asio::buffer_copy(read_sbuf_->prepare(taken),
+                             boost::asio::buffer(data, taken));
+    read_sbuf_->commit(taken);
+    break;
+  default:
+    break;
+  }
+  read_transferred_ += taken;
+  return taken;
+}
+
+void
+connection::deliver_received()
+{
+  if (read_kind_ == no_read) {
+    return;
+  }
+
+  if (!received_.empty()) {
+    std::size_t taken = take_received(&received_[0], received_.size());
+    received_.erase(received_.begin(), received_.begin() + taken);
+  }
+
+  bool done = false;
+  std::size_t bytes = read_transferred_;
+  switch (read_kind_) {
+  case read_at_least:
+    done = read_transferred_ >= read_minimum_;
+    break;
+  case read_until:
+    {
+      const char* begin =
+          boost::asio::buffer_cast<const char*>(read_sbuf_->data());
+      const char* end = begin + read_sbuf_->size();
+      const char* found = std::search(begin, end,
+                                      read_delim_.begin(), read_delim_.end());
+      if (found != end) {
+        done = true;
+        bytes = static_cast<std::size_t>(found - begin) + read_delim_.size();
+      }
+    }
+    break;
+  case read_some:
+    done = read_transferred_ > 0 ||
+           boost::asio::buffer_size(read_buffer_) == 0;
+    break;
+  default:
+    break;
+  }
+
+  boost::system::error_code ec;
+  if (!done && !received_.empty()) {
+    // The buffer of the read is full
+    if (read_kind_ == read_until) {
+      ec = boost::asio::error::not_found;
+    }
+    done = true;
+  }
+  if (!done) {
+    if (!receive_error_) {
+      if (!receiving_) {
+        start_receiving();
+      }
+      return;
+    }
+    ec = receive_error_;
+  }
+
+  read_kind_ = no_read;
+  boost::shared_ptr<process_handler_t> process_handler;
+  process_handler.swap(read_handler_);
+  handle_read(process_handler, ec, bytes);
+}
+#endif
+
+void
+connection::handle_output(
+    boost::shared_ptr<process_handler_t> /*process_handler*/,
+    const boost::system::error_code& ec, std::size_t bytes_transferred)
+{
+  if (ec) {
     BOOST_LOG_SEV(log_, logging::error)
       << "Writing failed: " << ec.message() << " (" << ec.value() << ")";
+    abort_output();
+    // A connection with a broken response must not read the next request
+    if (ec != boost::asio::error::operation_aborted) {
+      close();
+    }
+    return;
   }
+
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "handle_output(): " << bytes_transferred << " bytes in "
+    << writing_entries_ << " writes";
+
+  ++writes_count_;
+  sent_bytes_ += bytes_transferred;
+  if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+    metrics->bytes_sent.add(bytes_transferred);
+  }
+
+  // Skip written buffers, the last one may be written partially
+  std::size_t left = bytes_transferred;
+  while (write_buffers_head_ < write_buffers_.size()) {
+    boost::asio::const_buffer& buffer = write_buffers_[write_buffers_head_];
+    std::size_t size = boost::asio::buffer_size(buffer);
+    if (left < size) {
+      buffer = buffer + left;
+      break;
+    }
+    left -= size;
+    ++write_buffers_head_;
+  }
+
+  if (write_buffers_head_ < write_buffers_.size()) {
+    // The client is slow, but the write is not stalled
+    start_timeout(core_.get_write_timeout());
+    write_gathered();
+    return;
+  }
+
+  complete_output(writing_entries_);
 }
 
 void
-connection::handle_write_cb(
-    boost::shared_ptr<process_handler_t> /*process_handler*/,
-    boost::function<void()> f, const boost::system::error_code& ec,
-    std::size_t bytes_transferred)
+connection::complete_output(std::size_t entries_count)
 {
-  if (!ec) {
-    BOOST_LOG_SEV(log_, logging::flood)
-      << "handle_write_cb(): " << bytes_transferred << " bytes";
+  for (std::size_t i = 0; i < entries_count; ++i) {
+    // The entry is left before the callback, which may queue more output
+    boost::function<void()> f;
+    {
+      output_entry& entry = output_entries_[output_head_++];
+      output_bytes_ -= entry.bytes;
+      output_buffers_head_ += entry.buffers_count;
+      f.swap(entry.callback);
+
+      if (entry.first_of_response) {
+        if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+          metrics->first_byte.record(static_cast<boost::uint64_t>(
+              boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                boost::chrono::steady_clock::now() -
+                  entry.response_start).count()));
+        }
+      }
+    }
 
-    ++writes_count_;
-    sent_bytes_ += bytes_transferred;
     try {
       f();
     }
@@ -217,22 +751,316 @@ connection::handle_write_cb(
         << "Exception in translator write_callback(): "
         << boost::current_exception_diagnostic_information();
       close();
+      abort_output();
+      return;
     }
   }
-  else {
+
+  if (output_head_ == output_entries_.size()) {
+    output_entries_.clear();
+    output_buffers_.clear();
+    output_head_ = output_buffers_head_ = 0;
+  }
+  else if (output_head_ * 2 > output_entries_.size()) {
+    // A producer keeps the queue busy, so done entries are dropped here
+    output_entries_.erase(output_entries_.begin(),
+                          output_entries_.begin() + output_head_);
+    output_buffers_.erase(output_buffers_.begin(),
+                          output_buffers_.begin() + output_buffers_head_);
+    output_head_ = output_buffers_head_ = 0;
+  }
+
+  output_active_ = false;
+  start_output();
+
+  if (output_bytes_ <= core_.get_write_low_watermark()) {
+    if (deferred_read_) {
+      boost::function<void()> read;
+      read.swap(deferred_read_);
+      read();
+    }
+    if (writable_callback_) {
+      boost::function<void()> f;
+      f.swap(writable_callback_);
+      post_in_strand(f);
+    }
+  }
+}
+
+void
+connection::abort_output()
+{
+  // Callbacks may own the handler which owns the connection,
+  // so they are released after the queue is consistent
+  std::vector<output_entry> entries;
+  entries.swap(output_entries_);
+  output_buffers_.clear();
+  write_buffers_.clear();
+  output_head_ = output_buffers_head_ = 0;
+  write_buffers_head_ = 0;
+  writing_entries_ = 0;
+  output_active_ = false;
+  output_bytes_ = 0;
+  response_start_pending_ = false;
+
+  boost::function<void()> read, writable;
+  read.swap(deferred_read_);
+  writable.swap(writable_callback_);
+}
+
+#ifdef ENABLE_SENDFILE_TRANSFER
+void
+connection::handle_sendfile(
+    boost::shared_ptr<process_handler_t> process_handler,
+    int fd, boost::uint64_t offset, boost::uint64_t count,
+    const boost::system::error_code& ec)
+{
+  /// Limit of bytes sent in one handler invocation, so a fast client
+  /// downloading a huge file does not monopolize the thread.
+  static const boost::uint64_t max_bytes_per_turn = 4 * 1024 * 1024;
+
+  if (ec) {
     BOOST_LOG_SEV(log_, logging::error)
-      << "Writing failed: " << ec.message() << " (" << ec.value() << ")";
+      << "Sending file failed: " << ec.message() << " (" << ec.value() << ")";
+    abort_output();
+    if (ec != boost::asio::error::operation_aborted) {
+      close();
+    }
+    return;
+  }
+
+#ifdef ENABLE_IO_URING
+  if (uring_engine* uring = shard_->get_uring()) {
+    uring->async_send_file(socket_.native_handle(), fd, offset, count,
+        wrap(
+          boost::bind(&connection::handle_file_sent, shared_from_this(), process_handler,
+                      fd, offset, count, _1, _2)));
+    return;
+  }
+#endif
+
+  boost::system::error_code nb_ec;
+  socket_.native_non_blocking(true, nb_ec);
+
+  boost::uint64_t turn_bytes = 0;
+  while (count > 0 && turn_bytes < max_bytes_per_turn) {
+    off_t off = static_cast<off_t>(offset);
+    ssize_t n = ::sendfile(socket_.native_handle(), fd, &off,
+        static_cast<std::size_t>(std::min(count, max_bytes_per_turn - turn_bytes)));
+    if (n > 0) {
+      boost::uint64_t sent = static_cast<boost::uint64_t>(n);
+      offset += sent;
+      count -= sent;
+      turn_bytes += sent;
+      sent_bytes_ += sent;
+    }
+    else if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    else {
+      // Zero is returned when the file was truncated while sending
+      BOOST_LOG_SEV(log_, logging::error)
+        << "Sending file failed: "
+        << (n < 0 ? std::strerror(errno) : "unexpected end of file");
+      close();
+      abort_output();
+      return;
+    }
+  }
+
+  if (turn_bytes) {
+    if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+      metrics->bytes_sent.add(turn_bytes);
+    }
+  }
+
+  if (count > 0) {
+    // The write is not stalled while the data is being accepted
+    if (turn_bytes) {
+      start_timeout(core_.get_write_timeout());
+    }
+
+    // Resume when the socket becomes writable again
+    socket_.async_write_some(boost::asio::null_buffers(),
+        wrap(
+          boost::bind(&connection::handle_sendfile, shared_from_this(), process_handler,
+                      fd, offset, count, _1)));
+    return;
+  }
+
+  BOOST_LOG_SEV(log_, logging::flood) << "handle_sendfile(): done";
+
+  ++writes_count_;
+  complete_output(1);
+}
+
+#ifdef ENABLE_IO_URING
+void
+connection::handle_file_sent(
+    boost::shared_ptr<process_handler_t> process_handler,
+    int fd, boost::uint64_t offset, boost::uint64_t count,
+    const boost::system::error_code& ec, std::size_t bytes_transferred)
+{
+  if (ec) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Sending file failed: " << ec.message() << " (" << ec.value() << ")";
+    abort_output();
+    if (ec != boost::asio::error::operation_aborted) {
+      close();
+    }
+    return;
+  }
+
+  offset += bytes_transferred;
+  count -= bytes_transferred;
+  sent_bytes_ += bytes_transferred;
+  if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+    metrics->bytes_sent.add(bytes_transferred);
+  }
+
+  if (count > 0) {
+    start_timeout(core_.get_write_timeout());
+    handle_sendfile(process_handler, fd, offset, count,
+                    boost::system::error_code());
+    return;
+  }
+
+  BOOST_LOG_SEV(log_, logging::flood) << "handle_file_sent(): done";
+
+  ++writes_count_;
+  complete_output(1);
+}
+#endif
+#endif
+
+void
+connection::start_timeout(timer_wheel::duration timeout)
+{
+  if (timeout.is_special() || timeout.is_negative() || timeout.ticks() == 0) {
+    timer_wheel_->cancel(timeout_entry_);
+  }
+  else {
+    timer_wheel_->schedule(timeout_entry_, timeout);
   }
 }
 
+void
+connection::handle_timeout()
+{
+  BOOST_LOG_SEV(log_, logging::info) << "Connection timed out";
+
+  close();
+}
+
 void
 connection::close()
 {
   BOOST_LOG_SEV(log_, logging::trace) << "Closing connection";
 
+#ifdef ENABLE_IO_URING
+  if (uring_engine* uring = shard_->get_uring()) {
+    if (socket_.is_open()) {
+      // Requests in flight hold the socket, closing does not end them
+      uring->cancel(socket_.native_handle());
+    }
+    if (!receive_error_) {
+      receive_error_ = boost::asio::error::operation_aborted;
+    }
+    if (read_kind_ != no_read && !receiving_) {
+      post_in_strand(boost::bind(&connection::deliver_received,
+                                 shared_from_this()));
+    }
+  }
+#endif
+
+  close_socket();
+}
+
+void
+connection::close_socket()
+{
+  if (!socket_.is_open()) {
+    return;
+  }
+
+  if (remote_endpoint_.port()) {
+    if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+      metrics->connections_closed.inc();
+    }
+  }
+
   boost::system::error_code ignored_ec;
   socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
-  socket_.close();
+  socket_.close(ignored_ec);
+}
+
+void
+connection::linger_close()
+{
+  BOOST_LOG_SEV(log_, logging::trace) << "Lingering connection";
+
+#ifdef ENABLE_IO_URING
+  if (uring_engine* uring = shard_->get_uring()) {
+    // Input is discarded through the reactor, received data is dropped
+    if (socket_.is_open()) {
+      uring->cancel(socket_.native_handle());
+    }
+    if (!receive_error_) {
+      receive_error_ = boost::asio::error::operation_aborted;
+    }
+    received_.clear();
+  }
+#endif
+
+  boost::system::error_code ec;
+  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+  if (!ec) {
+    socket_.non_blocking(true, ec);
+  }
+  if (ec) {
+    close();
+    return;
+  }
+
+  // The deadline is not rearmed by reads, so it limits the whole lingering
+  start_timeout(core_.get_linger_timeout());
+  do_linger();
+}
+
+void
+connection::do_linger()
+{
+  socket_.async_read_some(boost::asio::null_buffers(),
+      wrap(
+        boost::bind(&connection::handle_linger, shared_from_this(), _1)));
+}
+
+void
+connection::handle_linger(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted) {
+    // Closed by the timeout
+    return;
+  }
+
+  char discarded[4096];
+  boost::system::error_code read_ec = ec;
+  while (!read_ec) {
+    std::size_t n = socket_.read_some(boost::asio::buffer(discarded), read_ec);
+    recieved_bytes_ += n;
+  }
+
+  if (read_ec == boost::asio::error::would_block) {
+    do_linger();
+    return;
+  }
+
+  BOOST_LOG_SEV(log_, logging::debug)
+    << "Lingering is ended: " << read_ec.message();
+  close();
 }
 
 } // namespace eiptnd
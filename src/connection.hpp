@@ -1,18 +1,33 @@
 #ifndef CONNECTION_HPP
 #define CONNECTION_HPP
 
+#include "connection_handler.hpp"
+#include "handler_memory.hpp"
+#include "io_shard.hpp"
 #include "log.hpp"
+#include "timer_wheel.hpp"
 
+#include <vector>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/asio/streambuf.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/log/attributes/mutable_constant.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 
+#if defined(__linux__)
+/// Response bodies are sent by sendfile(2) straight from the page cache.
+# define ENABLE_SENDFILE_TRANSFER
+#endif
+
 
 namespace eiptnd {
 
@@ -27,7 +42,7 @@ class connection
   typedef http_connection process_handler_t;
 public:
 //private:
-  explicit connection(core const& core);
+  connection(core const& core, boost::shared_ptr<io_shard> const& shard);
 
   //friend boost::shared_ptr<connection> boost::make_shared(core&);
   //friend boost::detail::sp_if_not_array<connection>::type /*::boost::*/make_shared(core&);
@@ -35,15 +50,18 @@ public:
 public:
   ~connection();
 
-  static boost::shared_ptr<connection> create(core const& core)
-  {
-    boost::shared_ptr<connection> p = boost::make_shared<connection>(core);
-    p->weak_this_ = p;
-    return p;
-  }
+  /// Take a finished connection from the pool of the calling thread
+  /// or construct a new one. The object returns to the pool when
+  /// the last reference is dropped.
+  static boost::shared_ptr<connection> create(
+      core const& core, boost::shared_ptr<io_shard> const& shard);
 
   std::string const& get_webroot() const;
 
+  core const& get_core() const { return core_; }
+
+  io_shard* get_shard() const { return shard_; }
+
   /// Get the socket associated with the connection.
 private: boost::asio::ip::tcp::socket& socket() { return socket_; }
 public:  boost::asio::ip::tcp::socket const& socket() const { return socket_; }
@@ -58,14 +76,70 @@ public:  boost::weak_ptr<process_handler_t> const& process_handler() const { ret
   /// Initiate graceful connection closure.
   void close();
 
+  /// Close the connection after its output is written. Unread requests
+  /// make the kernel reset a closed connection, and the client may lose
+  /// responses it has not received yet. So sending is shut down first,
+  /// and input is discarded until the client closes its side or the
+  /// linger timeout expires.
+  void linger_close();
+
+  /// Time limit for the next read operations (non-positive disables it).
+  void set_read_timeout(timer_wheel::duration timeout)
+  { read_timeout_ = timeout; }
+
   /// Reading API.
   void do_read_some(const boost::asio::mutable_buffer& buffer);
   void do_read_until(boost::asio::streambuf& sbuf, const std::string& delim);
   void do_read_at_least(boost::asio::streambuf& sbuf, std::size_t minimum);
 
-  /// Writing API.
+  /// Arm the deadline of a message which is received by several reads.
+  /// Reads by do_read_more() keep it instead of starting their own, so
+  /// a client trickling the message is cut off in time.
+  void start_read_deadline(timer_wheel::duration timeout);
+
+  /// Arm the write deadline for a response which is produced before
+  /// any of it is queued, so the deadline of the read is not left to
+  /// cut it off. Queued output keeps rearming it.
+  void start_response_deadline();
+  void do_read_more(boost::asio::streambuf& sbuf, std::size_t minimum);
+
+  /// Writing API. Writes are queued in order, and buffers of pending
+  /// ones are gathered into a single system call. Callbacks are called
+  /// in order when their data has been written, the data must stay
+  /// valid until then.
   void do_write(const boost::asio::const_buffer& buffer);
+  void do_write(std::vector<boost::asio::const_buffer> const& buffers);
   void do_write_cb(const boost::asio::const_buffer& buffer, boost::function<void()> f);
+  void do_write_cb(std::vector<boost::asio::const_buffer> const& buffers,
+                   boost::function<void()> f);
+#ifdef ENABLE_SENDFILE_TRANSFER
+  /// Send `count` bytes of file `fd` starting from `offset` without copying
+  /// them to user space. The descriptor must stay open until `f` is called.
+  void do_sendfile(int fd, boost::uint64_t offset, boost::uint64_t count,
+                   boost::function<void()> f);
+#endif
+
+  /// The next queued entry is the first one of a response to the request
+  /// received at `start`. The time to first byte is recorded when the
+  /// entry is written.
+  void mark_response_start(boost::chrono::steady_clock::time_point start)
+  { response_start_ = start; response_start_pending_ = true; }
+
+  /// Bytes queued for writing and not written yet.
+  std::size_t output_size() const { return output_bytes_; }
+
+  /// Is more output queued than the high watermark. Reads are deferred
+  /// until it drains below the low watermark, and producers should
+  /// wait for it by on_writable().
+  bool is_output_congested() const;
+
+  /// Call `f` in the strand once the output is below the low watermark,
+  /// right away (posted) if it is not congested.
+  void on_writable(boost::function<void()> f);
+
+  /// Post passed function, wrapped in connection's strand, to io_service.
+  /// Other threads report results of their work to the connection by it.
+  void post_in_strand(boost::function<void()> f);
 
   /// Getters for statistics data
   boost::uint64_t bytes_sent() const          { return sent_bytes_;     }
@@ -76,46 +150,219 @@ public:  boost::weak_ptr<process_handler_t> const& process_handler() const { ret
   { return remote_endpoint_; }
 
 private:
+  /// Deleter of pooled connections.
+  static void recycle(connection* p);
+
+  /// Return the connection to the state it has after construction.
+  void reset();
+
+  /// Keep the read to start it once the output is drained, if the output
+  /// is congested. The read is converted to a function only then, so
+  /// reads of a connection which is not congested do not allocate.
+  template <typename Read>
+  bool defer_read_if_congested(Read read);
+
   /// Handle completion of a read operation.
   void handle_read(
       boost::shared_ptr<process_handler_t> process_handler,
       const boost::system::error_code& ec,
       std::size_t bytes_transferred);
+#ifdef ENABLE_IO_URING
+  /// Reads served from data received by the shard's io_uring.
+  enum read_kind { no_read, read_at_least, read_until, read_some };
+
+  /// Received data waiting for a read is limited by it, receiving
+  /// is stopped above it and started again when the data is read.
+  static const std::size_t max_received_size = 64 * 1024;
+
+  /// Make the read pending and complete it if the data is received.
+  void start_received_read(read_kind kind, std::size_t minimum);
+
+  /// Start receiving unless it is in progress or the stream is ended.
+  void start_receiving();
+
+  /// Handle data received by the shard's io_uring.
+  void handle_received(const boost::system::error_code& ec,
+                       const char* data, std::size_t size, int buffer,
+                       bool more);
+
+  /// Move received data to the pending read, returns bytes taken.
+  std::size_t take_received(const char* data, std::size_t size);
+
+  /// Complete the pending read if it has got enough data or receiving
+  /// is ended, start receiving otherwise.
+  void deliver_received();
+#endif
+
+  /// Queued piece of output: buffers or a region of a file.
+  struct output_entry
+  {
+    /// Buffers of the entry in `output_buffers_`.
+    std::size_t buffers_count;
+    std::size_t bytes;
+
+    /// The file region, `fd` is -1 for buffers.
+    int fd;
+    boost::uint64_t offset;
+    boost::uint64_t count;
+
+    /// Start of the request the entry begins a response to.
+    bool first_of_response;
+    boost::chrono::steady_clock::time_point response_start;
+
+    boost::function<void()> callback;
+  };
+
+  /// Buffer sequence of the write in flight. It refers to the gathered
+  /// buffers instead of copying them into the operation.
+  struct gathered_buffers
+  {
+    typedef boost::asio::const_buffer value_type;
+    typedef std::vector<boost::asio::const_buffer>::const_iterator const_iterator;
+
+    const_iterator begin() const { return buffers->begin() + first; }
+    const_iterator end() const { return buffers->end(); }
+
+    std::vector<boost::asio::const_buffer> const* buffers;
+    std::size_t first;
+  };
+
+  /// Limit of buffers gathered into one write.
+  static const std::size_t max_gathered_buffers = 256;
+
+  /// Take the pending response start for the entry being queued.
+  void take_response_start(output_entry& entry);
+
+  template <typename Iterator>
+  void enqueue_output(Iterator first, Iterator last, boost::function<void()> f);
+
+  /// Start writing the head of the queue unless a write is in flight.
+  void start_output();
+
+  /// Write the rest of the gathered buffers. The write deadline is
+  /// rearmed whenever a part of them is accepted, so it only limits
+  /// stalled writes.
+  void write_gathered();
 
   /// Handle completion of a write operation.
-  void handle_write(
+  void handle_output(
       boost::shared_ptr<process_handler_t> process_handler,
-      const boost::system::error_code& ec,
-      std::size_t bytes_transferred);
-  void handle_write_cb(
+      const boost::system::error_code& ec, std::size_t bytes_transferred);
+
+  /// Pop written entries and call their callbacks, then continue with
+  /// the rest of the queue.
+  void complete_output(std::size_t entries_count);
+
+  /// Drop the queue after a failure, releasing callbacks.
+  void abort_output();
+#ifdef ENABLE_SENDFILE_TRANSFER
+  void handle_sendfile(
       boost::shared_ptr<process_handler_t> process_handler,
-      boost::function<void()> f, const boost::system::error_code& ec,
-      std::size_t bytes_transferred);
+      int fd, boost::uint64_t offset, boost::uint64_t count,
+      const boost::system::error_code& ec);
+#ifdef ENABLE_IO_URING
+  /// Handle a chunk of the file sent through the shard's io_uring.
+  void handle_file_sent(
+      boost::shared_ptr<process_handler_t> process_handler,
+      int fd, boost::uint64_t offset, boost::uint64_t count,
+      const boost::system::error_code& ec, std::size_t bytes_transferred);
+#endif
+#endif
 
-  /// Post passed function, wrapped in connection's strand, to io_service
-  void post_in_strand(boost::function<void()> f);
+  /// Close the socket unless it is closed already. The closing is
+  /// counted in metrics of the calling thread, so it is done by a thread
+  /// of the shard whenever the connection is closed by close().
+  void close_socket();
+
+  /// Discard input of a lingering connection until it is ended.
+  void do_linger();
+  void handle_linger(const boost::system::error_code& ec);
+
+  /// Close the connection if the current operation is not completed in time.
+  void start_timeout(timer_wheel::duration timeout);
+  void handle_timeout();
+
+  /// Wrap completion handler, so it is called in connection's strand.
+  template <typename Handler>
+  connection_handler<Handler> wrap(Handler handler)
+  { return make_connection_handler(strand_.get(), &handler_memory_, handler); }
 
   /// Dispatch passed function, wrapped in connection's strand, with io_service
   void dispatch_in_strand(boost::function<void()> f);
 
   /// Logger instance and attributes.
   logging::logger log_;
-  boost::log::attribute_set::iterator net_raddr_;
+  boost::log::attributes::mutable_constant<std::string> net_raddr_;
 
   ///
   core const& core_;
 
+  /// The shard which serves the connection and owns its pool.
+  io_shard* shard_;
+
   boost::shared_ptr<boost::asio::io_service> io_service_;
 
   /// Strand to ensure the connection's handlers are not called concurrently.
-  boost::asio::io_service::strand strand_;
+  /// There is no strand when io_service is run by a single thread.
+  boost::scoped_ptr<boost::asio::io_service::strand> strand_;
 
   /// Socket for the connection.
   boost::asio::ip::tcp::socket socket_;
 
+  /// Storage of the connection's asynchronous operations. It outlives
+  /// them because every operation holds a reference to the connection.
+  handler_memory handler_memory_;
+
+  /// Deadline of the current operation.
+  boost::shared_ptr<timer_wheel> timer_wheel_;
+  timer_wheel::entry timeout_entry_;
+  timer_wheel::duration read_timeout_;
+
   /// The handler used to process the data.
   boost::weak_ptr<process_handler_t> process_handler_;
 
+  /// Ordered output queue. Entries before the head indexes are done,
+  /// the vectors are reused, so queueing does not allocate in general.
+  std::vector<output_entry> output_entries_;
+  std::size_t output_head_;
+  std::vector<boost::asio::const_buffer> output_buffers_;
+  std::size_t output_buffers_head_;
+
+  /// Buffers and count of entries of the write in flight, buffers
+  /// before the head index are written.
+  std::vector<boost::asio::const_buffer> write_buffers_;
+  std::size_t write_buffers_head_;
+  std::size_t writing_entries_;
+
+  /// Is a write in flight or are callbacks being called.
+  bool output_active_;
+  std::size_t output_bytes_;
+
+  /// Start of the request whose response gets the next queued entry.
+  boost::chrono::steady_clock::time_point response_start_;
+  bool response_start_pending_;
+
+#ifdef ENABLE_IO_URING
+  /// Data received and not read yet, and the error receiving ended with.
+  std::vector<char> received_;
+  boost::system::error_code receive_error_;
+  bool receiving_;
+  boost::uint64_t receive_key_;
+
+  /// The read waiting for received data and bytes it has got.
+  read_kind read_kind_;
+  boost::asio::streambuf* read_sbuf_;
+  boost::asio::mutable_buffer read_buffer_;
+  std::size_t read_minimum_;
+  std::string read_delim_;
+  std::size_t read_transferred_;
+  boost::shared_ptr<process_handler_t> read_handler_;
+#endif
+
+  /// Read deferred by the congestion and the producer waiting for it.
+  boost::function<void()> deferred_read_;
+  boost::function<void()> writable_callback_;
+
   /// Statistics data counters
   /// (It's safe to declare non atomic because they are changed in strands)
   boost::uint64_t sent_bytes_, recieved_bytes_;
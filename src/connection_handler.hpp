@@ -0,0 +1,241 @@
+#ifndef CONNECTION_HANDLER_HPP
+#define CONNECTION_HANDLER_HPP
+
+#include <boost/asio/detail/bind_handler.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+#include <boost/asio/detail/wrapped_handler.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "handler_memory.hpp"
+
+
+namespace eiptnd {
+
+/// Handler which is already run in the connection's strand.
+/// It only passes memory of the connection to the operations.
+template <typename Handler>
+class in_strand_handler
+{
+public:
+  in_strand_handler(handler_memory* memory, Handler handler)
+    : memory_(memory)
+    , handler_(handler)
+  {
+  }
+
+  void operator()()
+  { handler_(); }
+
+  Handler& handler() { return handler_; }
+  handler_memory* memory() const { return memory_; }
+
+private:
+  handler_memory* memory_;
+  Handler handler_;
+};
+
+/// Completion handler of a connection's asynchronous operation.
+/// It is invoked through the connection's strand when the connection
+/// is served by several threads, and directly when there is no strand.
+/// Memory for the operation is taken from the connection's storage,
+/// or from the heap if there is no storage.
+template <typename Handler>
+class connection_handler
+{
+public:
+  connection_handler(boost::asio::io_service::strand* strand,
+                     handler_memory* memory, Handler handler)
+    : strand_(strand)
+    , memory_(memory)
+    , handler_(handler)
+  {
+  }
+
+  void operator()()
+  {
+    if (strand_) {
+      strand_->dispatch(unwrapped(handler_));
+    }
+    else {
+      handler_();
+    }
+  }
+
+  template <typename Arg1>
+  void operator()(Arg1 const& arg1)
+  {
+    if (strand_) {
+      strand_->dispatch(unwrapped(
+          boost::asio::detail::bind_handler(handler_, arg1)));
+    }
+    else {
+      handler_(arg1);
+    }
+  }
+
+  template <typename Arg1, typename Arg2>
+  void operator()(Arg1 const& arg1, Arg2 const& arg2)
+  {
+    if (strand_) {
+      strand_->dispatch(unwrapped(
+          boost::asio::detail::bind_handler(handler_, arg1, arg2)));
+    }
+    else {
+      handler_(arg1, arg2);
+    }
+  }
+
+  template <typename Arg1, typename Arg2, typename Arg3>
+  void operator()(Arg1 const& arg1, Arg2 const& arg2, Arg3 const& arg3)
+  {
+    if (strand_) {
+      strand_->dispatch(unwrapped(
+          boost::asio::detail::bind_handler(handler_, arg1, arg2, arg3)));
+    }
+    else {
+      handler_(arg1, arg2, arg3);
+    }
+  }
+
+  template <typename Arg1, typename Arg2, typename Arg3, typename Arg4,
+            typename Arg5>
+  void operator()(Arg1 const& arg1, Arg2 const& arg2, Arg3 const& arg3,
+                  Arg4 const& arg4, Arg5 const& arg5)
+  {
+    if (strand_) {
+      strand_->dispatch(unwrapped(
+          boost::asio::detail::bind_handler(handler_, arg1, arg2, arg3,
+                                            arg4, arg5)));
+    }
+    else {
+      handler_(arg1, arg2, arg3, arg4, arg5);
+    }
+  }
+
+  /// Intermediate handlers of composed operations are invoked
+  /// in the same way, so they don't race with the connection.
+  template <typename Function>
+  void invoke(Function& function)
+  {
+    if (strand_) {
+      // Rewrapped function is invoked with hooks of the inner handler,
+      // otherwise it would come back here again from the strand.
+      strand_->dispatch(
+          boost::asio::detail::rewrapped_handler<
+            Function, in_strand_handler<Handler> >(
+              function, unwrapped(handler_)));
+    }
+    else {
+      boost_asio_handler_invoke_helpers::invoke(function, handler_);
+    }
+  }
+
+  Handler& handler() { return handler_; }
+  handler_memory* memory() const { return memory_; }
+
+private:
+  template <typename Function>
+  in_strand_handler<Function> unwrapped(Function const& function) const
+  { return in_strand_handler<Function>(memory_, function); }
+
+  boost::asio::io_service::strand* strand_;
+  handler_memory* memory_;
+  Handler handler_;
+};
+
+template <typename Handler>
+inline connection_handler<Handler>
+make_connection_handler(boost::asio::io_service::strand* strand,
+                        handler_memory* memory, Handler handler)
+{
+  return connection_handler<Handler>(strand, memory, handler);
+}
+
+template <typename Handler>
+inline void* asio_handler_allocate(std::size_t size,
+                                   connection_handler<Handler>* this_handler)
+{
+  if (this_handler->memory()) {
+    return this_handler->memory()->allocate(size);
+  }
+  return boost_asio_handler_alloc_helpers::allocate(
+      size, this_handler->handler());
+}
+
+template <typename Handler>
+inline void asio_handler_deallocate(void* pointer, std::size_t size,
+                                    connection_handler<Handler>* this_handler)
+{
+  if (this_handler->memory()) {
+    this_handler->memory()->deallocate(pointer);
+    return;
+  }
+  boost_asio_handler_alloc_helpers::deallocate(
+      pointer, size, this_handler->handler());
+}
+
+template <typename Handler>
+inline void* asio_handler_allocate(std::size_t size,
+                                   in_strand_handler<Handler>* this_handler)
+{
+  if (this_handler->memory()) {
+    return this_handler->memory()->allocate(size);
+  }
+  return boost_asio_handler_alloc_helpers::allocate(
+      size, this_handler->handler());
+}
+
+template <typename Handler>
+inline void asio_handler_deallocate(void* pointer, std::size_t size,
+                                    in_strand_handler<Handler>* this_handler)
+{
+  if (this_handler->memory()) {
+    this_handler->memory()->deallocate(pointer);
+    return;
+  }
+  boost_asio_handler_alloc_helpers::deallocate(
+      pointer, size, this_handler->handler());
+}
+
+template <typename Function, typename Handler>
+inline void asio_handler_invoke(Function& function,
+                                in_strand_handler<Handler>* this_handler)
+{
+  boost_asio_handler_invoke_helpers::invoke(function, this_handler->handler());
+}
+
+template <typename Function, typename Handler>
+inline void asio_handler_invoke(const Function& function,
+                                in_strand_handler<Handler>* this_handler)
+{
+  boost_asio_handler_invoke_helpers::invoke(function, this_handler->handler());
+}
+
+template <typename Handler>
+inline bool asio_handler_is_continuation(connection_handler<Handler>* this_handler)
+{
+  return boost_asio_handler_cont_helpers::is_continuation(
+      this_handler->handler());
+}
+
+template <typename Function, typename Handler>
+inline void asio_handler_invoke(Function& function,
+                                connection_handler<Handler>* this_handler)
+{
+  this_handler->invoke(function);
+}
+
+template <typename Function, typename Handler>
+inline void asio_handler_invoke(const Function& function,
+                                connection_handler<Handler>* this_handler)
+{
+  Function tmp(function);
+  this_handler->invoke(tmp);
+}
+
+} // namespace eiptnd
+
+#endif // CONNECTION_HANDLER_HPP
@@ -2,11 +2,16 @@
 
 #include "tcp_server.hpp"
 #include "log.hpp"
+#include "http/content_coding.hpp"
 
 #include <boost/bind.hpp>
+#include <boost/core/null_deleter.hpp>
 #include <boost/exception/diagnostic_information.hpp>
+#include <boost/log/sinks/text_file_backend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
 #include <boost/log/utility/setup/console.hpp>
 #include <boost/log/utility/setup/file.hpp>
+#include <boost/log/utility/setup/formatter_parser.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 //#include <boost/log/trivial.hpp>
@@ -17,20 +22,96 @@
 
 namespace eiptnd {
 
+core::core(boost::application::context& context)
+  : log_(boost::log::keywords::channel = "core")
+  , vm_(*context.find<boost::program_options::variables_map>())
+  , webroot_(vm_["dir"].as<std::string>())
+  , chunk_size_(std::max<std::size_t>(vm_["chunk-size"].as<std::size_t>(), 1))
+  , keepalive_requests_(vm_["keepalive-requests"].as<std::size_t>())
+  , header_timeout_(boost::posix_time::seconds(
+        vm_["header-timeout"].as<long>()))
+  , keepalive_timeout_(boost::posix_time::seconds(
+        vm_["keepalive-timeout"].as<long>()))
+  , write_timeout_(boost::posix_time::seconds(
+        vm_["write-timeout"].as<long>()))
+  , linger_timeout_(boost::posix_time::seconds(
+        vm_["linger-timeout"].as<long>()))
+  , write_high_watermark_(vm_["write-high-watermark"].as<std::size_t>())
+  , write_low_watermark_(std::min(vm_["write-low-watermark"].as<std::size_t>(),
+                                  write_high_watermark_))
+  , metrics_url_(vm_["metrics-url"].as<std::string>())
+  , file_cache_(boost::make_shared<file_cache>(
+        vm_["cache-size"].as<std::size_t>(),
+        vm_["cache-max-file"].as<std::size_t>()))
+  , mapping_cache_(boost::make_shared<mapping_cache>(
+        vm_["mmap-cache-size"].as<std::size_t>(),
+        vm_["mmap-max-file"].as<std::size_t>()))
+  , autoindex_(vm_.count("autoindex") != 0)
+  , precompressed_(vm_.count("precompressed") != 0)
+  , gzip_level_(vm_["gzip-level"].as<int>())
+  , gzip_min_size_(vm_["gzip-min-size"].as<std::size_t>())
+  , gzip_max_size_(vm_["gzip-max-size"].as<std::size_t>())
+  , compressed_cache_(boost::make_shared<file_cache>(
+        vm_["gzip-cache-size"].as<std::size_t>(), gzip_max_size_))
+  , is_shutdowning_(false)
+{
+}
+
+core::~core()
+{
+  BOOST_AUTO(logging_core, boost::log::core::get());
+  logging_core->flush();
+  logging_core->remove_all_sinks();
+}
+
 void
-init_logging()
+core::init_logging()
 {
   /*boost::log::add_common_attributes();
   boost::log::register_simple_formatter_factory<logging::severity_level, char>("Severity");
   boost::log::register_simple_filter_factory<logging::severity_level, char>("Severity");*/
 
+  std::string const file_name = "/tmp/log/httpd-%Y-%m-%d_%H-%M-%S.%3N.log";
+  std::string const file_format =
+      "[%TimeStamp%] <%Severity%>\t[%Channel%] - %Message%";
+  bool const console = !vm_.count("no-console");
+
+  if (vm_.count("log-async")) {
+    async_log_sink::overflow_policy policy =
+        (vm_["log-overflow"].as<std::string>() == "drop")
+          ? async_log_sink::drop_on_overflow
+          : async_log_sink::block_on_overflow;
+    log_sink_ = boost::make_shared<async_log_sink>(
+        vm_["log-queue-size"].as<std::size_t>(), policy);
+
+    // The writer flushes backends once per batch
+    log_sink_->add_backend(
+        boost::make_shared<boost::log::sinks::text_file_backend>(
+          boost::log::keywords::file_name = file_name,
+          boost::log::keywords::auto_flush = false),
+        boost::log::parse_formatter(file_format));
+
+    if (console) {
+      auto backend = boost::make_shared<boost::log::sinks::text_ostream_backend>();
+      backend->add_stream(
+          boost::shared_ptr<std::ostream>(&std::cout, boost::null_deleter()));
+      log_sink_->add_backend(backend, boost::log::parse_formatter("%Message%"));
+    }
+
+    log_sink_->start();
+    boost::log::core::get()->add_sink(log_sink_);
+    return;
+  }
+
   boost::log::add_file_log(
     boost::log::keywords::auto_flush = true,
-    boost::log::keywords::file_name = "/tmp/log/httpd-%Y-%m-%d_%H-%M-%S.%3N.log",
-    boost::log::keywords::format = "[%TimeStamp%] <%Severity%>\t[%Channel%] - %Message%"
+    boost::log::keywords::file_name = file_name,
+    boost::log::keywords::format = file_format
   );
   //boost::log::add_file_log("/tmp/httpd.log");
-  boost::log::add_console_log(std::cout);
+  if (console) {
+    boost::log::add_console_log(std::cout);
+  }
   /*boost::log::core::get()->set_filter
   (
       boost::log::expressions::attr<CustomLogLevels>("Severity")boost::log::keywords::severity >= logging::severity_level::flood
@@ -53,27 +134,14 @@ init_logging()
   boost::log::init_from_settings(log_settings);*/
 }
 
-core::core(boost::application::context& context)
-  : log_(boost::log::keywords::channel = "core")
-  , vm_(*context.find<boost::program_options::variables_map>())
-  , webroot_(vm_["dir"].as<std::string>())
-  , is_shutdowning_(false)
-{
-}
-
-core::~core()
-{
-  BOOST_AUTO(logging_core, boost::log::core::get());
-  logging_core->flush();
-  logging_core->remove_all_sinks();
-}
-
 int
 core::operator()()
 {
   int ret = EXIT_SUCCESS;
   bool is_catch = false;
   try {
+    logging::set_severity_threshold(
+        vm_["log-level"].as<logging::severity_level>());
     init_logging();
     run();
   }
@@ -106,8 +174,8 @@ core::stop()
   if (is_shutdowning_) {
     BOOST_LOG_SEV(log_, logging::global) << "Forced to shutdown";
 
-    if (io_service_) {
-      io_service_->stop();
+    for (boost::shared_ptr<io_shard> const& shard : shards_) {
+      shard->stop();
     }
 
     boost::log::core::get()->flush();
@@ -117,6 +185,20 @@ core::stop()
 
   is_shutdowning_ = true;
 
+#ifdef ENABLE_FS_WATCHER
+  if (webroot_watcher_) {
+    webroot_watcher_->cancel();
+  }
+#endif
+
+  if (date_cache_) {
+    date_cache_->cancel();
+  }
+
+  for (boost::shared_ptr<io_shard> const& shard : shards_) {
+    shard->stop_timers();
+  }
+
   BOOST_LOG_SEV(log_, logging::normal) << "Freeing listeners";
   for (boost::weak_ptr<tcp_server> const& listener : listeners_) {
     auto p = listener.lock();
@@ -128,14 +210,90 @@ core::stop()
   BOOST_LOG_SEV(log_, logging::notify)
     << "Cleanup is done. Waiting for io_service release...";
 
-  BOOST_LOG_SEV(log_, logging::normal)
-    << "The io_service is still in use " << io_service_.use_count() << " objects";
+  if (log_sink_ && log_sink_->dropped()) {
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Log records dropped on queue overflow: " << log_sink_->dropped();
+  }
+
+  for (boost::shared_ptr<io_shard> const& shard : shards_) {
+    BOOST_LOG_SEV(log_, logging::normal)
+      << "The io_service is still in use "
+      << shard->get_ios().use_count() << " objects";
+
+    pool_stats stats = shard->connections_pool_stats();
+    BOOST_LOG_SEV(log_, logging::normal)
+      << "Connections pool keeps " << stats.size << " objects, hit rate "
+      << stats.hit_rate() << "% (" << stats.hits << " of "
+      << stats.hits + stats.misses << ")";
+
+    stats = shard->http_connections_pool_stats();
+    BOOST_LOG_SEV(log_, logging::normal)
+      << "HTTP connections pool keeps " << stats.size << " objects, hit rate "
+      << stats.hit_rate() << "% (" << stats.hits << " of "
+      << stats.hits + stats.misses << ")";
+  }
 
   boost::log::core::get()->flush();
 
   return true; // return true to stop, false to ignore
 }
 
+void
+core::write_metrics(std::ostream& os) const
+{
+  metrics_snapshot snapshot;
+  pool_stats pool, http_pool;
+  for (boost::shared_ptr<io_shard> const& shard : shards_) {
+    shard->collect_metrics(snapshot);
+    pool += shard->connections_pool_stats();
+    http_pool += shard->http_connections_pool_stats();
+  }
+
+  write_prometheus(os, snapshot);
+
+  write_prometheus_metric(os, "eiptnd_connection_pool_size", "gauge",
+      "Finished connections kept for reuse.", pool.size);
+  write_prometheus_metric(os, "eiptnd_connection_pool_hits_total", "counter",
+      "Connections taken from pools.", pool.hits);
+  write_prometheus_metric(os, "eiptnd_connection_pool_misses_total", "counter",
+      "Connections constructed because pools were empty.", pool.misses);
+  write_prometheus_metric(os, "eiptnd_http_connection_pool_size", "gauge",
+      "Finished HTTP handlers kept for reuse.", http_pool.size);
+  write_prometheus_metric(os, "eiptnd_http_connection_pool_hits_total", "counter",
+      "HTTP handlers taken from pools.", http_pool.hits);
+  write_prometheus_metric(os, "eiptnd_http_connection_pool_misses_total", "counter",
+      "HTTP handlers constructed because pools were empty.", http_pool.misses);
+  write_prometheus_metric(os, "eiptnd_file_cache_bytes", "gauge",
+      "Total size of cached responses.", file_cache_->size());
+  if (mapping_cache_->enabled()) {
+    write_prometheus_metric(os, "eiptnd_mapping_cache_bytes", "gauge",
+        "Total size of files mapped for serving.", mapping_cache_->size());
+  }
+
+  if (compression_pool_) {
+    write_prometheus_metric(os, "eiptnd_compressed_cache_bytes", "gauge",
+        "Total size of cached compressed responses.",
+        compressed_cache_->size());
+    write_prometheus_metric(os, "eiptnd_compression_pending", "gauge",
+        "Responses being compressed or waiting for it.",
+        compression_pool_->pending());
+    write_prometheus_metric(os, "eiptnd_compression_rejected_total", "counter",
+        "Responses sent uncompressed because compression was overloaded.",
+        compression_pool_->rejected());
+  }
+
+  if (access_log_) {
+    write_prometheus_metric(os, "eiptnd_access_log_records_total", "counter",
+        "Requests written to the access log.", access_log_->written());
+    write_prometheus_metric(os, "eiptnd_access_log_dropped_total", "counter",
+        "Requests lost because of access log errors.", access_log_->dropped());
+  }
+  if (log_sink_) {
+    write_prometheus_metric(os, "eiptnd_log_dropped_total", "counter",
+        "Log records dropped on queue overflow.", log_sink_->dropped());
+  }
+}
+
 void
 core::run()
 {
@@ -143,20 +301,132 @@ core::run()
   BOOST_LOG_SEV(log_, logging::info)
       << "Asio thread pool size: " << thread_pool_size;
 
-  io_service_ = boost::make_shared<boost::asio::io_service>(thread_pool_size);
+  std::size_t pool_size = vm_["pool-size"].as<std::size_t>();
+
+  std::string const mime_types_file = vm_["mime-types"].as<std::string>();
+  if (!mime_types_file.empty()) {
+    mime_types_.load(mime_types_file);
+    BOOST_LOG_SEV(log_, logging::info)
+      << "Loaded " << mime_types_.size() << " content types from "
+      << mime_types_file;
+  }
+
+  if (vm_.count("gzip")) {
+#ifdef ENABLE_GZIP
+    std::size_t gzip_threads =
+        std::max<std::size_t>(vm_["gzip-threads"].as<std::size_t>(), 1);
+    compression_pool_ = boost::make_shared<worker_pool>(
+        gzip_threads, vm_["gzip-queue-size"].as<std::size_t>());
+    BOOST_LOG_SEV(log_, logging::info)
+      << "Compression thread pool size: " << gzip_threads;
+#else
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Built without zlib, responses are not compressed on the fly";
+#endif
+  }
+
+  std::string const access_log_dir = vm_["access-log"].as<std::string>();
+  if (!access_log_dir.empty()) {
+    access_log_ = boost::make_shared<access_log>(
+        access_log_dir, vm_["access-log-file-size"].as<std::size_t>());
+  }
+
+  bool shard_per_core = vm_.count("shard-per-core") && thread_pool_size > 1;
+#ifndef SO_REUSEPORT
+  if (shard_per_core) {
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "SO_REUSEPORT is not supported, using a single shard";
+    shard_per_core = false;
+  }
+#endif
+
+  // Every shard owns a thread and its listeners,
+  // otherwise a single shard is run by all threads.
+  if (shard_per_core) {
+    for (std::size_t i = 0; i < thread_pool_size; ++i) {
+      shards_.push_back(boost::make_shared<io_shard>(1, pool_size,
+                                                     access_log_));
+    }
+  }
+  else {
+    shards_.push_back(boost::make_shared<io_shard>(thread_pool_size, pool_size,
+                                                   access_log_));
+  }
+
+  if (vm_["io-engine"].as<std::string>() == "uring") {
+#if defined(ENABLE_IO_URING) && defined(ENABLE_SENDFILE_TRANSFER) && \
+    !defined(ENABLE_SEGMENTED_TRANSFER)
+    std::size_t uring_shards = 0;
+    for (boost::shared_ptr<io_shard> const& shard : shards_) {
+      try {
+        shard->start_uring(chunk_size_);
+        ++uring_shards;
+      }
+      catch (const boost::system::system_error& e) {
+        BOOST_LOG_SEV(log_, logging::warning)
+          << "io_uring is not available, sockets are served by asio: "
+          << e.what();
+        break;
+      }
+    }
+    BOOST_LOG_SEV(log_, logging::info)
+      << "Sockets are served through io_uring by " << uring_shards << " of "
+      << shards_.size() << " shards";
+#else
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "io_uring is not supported by this build, sockets are served by asio";
+#endif
+  }
+
+  date_cache_ = boost::make_shared<date_cache>(
+      boost::ref(*shards_.front()->get_ios()));
+  date_cache_->start();
+
+  if (file_cache_->enabled()) {
+#ifdef ENABLE_FS_WATCHER
+    // Mappings are checked by every request, they are dropped here
+    // so removed files do not stay mapped
+    auto cache = file_cache_;
+    auto mappings = mapping_cache_;
+    webroot_watcher_ = boost::make_shared<fs_watcher>(
+        boost::ref(*shards_.front()->get_ios()), webroot_,
+        [cache, mappings](std::string const& path, bool is_dir) {
+          if (is_dir) {
+            cache->erase_tree(path);
+            mappings->erase_tree(path);
+          }
+          else {
+            // The file may be cached as a coding of its original too
+            cache->erase(path);
+            cache->erase(coded_cache_key(path, "gzip"));
+            cache->erase(coded_cache_key(path, "br"));
+            mappings->erase(path);
+          }
+        });
+    webroot_watcher_->start();
+#else
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Changes of files are not tracked, the cache may serve stale content";
+#endif
+  }
 
   string_vector bind_list = vm_["host"].as<string_vector>();
   unsigned short port_num = vm_["port"].as<unsigned short>();
+  std::size_t accept_depth = vm_["accept-depth"].as<std::size_t>();
 
   try {
-    for(std::string const& address : bind_list) {
-      BOOST_LOG_SEV(log_, logging::normal)
-        << "TCP listener at " << address << ":" << port_num << " was created";
-
-      boost::shared_ptr<tcp_server> listener =
-          boost::make_shared<tcp_server>(boost::ref(*this), address, port_num);
-      listeners_.push_back(listener);
-      listener->start_accept();
+    for (boost::shared_ptr<io_shard> const& shard : shards_) {
+      for(std::string const& address : bind_list) {
+        BOOST_LOG_SEV(log_, logging::normal)
+          << "TCP listener at " << address << ":" << port_num << " was created";
+
+        boost::shared_ptr<tcp_server> listener =
+            boost::make_shared<tcp_server>(boost::ref(*this), shard,
+                                           address, port_num, shard_per_core,
+                                           accept_depth);
+        listeners_.push_back(listener);
+        listener->start_accept();
+      }
     }
   }
   catch (const boost::system::system_error& e) {
@@ -166,19 +436,39 @@ core::run()
     throw;
   }
 
+  bool pin_threads = vm_.count("pin-threads") != 0;
+  std::size_t cpus_count = std::max(1u, boost::thread::hardware_concurrency());
+
   if (thread_pool_size > 1) {
     boost::thread_group threads;
-    for (std::size_t i = 0; i < thread_pool_size; ++i) {
-      threads.create_thread(
-          boost::bind(&boost::asio::io_service::run, io_service_));
+    std::size_t thread_idx = 0;
+    for (boost::shared_ptr<io_shard> const& shard : shards_) {
+      for (std::size_t i = 0; i < shard->threads_count(); ++i, ++thread_idx) {
+        int cpu = pin_threads ? static_cast<int>(thread_idx % cpus_count) : -1;
+        threads.create_thread(boost::bind(&io_shard::run, shard, cpu));
+      }
     }
 
     threads.join_all();
   }
   else {
-    io_service_->run();
+    shards_.front()->run(pin_threads ? 0 : -1);
   }
 
+  if (compression_pool_) {
+    compression_pool_->stop();
+  }
+
+  if (access_log_) {
+    for (boost::shared_ptr<io_shard> const& shard : shards_) {
+      shard->flush_access_log();
+    }
+    access_log_->close();
+
+    BOOST_LOG_SEV(log_, logging::normal)
+      << "Access log keeps " << access_log_->written() << " requests, "
+      << access_log_->dropped() << " are dropped";
+  }
 
   BOOST_LOG_SEV(log_, logging::notify) << "All threads are done";
 }
@@ -1,12 +1,21 @@
 #ifndef CORE_HPP
 #define CORE_HPP
 
+#include "async_log_sink.hpp"
+#include "fs_watcher.hpp"
+#include "io_shard.hpp"
 #include "log.hpp"
 #include "tcp_server.hpp"
-
+#include "timer_wheel.hpp"
+#include "worker_pool.hpp"
+#include "http/date_cache.hpp"
+#include "http/file_cache.hpp"
+#include "http/mapping_cache.hpp"
+#include "http/mime_types.hpp"
+
+#include <iosfwd>
 #include <vector>
 #include <boost/application/context.hpp>
-#include <boost/asio/io_service.hpp>
 #include <boost/program_options/variables_map.hpp>
 
 typedef std::vector<std::string> string_vector;
@@ -28,30 +37,155 @@ public:
   /// Handles stop signal.
   bool stop();
 
-  boost::shared_ptr<boost::asio::io_service> const& get_ios() const
-  { return io_service_; }
-
   std::string const& get_webroot() const
   { return webroot_; }
 
+  std::size_t get_chunk_size() const
+  { return chunk_size_; }
+
+  std::size_t get_keepalive_requests() const
+  { return keepalive_requests_; }
+
+  file_cache& get_file_cache() const
+  { return *file_cache_; }
+
+  /// Mappings of files which are too large for the file cache.
+  mapping_cache& get_mapping_cache() const
+  { return *mapping_cache_; }
+
+  date_cache const& get_date_cache() const
+  { return *date_cache_; }
+
+  mime_types const& get_mime_types() const
+  { return mime_types_; }
+
+  /// Respond with indexes of directories.
+  bool get_autoindex() const
+  { return autoindex_; }
+
+  /// Serve .br and .gz siblings of files to clients accepting them.
+  bool get_precompressed() const
+  { return precompressed_; }
+
+  /// Compress files of compressible types on the fly.
+  bool get_gzip() const
+  { return compression_pool_ != 0; }
+
+  int get_gzip_level() const
+  { return gzip_level_; }
+
+  std::size_t get_gzip_min_size() const
+  { return gzip_min_size_; }
+
+  std::size_t get_gzip_max_size() const
+  { return gzip_max_size_; }
+
+  /// Threads compressing responses, null if gzip is disabled.
+  worker_pool* get_compression_pool() const
+  { return compression_pool_.get(); }
+
+  /// Compressed variants of files keyed by path, ETag and coding.
+  file_cache& get_compressed_cache() const
+  { return *compressed_cache_; }
+
+  timer_wheel::duration get_header_timeout() const
+  { return header_timeout_; }
+
+  timer_wheel::duration get_keepalive_timeout() const
+  { return keepalive_timeout_; }
+
+  timer_wheel::duration get_write_timeout() const
+  { return write_timeout_; }
+
+  timer_wheel::duration get_linger_timeout() const
+  { return linger_timeout_; }
+
+  /// Output queued for a connection above which reading from it and
+  /// producing for it are paused, until the output drains below the low one.
+  std::size_t get_write_high_watermark() const
+  { return write_high_watermark_; }
+
+  std::size_t get_write_low_watermark() const
+  { return write_low_watermark_; }
+
+  /// Path of the metrics page, empty if it is disabled.
+  std::string const& get_metrics_url() const
+  { return metrics_url_; }
+
+  /// Render counters of all threads and pools in the Prometheus format.
+  void write_metrics(std::ostream& os) const;
+
 private:
   /// Daemon runner.
   void run();
 
+  /// Set up log sinks according to options.
+  void init_logging();
+
   /// Logger instance and attributes.
   logging::logger log_;
 
+  /// Sink of the asynchronous logging mode.
+  boost::shared_ptr<async_log_sink> log_sink_;
+
   /// Variables map.
   boost::program_options::variables_map& vm_;
 
-  /// Boost.Asio Proactor.
-  boost::shared_ptr<boost::asio::io_service> io_service_;
+  /// Binary log of served requests, null if it is disabled.
+  boost::shared_ptr<access_log> access_log_;
+
+  /// Boost.Asio Proactors with their threads.
+  std::vector<boost::shared_ptr<io_shard> > shards_;
 
   ///
   std::vector<boost::weak_ptr<tcp_server> > listeners_;
 
   std::string webroot_;
 
+  /// Size of a single buffer used in segmented file transfer.
+  std::size_t chunk_size_;
+
+  /// Limit of requests served through a single persistent connection.
+  std::size_t keepalive_requests_;
+
+  /// Time limits of receiving the first request, waiting for the next
+  /// one through a persistent connection and sending a response, and
+  /// of discarding input of a connection which is being closed.
+  timer_wheel::duration header_timeout_;
+  timer_wheel::duration keepalive_timeout_;
+  timer_wheel::duration write_timeout_;
+  timer_wheel::duration linger_timeout_;
+
+  std::size_t write_high_watermark_;
+  std::size_t write_low_watermark_;
+
+  std::string metrics_url_;
+
+  /// Content types of served files.
+  mime_types mime_types_;
+
+  /// Hot files shared by all connections.
+  boost::shared_ptr<file_cache> file_cache_;
+
+  /// Medium-sized files mapped for all connections.
+  boost::shared_ptr<mapping_cache> mapping_cache_;
+
+  bool autoindex_;
+  bool precompressed_;
+  int gzip_level_;
+  std::size_t gzip_min_size_;
+  std::size_t gzip_max_size_;
+  boost::shared_ptr<worker_pool> compression_pool_;
+  boost::shared_ptr<file_cache> compressed_cache_;
+
+  /// Value of the Date header field.
+  boost::shared_ptr<date_cache> date_cache_;
+
+#ifdef ENABLE_FS_WATCHER
+  /// Evicts changed files from the cache.
+  boost::shared_ptr<fs_watcher> webroot_watcher_;
+#endif
+
   /// Flags if daemon currently in shutdowning phase.
   bool is_shutdowning_;
 };
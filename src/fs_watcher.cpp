@@ -0,0 +1,157 @@
+#include "fs_watcher.hpp"
+
+#ifdef ENABLE_FS_WATCHER
+
+#include <cerrno>
+#include <cstring>
+#include <boost/asio/buffer.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/system/system_error.hpp>
+#include <sys/inotify.h>
+
+
+namespace eiptnd {
+
+namespace {
+
+const boost::uint32_t watch_mask =
+    IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+    IN_ONLYDIR;
+
+} // namespace
+
+fs_watcher::fs_watcher(boost::asio::io_service& io_service,
+                       std::string const& root, callback_t on_change)
+  : log_(boost::log::keywords::channel = "fs-watcher")
+  , root_(root)
+  , on_change_(on_change)
+  , stream_(io_service)
+{
+  int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd == -1) {
+    throw boost::system::system_error(
+        boost::system::error_code(errno, boost::system::system_category()),
+        "inotify_init1");
+  }
+  stream_.assign(fd);
+}
+
+void
+fs_watcher::start()
+{
+  add_watch_recursive(root_);
+
+  BOOST_LOG_SEV(log_, logging::info)
+    << "Watching " << watches_.size() << " directories under " << root_;
+
+  start_read();
+}
+
+void
+fs_watcher::cancel()
+{
+  boost::system::error_code ignored_ec;
+  stream_.close(ignored_ec);
+}
+
+void
+fs_watcher::add_watch_recursive(std::string const& dir)
+{
+  add_watch(dir);
+
+  boost::system::error_code ec;
+  boost::filesystem::recursive_directory_iterator it(dir, ec), end;
+  for (; !ec && it != end; it.increment(ec)) {
+    if (boost::filesystem::is_directory(it->status())) {
+      add_watch(it->path().string());
+    }
+  }
+
+  if (ec) {
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Scanning " << dir << " failed: " << ec.message();
+  }
+}
+
+void
+fs_watcher::add_watch(std::string const& dir)
+{
+  int wd = ::inotify_add_watch(stream_.native_handle(), dir.c_str(), watch_mask);
+  if (wd == -1) {
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Watching " << dir << " failed: " << std::strerror(errno);
+    return;
+  }
+
+  watches_[wd] = dir;
+}
+
+void
+fs_watcher::start_read()
+{
+  stream_.async_read_some(boost::asio::buffer(buf_),
+      boost::bind(&fs_watcher::handle_read, shared_from_this(), _1, _2));
+}
+
+void
+fs_watcher::handle_read(const boost::system::error_code& ec,
+                        std::size_t bytes_transferred)
+{
+  if (ec) {
+    if (ec != boost::asio::error::operation_aborted) {
+      BOOST_LOG_SEV(log_, logging::error)
+        << "Reading events failed: " << ec.message() << " (" << ec.value() << ")";
+    }
+    return;
+  }
+
+  std::size_t offset = 0;
+  while (offset + sizeof(inotify_event) <= bytes_transferred) {
+    const inotify_event* ev = reinterpret_cast<const inotify_event*>(buf_ + offset);
+    offset += sizeof(inotify_event) + ev->len;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+      BOOST_LOG_SEV(log_, logging::warning)
+        << "Events queue overflow, everything is considered changed";
+      on_change_(root_, true);
+      continue;
+    }
+
+    auto found = watches_.find(ev->wd);
+    if (found == watches_.end()) {
+      continue;
+    }
+
+    if (ev->mask & IN_IGNORED) {
+      watches_.erase(found);
+      continue;
+    }
+
+    bool is_dir = (ev->mask & IN_ISDIR) != 0;
+    std::string path = found->second;
+    if (ev->len) {
+      path = (boost::filesystem::path(path) / ev->name).string();
+    }
+    else {
+      // Event about the watched directory itself
+      is_dir = true;
+    }
+
+    BOOST_LOG_SEV(log_, logging::trace)
+      << "Changed: " << path << " (0x" << std::hex << ev->mask << ")";
+
+    if (is_dir && ev->len && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+      add_watch_recursive(path);
+    }
+
+    on_change_(path, is_dir);
+  }
+
+  start_read();
+}
+
+} // namespace eiptnd
+
+#endif // ENABLE_FS_WATCHER
@@ -0,0 +1,75 @@
+#ifndef FS_WATCHER_HPP
+#define FS_WATCHER_HPP
+
+#include "log.hpp"
+
+#if defined(__linux__)
+/// Changes under the web root are tracked by inotify(7).
+# define ENABLE_FS_WATCHER
+#endif
+
+#ifdef ENABLE_FS_WATCHER
+
+#include <string>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+
+
+namespace eiptnd {
+
+/// Watches a directory tree and reports every changed, moved or
+/// deleted entry. The notifications are delivered through io_service,
+/// so nothing is polled and no syscalls are made between the changes.
+class fs_watcher
+  : public boost::enable_shared_from_this<fs_watcher>
+  , private boost::noncopyable
+{
+public:
+  /// Receives the path of a changed entry and whether it is a directory
+  /// (everything under such path should be considered changed too).
+  typedef boost::function<void(std::string const&, bool)> callback_t;
+
+  fs_watcher(boost::asio::io_service& io_service,
+             std::string const& root, callback_t on_change);
+
+  /// Start watching.
+  void start();
+
+  /// Stop watching and release the descriptor.
+  void cancel();
+
+private:
+  /// Add watches to the directory and all its subdirectories.
+  void add_watch_recursive(std::string const& dir);
+  void add_watch(std::string const& dir);
+
+  void start_read();
+  void handle_read(const boost::system::error_code& ec,
+                   std::size_t bytes_transferred);
+
+  /// Logger instance and attributes.
+  logging::logger log_;
+
+  std::string root_;
+
+  callback_t on_change_;
+
+  /// The inotify descriptor.
+  boost::asio::posix::stream_descriptor stream_;
+
+  /// Watched directories by their watch descriptors.
+  boost::unordered_map<int, std::string> watches_;
+
+  /// Buffer for incoming events.
+  alignas(8) char buf_[16 * 1024];
+};
+
+} // namespace eiptnd
+
+#endif // ENABLE_FS_WATCHER
+
+#endif // FS_WATCHER_HPP
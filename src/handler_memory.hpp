@@ -0,0 +1,69 @@
+#ifndef HANDLER_MEMORY_HPP
+#define HANDLER_MEMORY_HPP
+
+#include <cstddef>
+#include <new>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+
+namespace eiptnd {
+
+/// Storage for asynchronous operations of a single connection.
+/// A connection has only a few operations in flight (read, write,
+/// timeout and strand dispatches), so a handful of fixed slots is
+/// enough to serve them without the heap. Larger or excess requests
+/// fall back to operator new.
+class handler_memory
+  : private boost::noncopyable
+{
+public:
+  enum { slots_count = 4, slot_size = 768 };
+
+  handler_memory()
+  {
+    for (std::size_t i = 0; i < slots_count; ++i) {
+      in_use_[i] = false;
+    }
+  }
+
+  void* allocate(std::size_t size)
+  {
+    if (size <= slot_size) {
+      // Operations are completed by any thread of the shard, so slots
+      // could be released concurrently with the allocation.
+      for (std::size_t i = 0; i < slots_count; ++i) {
+        if (!in_use_[i].exchange(true, boost::memory_order_acquire)) {
+          return slots_[i].address();
+        }
+      }
+    }
+
+    return ::operator new(size);
+  }
+
+  void deallocate(void* pointer)
+  {
+    for (std::size_t i = 0; i < slots_count; ++i) {
+      if (pointer == slots_[i].address()) {
+        in_use_[i].store(false, boost::memory_order_release);
+        return;
+      }
+    }
+
+    ::operator delete(pointer);
+  }
+
+private:
+  typedef boost::aligned_storage<
+    slot_size, boost::alignment_of<std::max_align_t>::value> slot;
+
+  slot slots_[slots_count];
+  boost::atomic<bool> in_use_[slots_count];
+};
+
+} // namespace eiptnd
+
+#endif // HANDLER_MEMORY_HPP
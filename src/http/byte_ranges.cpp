@@ -0,0 +1,146 @@
+#include "byte_ranges.hpp"
+
+#include "date_cache.hpp"
+#include "request_parser.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <boost/algorithm/string/predicate.hpp>
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Non-empty decimal number which fits 64 bits.
+bool parse_number(boost::string_ref s, boost::uint64_t& value)
+{
+  if (s.empty()) {
+    return false;
+  }
+
+  value = 0;
+  for (char c : s) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    boost::uint64_t digit = static_cast<boost::uint64_t>(c - '0');
+    if (value > (std::numeric_limits<boost::uint64_t>::max() - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+  return true;
+}
+
+} // namespace
+
+range_result parse_ranges(boost::string_ref value, boost::uint64_t size,
+                          std::size_t max_ranges,
+                          std::vector<byte_range>& ranges)
+{
+  ranges.clear();
+
+  value = trim_ows(value);
+  std::size_t eq = value.find('=');
+  if (eq == boost::string_ref::npos ||
+      !boost::iequals(trim_ows(value.substr(0, eq)), "bytes")) {
+    return range_ignored;
+  }
+  value.remove_prefix(eq + 1);
+
+  bool has_specs = false;
+  while (!value.empty()) {
+    std::size_t comma = value.find(',');
+    boost::string_ref spec = trim_ows(value.substr(0, comma));
+    value.remove_prefix(comma == boost::string_ref::npos ? value.size()
+                                                         : comma + 1);
+    // Empty list elements are allowed
+    if (spec.empty()) {
+      continue;
+    }
+    has_specs = true;
+
+    std::size_t dash = spec.find('-');
+    if (dash == boost::string_ref::npos) {
+      return range_ignored;
+    }
+
+    boost::uint64_t first, last;
+    if (dash == 0) {
+      // Suffix range: the last bytes of the body
+      if (!parse_number(spec.substr(1), last)) {
+        return range_ignored;
+      }
+      if (last && size) {
+        last = std::min(last, size);
+        ranges.push_back(byte_range(size - last, last));
+      }
+      continue;
+    }
+
+    if (!parse_number(spec.substr(0, dash), first)) {
+      return range_ignored;
+    }
+    if (dash + 1 == spec.size()) {
+      last = std::numeric_limits<boost::uint64_t>::max();
+    }
+    else if (!parse_number(spec.substr(dash + 1), last) || last < first) {
+      return range_ignored;
+    }
+
+    if (first < size) {
+      last = std::min(last, size - 1);
+      ranges.push_back(byte_range(first, last - first + 1));
+    }
+  }
+
+  if (!has_specs) {
+    return range_ignored;
+  }
+  if (ranges.empty()) {
+    return range_unsatisfiable;
+  }
+
+  if (ranges.size() > 1) {
+    std::sort(ranges.begin(), ranges.end(),
+        [](byte_range const& a, byte_range const& b) {
+          return a.offset < b.offset;
+        });
+
+    std::size_t merged = 0;
+    for (std::size_t i = 1; i < ranges.size(); ++i) {
+      byte_range& prev = ranges[merged];
+      boost::uint64_t prev_end = prev.offset + prev.length;
+      if (ranges[i].offset <= prev_end) {
+        prev.length = std::max(prev_end, ranges[i].offset + ranges[i].length)
+            - prev.offset;
+      }
+      else {
+        ranges[++merged] = ranges[i];
+      }
+    }
+    ranges.resize(merged + 1);
+  }
+
+  if (ranges.size() > max_ranges) {
+    ranges.clear();
+    return range_ignored;
+  }
+  return range_satisfiable;
+}
+
+bool if_range_matches(boost::string_ref if_range, boost::string_ref etag,
+                      std::time_t last_modified)
+{
+  if_range = trim_ows(if_range);
+  if (if_range.starts_with("\"") || if_range.starts_with("W/")) {
+    // Weak tags never match
+    return if_range == etag && !etag.starts_with("W/");
+  }
+
+  std::time_t date;
+  return date_cache::parse(if_range, date) && date == last_modified;
+}
+
+} // namespace eiptnd
@@ -0,0 +1,47 @@
+#ifndef HTTP_BYTE_RANGES_HPP
+#define HTTP_BYTE_RANGES_HPP
+
+#include <ctime>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Window of a response body.
+struct byte_range
+{
+  byte_range() : offset(0), length(0) {}
+  byte_range(boost::uint64_t offset, boost::uint64_t length)
+    : offset(offset), length(length) {}
+
+  boost::uint64_t offset;
+  boost::uint64_t length;
+};
+
+enum range_result
+{
+  /// There are no ranges, or the field is invalid: send the whole body.
+  range_ignored,
+  /// At least one range overlaps the body.
+  range_satisfiable,
+  /// No range overlaps the body, 416 should be sent.
+  range_unsatisfiable
+};
+
+/// Parse a Range field value (RFC 7233) for a body of `size` bytes.
+/// Overlapping and adjacent ranges are coalesced in the order of offsets.
+/// The field is ignored when more than `max_ranges` ranges remain.
+range_result parse_ranges(boost::string_ref value, boost::uint64_t size,
+                          std::size_t max_ranges,
+                          std::vector<byte_range>& ranges);
+
+/// Does an If-Range field value match validators of the body. Entity
+/// tags are compared strongly, and a date must be equal to Last-Modified.
+bool if_range_matches(boost::string_ref if_range, boost::string_ref etag,
+                      std::time_t last_modified);
+
+} // namespace eiptnd
+
+#endif // HTTP_BYTE_RANGES_HPP
@@ -0,0 +1,130 @@
+#include "content_coding.hpp"
+
+#include "request_parser.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#ifdef ENABLE_GZIP
+#include <zlib.h>
+#endif
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Is the weight of a coding zero, e.g. "q=0" or "q=0.000".
+bool is_rejected(boost::string_ref params)
+{
+  while (!params.empty()) {
+    std::size_t semicolon = params.find(';');
+    boost::string_ref param = trim_ows(params.substr(0, semicolon));
+    params.remove_prefix(semicolon == boost::string_ref::npos
+                         ? params.size() : semicolon + 1);
+
+    if (param.size() < 2 || (param[0] != 'q' && param[0] != 'Q') ||
+        param[1] != '=') {
+      continue;
+    }
+    param = trim_ows(param.substr(2));
+    if (param.empty() || param[0] != '0') {
+      return false;
+    }
+    return param.substr(1).find_first_not_of("0.") == boost::string_ref::npos;
+  }
+  return false;
+}
+
+} // namespace
+
+bool accepts_encoding(boost::string_ref accept_encoding,
+                      boost::string_ref coding)
+{
+  bool by_wildcard = false;
+  while (!accept_encoding.empty()) {
+    std::size_t comma = accept_encoding.find(',');
+    boost::string_ref element = accept_encoding.substr(0, comma);
+    accept_encoding.remove_prefix(comma == boost::string_ref::npos
+                                  ? accept_encoding.size() : comma + 1);
+
+    std::size_t semicolon = element.find(';');
+    boost::string_ref name = trim_ows(element.substr(0, semicolon));
+    boost::string_ref params = semicolon == boost::string_ref::npos
+        ? boost::string_ref() : element.substr(semicolon + 1);
+
+    // An explicit entry overrides the wildcard
+    if (boost::iequals(name, coding)) {
+      return !is_rejected(params);
+    }
+    if (name == "*") {
+      by_wildcard = !is_rejected(params);
+    }
+  }
+  return by_wildcard;
+}
+
+bool is_compressible(boost::string_ref content_type)
+{
+  static const char* const types[] = {
+    "application/javascript",
+    "application/json",
+    "application/manifest+json",
+    "application/wasm",
+    "application/xml",
+    "image/bmp",
+    "image/svg+xml",
+    "image/x-icon"
+  };
+
+  content_type = content_type.substr(0, content_type.find(';'));
+  if (boost::istarts_with(content_type, "text/")) {
+    return true;
+  }
+  for (const char* type : types) {
+    if (boost::iequals(content_type, type)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string coded_cache_key(std::string const& path, boost::string_ref coding)
+{
+  if (coding.empty()) {
+    return path;
+  }
+
+  // Paths reported by the web root watcher never end with a line break
+  std::string key;
+  key.reserve(path.size() + 1 + coding.size());
+  key += path;
+  key += '\n';
+  key.append(coding.data(), coding.size());
+  return key;
+}
+
+#ifdef ENABLE_GZIP
+bool gzip_compress(const char* data, std::size_t size, int level,
+                   std::string& out)
+{
+  z_stream stream = z_stream();
+  // 16 is added to window bits to get the gzip wrapper instead of zlib one
+  if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  out.resize(deflateBound(&stream, static_cast<uLong>(size)));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream.avail_in = static_cast<uInt>(size);
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = static_cast<uInt>(out.size());
+
+  int ret = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return ret == Z_STREAM_END;
+}
+#endif
+
+} // namespace eiptnd
@@ -0,0 +1,33 @@
+#ifndef HTTP_CONTENT_CODING_HPP
+#define HTTP_CONTENT_CODING_HPP
+
+#include <string>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Does an Accept-Encoding field value allow the content coding, i.e.
+/// it is listed explicitly or by `*` with a non-zero quality.
+bool accepts_encoding(boost::string_ref accept_encoding,
+                      boost::string_ref coding);
+
+/// Is it worth to compress bodies of the content type. Images, media
+/// and archives are compressed already.
+bool is_compressible(boost::string_ref content_type);
+
+/// Key of a file in the cache of hot files when it is sent with a content
+/// coding, e.g. a .gz sibling sent as the gzip coding of the original.
+/// The identity is keyed by the path alone, so a sibling requested
+/// directly and the coded one are cached side by side.
+std::string coded_cache_key(std::string const& path, boost::string_ref coding);
+
+#ifdef ENABLE_GZIP
+/// Compress data into gzip format, false on zlib errors.
+bool gzip_compress(const char* data, std::size_t size, int level,
+                   std::string& out);
+#endif
+
+} // namespace eiptnd
+
+#endif // HTTP_CONTENT_CODING_HPP
@@ -0,0 +1,182 @@
+#include "date_cache.hpp"
+
+#include <cstring>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/conversion.hpp>
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Time rendered by a thread.
+struct local_date
+{
+  boost::int64_t seconds;
+  char text[date_cache::date_size];
+};
+
+thread_local local_date cached_date = { -1, { 0 } };
+
+const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+void put2(char* out, unsigned int value)
+{
+  out[0] = static_cast<char>('0' + value / 10);
+  out[1] = static_cast<char>('0' + value % 10);
+}
+
+bool get_digits(const char* in, std::size_t count, unsigned int& value)
+{
+  value = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (in[i] < '0' || in[i] > '9') {
+      return false;
+    }
+    value = value * 10 + static_cast<unsigned int>(in[i] - '0');
+  }
+  return true;
+}
+
+} // namespace
+
+date_cache::date_cache(boost::asio::io_service& io_service)
+  : timer_(io_service)
+  , seconds_(std::time(0))
+{
+}
+
+void
+date_cache::start()
+{
+  seconds_.store(std::time(0), boost::memory_order_relaxed);
+  schedule();
+}
+
+void
+date_cache::cancel()
+{
+  boost::system::error_code ignored_ec;
+  timer_.cancel(ignored_ec);
+}
+
+boost::string_ref
+date_cache::get() const
+{
+  boost::int64_t seconds = seconds_.load(boost::memory_order_relaxed);
+  if (cached_date.seconds != seconds) {
+    format(static_cast<std::time_t>(seconds), cached_date.text);
+    cached_date.seconds = seconds;
+  }
+  return boost::string_ref(cached_date.text, date_size);
+}
+
+void
+date_cache::format(std::time_t time, char* out)
+{
+  static const char days[] = "ThuFriSatSunMonTueWed";
+
+  boost::int64_t seconds = static_cast<boost::int64_t>(time);
+  boost::int64_t days_count = seconds / 86400;
+  boost::int64_t day_seconds = seconds % 86400;
+  if (day_seconds < 0) {
+    day_seconds += 86400;
+    --days_count;
+  }
+
+  // Civil date from days since the epoch (proleptic Gregorian calendar)
+  boost::int64_t z = days_count + 719468;
+  boost::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned int doe = static_cast<unsigned int>(z - era * 146097);
+  unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned int mp = (5 * doy + 2) / 153;
+  unsigned int day = doy - (153 * mp + 2) / 5 + 1;
+  unsigned int month = mp < 10 ? mp + 3 : mp - 9;
+  boost::int64_t year = static_cast<boost::int64_t>(yoe) + era * 400 +
+      (month <= 2 ? 1 : 0);
+
+  unsigned int weekday = static_cast<unsigned int>(
+      ((days_count % 7) + 7) % 7);
+
+  std::memcpy(out, days + weekday * 3, 3);
+  out[3] = ',';
+  out[4] = ' ';
+  put2(out + 5, day);
+  out[7] = ' ';
+  std::memcpy(out + 8, months + (month - 1) * 3, 3);
+  out[11] = ' ';
+  put2(out + 12, static_cast<unsigned int>(year / 100 % 100));
+  put2(out + 14, static_cast<unsigned int>(year % 100));
+  out[16] = ' ';
+  put2(out + 17, static_cast<unsigned int>(day_seconds / 3600));
+  out[19] = ':';
+  put2(out + 20, static_cast<unsigned int>(day_seconds / 60 % 60));
+  out[22] = ':';
+  put2(out + 23, static_cast<unsigned int>(day_seconds % 60));
+  std::memcpy(out + 25, " GMT", 4);
+}
+
+bool
+date_cache::parse(boost::string_ref text, std::time_t& time)
+{
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  const char* in = text.data();
+  if (text.size() != date_size || in[3] != ',' || in[4] != ' ' ||
+      in[7] != ' ' || in[11] != ' ' || in[16] != ' ' || in[19] != ':' ||
+      in[22] != ':' || boost::string_ref(in + 25, 4) != " GMT") {
+    return false;
+  }
+
+  unsigned int day, year, hours, minutes, seconds;
+  if (!get_digits(in + 5, 2, day) || !get_digits(in + 12, 4, year) ||
+      !get_digits(in + 17, 2, hours) || !get_digits(in + 20, 2, minutes) ||
+      !get_digits(in + 23, 2, seconds)) {
+    return false;
+  }
+
+  unsigned int month = 0;
+  while (month < 12 && std::memcmp(months + month * 3, in + 8, 3) != 0) {
+    ++month;
+  }
+  if (month == 12 || day < 1 || day > 31 || hours > 23 || minutes > 59 ||
+      seconds > 60) {
+    return false;
+  }
+  ++month;
+
+  // Days since the epoch from the civil date
+  boost::int64_t y = static_cast<boost::int64_t>(year) - (month <= 2 ? 1 : 0);
+  boost::int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned int yoe = static_cast<unsigned int>(y - era * 400);
+  unsigned int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  boost::int64_t days_count = era * 146097 + static_cast<boost::int64_t>(doe) - 719468;
+
+  time = static_cast<std::time_t>(
+      days_count * 86400 + hours * 3600 + minutes * 60 + seconds);
+  return true;
+}
+
+void
+date_cache::schedule()
+{
+  // Tick at the start of the next second, so the date does not lag
+  timer_.expires_at(boost::posix_time::from_time_t(
+      static_cast<std::time_t>(seconds_.load(boost::memory_order_relaxed) + 1)));
+  timer_.async_wait(
+      boost::bind(&date_cache::handle_timer, shared_from_this(), _1));
+}
+
+void
+date_cache::handle_timer(const boost::system::error_code& ec)
+{
+  if (ec) {
+    return;
+  }
+
+  seconds_.store(std::time(0), boost::memory_order_relaxed);
+  schedule();
+}
+
+} // namespace eiptnd
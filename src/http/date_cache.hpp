@@ -0,0 +1,57 @@
+#ifndef HTTP_DATE_CACHE_HPP
+#define HTTP_DATE_CACHE_HPP
+
+#include <ctime>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Current time for the Date header field. A timer takes the time once
+/// a second, and every thread renders it once after it was changed, so
+/// responses get the date without system calls and formatting.
+class date_cache
+  : public boost::enable_shared_from_this<date_cache>
+  , private boost::noncopyable
+{
+public:
+  /// Length of IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+  enum { date_size = 29 };
+
+  explicit date_cache(boost::asio::io_service& io_service);
+
+  /// Start refreshing the time.
+  void start();
+
+  /// Stop the timer.
+  void cancel();
+
+  /// Date of the last refresh, it is valid until the next call
+  /// by the same thread.
+  boost::string_ref get() const;
+
+  /// Render `time` as IMF-fixdate (RFC 7231) into `date_size` bytes.
+  static void format(std::time_t time, char* out);
+
+  /// Parse IMF-fixdate, obsolete formats are not accepted.
+  static bool parse(boost::string_ref text, std::time_t& time);
+
+private:
+  void schedule();
+  void handle_timer(const boost::system::error_code& ec);
+
+  boost::asio::deadline_timer timer_;
+
+  /// Seconds since the Unix epoch.
+  boost::atomic<boost::int64_t> seconds_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_DATE_CACHE_HPP
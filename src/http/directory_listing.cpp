@@ -0,0 +1,109 @@
+#include "directory_listing.hpp"
+
+
+namespace eiptnd {
+
+directory_listing::directory_listing(std::string const& dir,
+                                     std::string const& location)
+  : location_(location)
+  , is_open_(false)
+  , started_(false)
+  , finished_(false)
+{
+  boost::system::error_code ec;
+  it_ = boost::filesystem::directory_iterator(dir, ec);
+  is_open_ = !ec;
+}
+
+void
+directory_listing::append_escaped(boost::string_ref text)
+{
+  for (char c : text) {
+    switch (c) {
+    case '&': piece_ += "&amp;"; break;
+    case '<': piece_ += "&lt;"; break;
+    case '>': piece_ += "&gt;"; break;
+    case '"': piece_ += "&quot;"; break;
+    default: piece_ += c;
+    }
+  }
+}
+
+void
+directory_listing::append_link(std::string const& name, bool is_dir)
+{
+  static const char digits[] = "0123456789ABCDEF";
+
+  // Names are percent-encoded in the reference, except for safe characters
+  piece_ += "<a href=\"";
+  for (char c : name) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if ((u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') ||
+        (u >= '0' && u <= '9') || u == '-' || u == '.' || u == '_' ||
+        u == '~') {
+      piece_ += c;
+    }
+    else {
+      piece_ += '%';
+      piece_ += digits[u >> 4];
+      piece_ += digits[u & 0xf];
+    }
+  }
+  if (is_dir) {
+    piece_ += '/';
+  }
+  piece_ += "\">";
+  append_escaped(name);
+  if (is_dir) {
+    piece_ += '/';
+  }
+  piece_ += "</a>\n";
+}
+
+bool
+directory_listing::next(std::string& piece)
+{
+  if (finished_) {
+    return false;
+  }
+
+  if (!started_) {
+    started_ = true;
+    piece_ += "<!DOCTYPE html>\n<html><head><title>Index of ";
+    append_escaped(location_);
+    piece_ += "</title></head>\n<body><h1>Index of ";
+    append_escaped(location_);
+    piece_ += "</h1><hr><pre>\n";
+    if (location_ != "/") {
+      piece_ += "<a href=\"../\">../</a>\n";
+    }
+  }
+
+  boost::system::error_code ec;
+  boost::filesystem::directory_iterator end;
+  while (it_ != end && piece_.size() < piece_size) {
+    boost::filesystem::directory_entry const& entry = *it_;
+    append_link(entry.path().filename().string(),
+                boost::filesystem::is_directory(entry.status(ec)));
+    it_.increment(ec);
+    if (ec) {
+      // The rest of the directory is lost, but the listing is still valid
+      it_ = end;
+    }
+  }
+
+  if (it_ == end) {
+    piece_ += "</pre><hr></body></html>\n";
+    finished_ = true;
+  }
+
+  // The buffer is handed over, as it is held until written
+  piece.swap(piece_);
+  piece_.clear();
+  if (!finished_) {
+    piece_.reserve(piece_size + 1024);
+  }
+  return true;
+}
+
+} // namespace eiptnd
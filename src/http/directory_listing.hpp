@@ -0,0 +1,44 @@
+#ifndef HTTP_DIRECTORY_LISTING_HPP
+#define HTTP_DIRECTORY_LISTING_HPP
+
+#include <string>
+#include <boost/filesystem/operations.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// HTML index of a directory rendered piece by piece while it is read,
+/// so a huge directory is never held in memory as a whole. Entries are
+/// listed in the order of the file system.
+class directory_listing
+  : private boost::noncopyable
+{
+public:
+  /// `location` is the URL path of the directory ending with a slash.
+  directory_listing(std::string const& dir, std::string const& location);
+
+  bool is_open() const { return is_open_; }
+
+  /// Render the next piece, false at the end of the listing.
+  bool next(std::string& piece);
+
+private:
+  /// Pieces are flushed when they grow to this size.
+  static const std::size_t piece_size = 16 * 1024;
+
+  void append_escaped(boost::string_ref text);
+  void append_link(std::string const& name, bool is_dir);
+
+  boost::filesystem::directory_iterator it_;
+  std::string location_;
+  std::string piece_;
+  bool is_open_;
+  bool started_;
+  bool finished_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_DIRECTORY_LISTING_HPP
@@ -0,0 +1,144 @@
+#include "file_cache.hpp"
+
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/functional/hash.hpp>
+
+
+namespace eiptnd {
+
+file_cache::file_cache(std::size_t capacity, std::size_t max_file_size)
+  : shards_(new shard[shards_count])
+  , shard_capacity_(capacity / shards_count)
+  // Single file could not take more than a whole shard
+  , max_file_size_(std::min(max_file_size, shard_capacity_))
+{
+}
+
+bool
+file_cache::is_cacheable(boost::uint64_t file_size) const
+{
+  return enabled() && file_size <= max_file_size_;
+}
+
+file_cache::shard&
+file_cache::get_shard(std::string const& key) const
+{
+  return shards_[boost::hash<std::string>()(key) % shards_count];
+}
+
+cached_response_ptr
+file_cache::find(std::string const& key)
+{
+  if (!enabled()) {
+    return cached_response_ptr();
+  }
+
+  shard& s = get_shard(key);
+  boost::mutex::scoped_lock lock(s.mutex);
+
+  auto found = s.index.find(key);
+  if (found == s.index.end()) {
+    return cached_response_ptr();
+  }
+
+  s.lru.splice(s.lru.begin(), s.lru, found->second);
+  return found->second->second;
+}
+
+void
+file_cache::erase_entry(shard& s, lru_list_t::iterator it)
+{
+  s.size -= it->second->data.size();
+  s.index.erase(it->first);
+  s.lru.erase(it);
+}
+
+void
+file_cache::insert(std::string const& key, cached_response_ptr const& response,
+                   std::size_t generation)
+{
+  std::size_t size = response->data.size();
+  if (!enabled() || size > shard_capacity_) {
+    return;
+  }
+
+  shard& s = get_shard(key);
+  boost::mutex::scoped_lock lock(s.mutex);
+
+  // Checked under the lock, as erase() increments it under the lock too
+  if (generation != s.generation.load()) {
+    return;
+  }
+
+  auto found = s.index.find(key);
+  if (found != s.index.end()) {
+    erase_entry(s, found->second);
+  }
+
+  while (s.size + size > shard_capacity_) {
+    erase_entry(s, std::prev(s.lru.end()));
+  }
+
+  s.lru.push_front(entry_t(key, response));
+  s.index[key] = s.lru.begin();
+  s.size += size;
+}
+
+void
+file_cache::erase(std::string const& key)
+{
+  if (!enabled()) {
+    return;
+  }
+
+  shard& s = get_shard(key);
+  boost::mutex::scoped_lock lock(s.mutex);
+
+  ++s.generation;
+  auto found = s.index.find(key);
+  if (found != s.index.end()) {
+    erase_entry(s, found->second);
+  }
+}
+
+void
+file_cache::erase_tree(std::string const& dir)
+{
+  if (!enabled()) {
+    return;
+  }
+
+  std::string path = dir;
+  while (!path.empty() && path[path.size() - 1] == '/') {
+    path.erase(path.size() - 1);
+  }
+  std::string const prefix = path + '/';
+
+  for (std::size_t i = 0; i < shards_count; ++i) {
+    shard& s = shards_[i];
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    ++s.generation;
+    for (auto it = s.lru.begin(); it != s.lru.end(); ) {
+      auto next = std::next(it);
+      if (it->first == path || boost::starts_with(it->first, prefix)) {
+        erase_entry(s, it);
+      }
+      it = next;
+    }
+  }
+}
+
+std::size_t
+file_cache::size() const
+{
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < shards_count; ++i) {
+    boost::mutex::scoped_lock lock(shards_[i].mutex);
+    total += shards_[i].size;
+  }
+  return total;
+}
+
+} // namespace eiptnd
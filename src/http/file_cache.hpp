@@ -0,0 +1,113 @@
+#ifndef HTTP_FILE_CACHE_HPP
+#define HTTP_FILE_CACHE_HPP
+
+#include <ctime>
+#include <list>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Response to a file request without the status line: pre-rendered
+/// header fields followed by the file content. It is never modified after
+/// it was cached, so it could be written by many connections at the same time.
+struct cached_response
+{
+  std::string data;
+  std::size_t header_size;
+
+  /// Validators of the file. Their header fields (with Vary) are rendered
+  /// at the beginning of `data`, so a 304 response copies them as they are.
+  std::string etag;
+  std::time_t last_modified;
+  std::size_t validators_size;
+
+  /// Representation of the body, the coding is empty for the identity.
+  std::string content_type;
+  std::string content_encoding;
+
+  boost::string_ref validators() const
+  { return boost::string_ref(data.data(), validators_size); }
+};
+
+typedef boost::shared_ptr<const cached_response> cached_response_ptr;
+
+/// Memory bounded cache of hot files keyed by the resolved path.
+/// Keys are distributed over shards with independent locks and
+/// LRU lists, so threads serving different files do not contend.
+class file_cache
+  : private boost::noncopyable
+{
+public:
+  /// Zero `capacity` disables the cache.
+  file_cache(std::size_t capacity, std::size_t max_file_size);
+
+  bool enabled() const { return shard_capacity_ > 0; }
+
+  /// Can a file of given size be placed into the cache.
+  bool is_cacheable(boost::uint64_t file_size) const;
+
+  /// Find response and mark it as recently used.
+  cached_response_ptr find(std::string const& key);
+
+  /// Insert response evicting least recently used ones when needed.
+  /// The response is dropped if anything was erased from the shard of
+  /// `key` since `generation` was taken, as it may be read from the file
+  /// that has been changed.
+  void insert(std::string const& key, cached_response_ptr const& response,
+              std::size_t generation);
+
+  /// Remove response from the cache.
+  void erase(std::string const& key);
+
+  /// Remove responses for all files under the directory.
+  void erase_tree(std::string const& dir);
+
+  /// Counter of erase operations of the shard owning `key`. It should
+  /// be taken before the file is examined, i.e. before stat(2).
+  std::size_t generation(std::string const& key) const
+  { return get_shard(key).generation.load(); }
+
+  /// Total size of cached responses.
+  std::size_t size() const;
+
+private:
+  typedef std::pair<std::string, cached_response_ptr> entry_t;
+  typedef std::list<entry_t> lru_list_t;
+
+  struct shard
+  {
+    shard() : size(0), generation(0) {}
+
+    mutable boost::mutex mutex;
+    /// Most recently used entries are at the front.
+    lru_list_t lru;
+    boost::unordered_map<std::string, lru_list_t::iterator> index;
+    std::size_t size;
+
+    /// Incremented under the lock by every erase of the shard.
+    boost::atomic<std::size_t> generation;
+  };
+
+  shard& get_shard(std::string const& key) const;
+
+  static void erase_entry(shard& s, lru_list_t::iterator it);
+
+  static const std::size_t shards_count = 16;
+
+  boost::scoped_array<shard> shards_;
+  std::size_t shard_capacity_;
+  std::size_t max_file_size_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_FILE_CACHE_HPP
@@ -0,0 +1,39 @@
+#include "file_handle.hpp"
+
+#ifdef ENABLE_FILE_HANDLE
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace eiptnd {
+
+file_handle::file_handle(std::string const& path)
+  : fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+  , size_(0)
+{
+  if (fd_ == -1) {
+    return;
+  }
+
+  struct stat st;
+  if (::fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+
+  size_ = static_cast<boost::uint64_t>(st.st_size);
+}
+
+file_handle::~file_handle()
+{
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+}
+
+} // namespace eiptnd
+
+#endif // ENABLE_FILE_HANDLE
@@ -0,0 +1,42 @@
+#ifndef HTTP_FILE_HANDLE_HPP
+#define HTTP_FILE_HANDLE_HPP
+
+#if defined(__linux__)
+/// Bodies sent by sendfile(2) are read from descriptors of opened files.
+# define ENABLE_FILE_HANDLE
+#endif
+
+#ifdef ENABLE_FILE_HANDLE
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+
+namespace eiptnd {
+
+/// Read-only descriptor of a regular file which is sent as a response body.
+class file_handle
+  : private boost::noncopyable
+{
+public:
+  explicit file_handle(std::string const& path);
+  ~file_handle();
+
+  /// Is the file opened and is it a regular file.
+  bool is_open() const { return fd_ != -1; }
+
+  int native_handle() const { return fd_; }
+
+  boost::uint64_t size() const { return size_; }
+
+private:
+  int fd_;
+  boost::uint64_t size_;
+};
+
+} // namespace eiptnd
+
+#endif // ENABLE_FILE_HANDLE
+
+#endif // HTTP_FILE_HANDLE_HPP
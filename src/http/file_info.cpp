@@ -0,0 +1,102 @@
+#include "file_info.hpp"
+
+#include "request_parser.hpp"
+
+#include <boost/filesystem.hpp>
+
+#if defined(BOOST_POSIX_API)
+#include <sys/stat.h>
+#endif
+
+
+namespace eiptnd {
+
+namespace {
+
+void append_hex(std::string& out, boost::uint64_t value)
+{
+  static const char digits[] = "0123456789abcdef";
+  char buf[16];
+  char* first = buf + sizeof(buf);
+  do {
+    *--first = digits[value & 0xf];
+    value >>= 4;
+  } while (value);
+  out.append(first, buf + sizeof(buf));
+}
+
+/// Drop the weakness indicator, it is ignored by the weak comparison.
+boost::string_ref opaque_tag(boost::string_ref tag)
+{
+  if (tag.starts_with("W/")) {
+    tag.remove_prefix(2);
+  }
+  return tag;
+}
+
+} // namespace
+
+bool get_file_info(std::string const& path, file_info& info)
+{
+#if defined(BOOST_POSIX_API)
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  info.is_regular = S_ISREG(st.st_mode);
+  info.is_directory = S_ISDIR(st.st_mode);
+  info.size = static_cast<boost::uint64_t>(st.st_size);
+  info.mtime = st.st_mtime;
+  info.inode = static_cast<boost::uint64_t>(st.st_ino);
+  return true;
+#else
+  boost::system::error_code ec;
+  boost::filesystem::file_status status = boost::filesystem::status(path, ec);
+  if (ec || !boost::filesystem::exists(status)) {
+    return false;
+  }
+
+  info.is_regular = boost::filesystem::is_regular_file(status);
+  info.is_directory = boost::filesystem::is_directory(status);
+  if (info.is_regular) {
+    info.size = boost::filesystem::file_size(path, ec);
+    info.mtime = boost::filesystem::last_write_time(path, ec);
+  }
+  info.inode = 0;
+  return true;
+#endif
+}
+
+std::string make_etag(file_info const& info)
+{
+  std::string etag;
+  etag.reserve(40);
+  etag += '"';
+  append_hex(etag, info.inode);
+  etag += '-';
+  append_hex(etag, static_cast<boost::uint64_t>(info.mtime));
+  etag += '-';
+  append_hex(etag, info.size);
+  etag += '"';
+  return etag;
+}
+
+bool etag_matches(boost::string_ref if_none_match, boost::string_ref etag)
+{
+  etag = opaque_tag(etag);
+
+  while (!if_none_match.empty()) {
+    std::size_t comma = if_none_match.find(',');
+    boost::string_ref tag = trim_ows(if_none_match.substr(0, comma));
+    if_none_match.remove_prefix(comma == boost::string_ref::npos
+                                ? if_none_match.size() : comma + 1);
+
+    if (tag == "*" || opaque_tag(tag) == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace eiptnd
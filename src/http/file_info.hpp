@@ -0,0 +1,38 @@
+#ifndef HTTP_FILE_INFO_HPP
+#define HTTP_FILE_INFO_HPP
+
+#include <ctime>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Attributes of a file which identify its content.
+struct file_info
+{
+  file_info()
+    : is_regular(false), is_directory(false), size(0), mtime(0), inode(0) {}
+
+  bool is_regular;
+  bool is_directory;
+  boost::uint64_t size;
+  std::time_t mtime;
+  boost::uint64_t inode;
+};
+
+/// Take attributes of a file by a single stat, false if it does not exist.
+bool get_file_info(std::string const& path, file_info& info);
+
+/// Strong entity tag of the file, e.g. "1a2b-5f00c1d2-3e8". It changes
+/// when the file is replaced or modified.
+std::string make_etag(file_info const& info);
+
+/// Does an If-None-Match field value match the entity tag. Tags are
+/// compared weakly, as required for GET and HEAD requests.
+bool etag_matches(boost::string_ref if_none_match, boost::string_ref etag);
+
+} // namespace eiptnd
+
+#endif // HTTP_FILE_INFO_HPP
@@ -0,0 +1,56 @@
+#include "header_builder.hpp"
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Reference to a literal, its length is known at compile time.
+template <std::size_t N>
+boost::string_ref literal(const char (&s)[N])
+{
+  return boost::string_ref(s, N - 1);
+}
+
+} // namespace
+
+boost::string_ref status_line_tail(unsigned short code)
+{
+  switch (code) {
+  case 100: return literal("100 Continue\r\n");
+  case 200: return literal("200 OK\r\n");
+  case 201: return literal("201 Created\r\n");
+  case 202: return literal("202 Accepted\r\n");
+  case 204: return literal("204 No Content\r\n");
+  case 206: return literal("206 Partial Content\r\n");
+  case 301: return literal("301 Moved Permanently\r\n");
+  case 302: return literal("302 Found\r\n");
+  case 304: return literal("304 Not Modified\r\n");
+  case 307: return literal("307 Temporary Redirect\r\n");
+  case 400: return literal("400 Bad Request\r\n");
+  case 403: return literal("403 Forbidden\r\n");
+  case 404: return literal("404 Not Found\r\n");
+  case 405: return literal("405 Method Not Allowed\r\n");
+  case 408: return literal("408 Request Timeout\r\n");
+  case 411: return literal("411 Length Required\r\n");
+  case 412: return literal("412 Precondition Failed\r\n");
+  case 413: return literal("413 Payload Too Large\r\n");
+  case 414: return literal("414 URI Too Long\r\n");
+  case 416: return literal("416 Range Not Satisfiable\r\n");
+  case 431: return literal("431 Request Header Fields Too Large\r\n");
+  case 500: return literal("500 Internal Server Error\r\n");
+  case 501: return literal("501 Not Implemented\r\n");
+  case 503: return literal("503 Service Unavailable\r\n");
+  case 505: return literal("505 HTTP Version Not Supported\r\n");
+  }
+
+  if (code >= 500) {
+    return literal("500 Internal Server Error\r\n");
+  }
+  if (code >= 400) {
+    return literal("400 Bad Request\r\n");
+  }
+  return literal("200 OK\r\n");
+}
+
+} // namespace eiptnd
@@ -0,0 +1,97 @@
+#ifndef HTTP_HEADER_BUILDER_HPP
+#define HTTP_HEADER_BUILDER_HPP
+
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Status code with its reason phrase and the line ending,
+/// e.g. "404 Not Found\r\n". Unknown codes get a generic phrase.
+boost::string_ref status_line_tail(unsigned short code);
+
+/// Response status line and header fields rendered into a fixed buffer,
+/// without iostreams and allocations. Data which does not fit is dropped
+/// and the builder is marked as overflowed.
+class header_builder
+{
+public:
+  enum { capacity = 1024 };
+
+  header_builder() : size_(0), overflow_(false) {}
+
+  void clear()
+  {
+    size_ = 0;
+    overflow_ = false;
+  }
+
+  header_builder& status_line(bool http11, unsigned short code)
+  {
+    append(http11 ? "HTTP/1.1 " : "HTTP/1.0 ", 9);
+    return append(status_line_tail(code));
+  }
+
+  header_builder& field(boost::string_ref name, boost::string_ref value)
+  {
+    append(name);
+    append(": ", 2);
+    append(value);
+    return append("\r\n", 2);
+  }
+
+  header_builder& field(boost::string_ref name, boost::uint64_t value)
+  {
+    append(name);
+    append(": ", 2);
+    append_uint(value);
+    return append("\r\n", 2);
+  }
+
+  /// The empty line ending the header.
+  header_builder& end()
+  { return append("\r\n", 2); }
+
+  header_builder& append(boost::string_ref s)
+  { return append(s.data(), s.size()); }
+
+  header_builder& append(const char* s, std::size_t n)
+  {
+    if (n > capacity - size_) {
+      overflow_ = true;
+      n = capacity - size_;
+    }
+    std::memcpy(data_ + size_, s, n);
+    size_ += n;
+    return *this;
+  }
+
+  header_builder& append_uint(boost::uint64_t value)
+  {
+    char digits[20];
+    char* first = digits + sizeof(digits);
+    do {
+      *--first = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while (value);
+    return append(first, digits + sizeof(digits) - first);
+  }
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool overflow() const { return overflow_; }
+
+  boost::string_ref str() const
+  { return boost::string_ref(data_, size_); }
+
+private:
+  char data_[capacity];
+  std::size_t size_;
+  bool overflow_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_HEADER_BUILDER_HPP
@@ -1,6 +1,12 @@
 #include "http_connection.hpp"
 
-#include <boost/asio/buffers_iterator.hpp>
+#include "../core.hpp"
+#include "content_coding.hpp"
+#include "date_cache.hpp"
+#include "directory_listing.hpp"
+
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <fstream>
@@ -13,186 +19,1340 @@ http_connection::http_connection(boost::shared_ptr<connection> connection)
   : log_(boost::log::keywords::channel = "http-connection@" +
         boost::lexical_cast<std::string>(connection->remote_endpoint()))
   , conn_(boost::move(connection))
+  , shard_(conn_->get_shard())
+  , requests_count_(0)
+  , http11_(false)
+  , keep_alive_(false)
+  , head_request_(false)
+  , request_pending_(false)
+  , status_(0)
+  , request_sent_bytes_(0)
+  , stream_chunked_(false)
+  , stream_header_pending_(false)
+  , access_pending_(false)
+  , method_(other_method)
+#ifdef ENABLE_SEGMENTED_TRANSFER
+  , file_remaining_(0)
+  , window_(0)
+#endif
 {
+#ifdef ENABLE_SEGMENTED_TRANSFER
+  chunk_sizes_.fill(0);
+#endif
 }
 
-template <typename Iterator>
-bool parse_request(Iterator const& first, Iterator const& last,
-                   std::string & mtd, std::string & url, std::string & ver)
+boost::shared_ptr<http_connection>
+http_connection::create(boost::shared_ptr<connection> connection)
 {
-  const std::string delim(" ");
+  io_shard* shard = connection->get_shard();
+  http_connection* raw = 0;
+  if (io_shard::thread_context* context = shard->this_thread_context()) {
+    raw = context->http_connections.acquire();
+  }
 
-  auto mtd_last = std::search(first, last,
-                              std::begin(delim), std::end(delim));
-  if (mtd_last == last) {
-    return false;
+  if (raw) {
+    raw->log_.channel("http-connection@" +
+        boost::lexical_cast<std::string>(connection->remote_endpoint()));
+    raw->conn_ = boost::move(connection);
   }
-  auto url_first = std::next(mtd_last, 1);
-  auto url_last = std::search(url_first, last,
-                              std::begin(delim), std::end(delim));
-  if (url_last == last) {
-    return false;
+  else {
+    raw = new http_connection(boost::move(connection));
   }
 
-  auto ver_first = std::next(url_last, 1);
-  if (ver_first == last) {
-    return false;
+  return boost::shared_ptr<http_connection>(raw, &http_connection::recycle);
+}
+
+void
+http_connection::recycle(http_connection* p)
+{
+  p->reset();
+
+  io_shard::thread_context* context = p->shard_->this_thread_context();
+  if (!context || !context->http_connections.release(p)) {
+    delete p;
+  }
+}
+
+void
+http_connection::reset()
+{
+  // The response was aborted, but its part could be sent
+  if (request_pending_) {
+    finish_request();
+  }
+
+  conn_.reset();
+  in_buf_.consume(in_buf_.size());
+  parser_.reset();
+  requests_count_ = 0;
+  http11_ = false;
+  keep_alive_ = false;
+  head_request_ = false;
+  status_ = 0;
+  target_.clear();
+
+  file_.reset();
+  ranges_.clear();
+  parts_.clear();
+  stream_chunked_ = false;
+  stream_header_pending_ = false;
+#ifdef ENABLE_SEGMENTED_TRANSFER
+  file_remaining_ = 0;
+  window_ = 0;
+  chunk_sizes_.fill(0);
+#endif
+}
+
+/// Check the list of Connection field options for a token.
+bool has_connection_option(boost::string_ref options, boost::string_ref token)
+{
+  while (!options.empty()) {
+    std::size_t comma = options.find(',');
+    boost::string_ref option = trim_ows(options.substr(0, comma));
+    options.remove_prefix(comma == boost::string_ref::npos ? options.size()
+                                                           : comma + 1);
+    if (boost::iequals(option, token)) {
+      return true;
+    }
   }
+  return false;
+}
 
-  mtd.assign(first, mtd_last);
-  url.assign(url_first, url_last);
-  ver.assign(ver_first, last);
+/// Decode %XX escapes of a URL path. Escaped slashes and NULs are
+/// refused, as they would change the way the path is split or cut.
+static bool decode_path(boost::string_ref path, std::string& decoded)
+{
+  decoded.clear();
+  decoded.reserve(path.size());
+  for (std::size_t i = 0; i < path.size(); ++i) {
+    if (path[i] != '%') {
+      decoded += path[i];
+      continue;
+    }
 
+    int value = 0;
+    for (std::size_t j = i + 1; j < i + 3; ++j) {
+      char c = j < path.size() ? path[j] : 0;
+      if (c >= '0' && c <= '9') {
+        value = value * 16 + (c - '0');
+      }
+      else if (c >= 'a' && c <= 'f') {
+        value = value * 16 + (c - 'a' + 10);
+      }
+      else if (c >= 'A' && c <= 'F') {
+        value = value * 16 + (c - 'A' + 10);
+      }
+      else {
+        return false;
+      }
+    }
+    if (value == '/' || value == 0) {
+      return false;
+    }
+    decoded += static_cast<char>(value);
+    i += 2;
+  }
   return true;
 }
 
-void http_connection::send_file(std::string const& url)
+/// Append a decoded URL path percent-encoding everything except
+/// unreserved characters and slashes, so it can't break out of
+/// a header line however the request was escaped.
+static void append_encoded_path(std::string& out, std::string const& path)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  for (char c : path) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if ((u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') ||
+        (u >= '0' && u <= '9') || u == '-' || u == '.' || u == '_' ||
+        u == '~' || u == '/') {
+      out += c;
+    }
+    else {
+      out += '%';
+      out += digits[u >> 4];
+      out += digits[u & 0xf];
+    }
+  }
+}
+
+void http_connection::send_file(boost::string_ref url)
 {
   BOOST_LOG_SEV(log_, logging::trace)
     << "send_file(): " << url;
 
-  auto found = url.find_first_of("?");
-  if (std::string::npos == found) {
-    found = url.find_first_of("#");
-  }
+  std::size_t query = url.find_first_of("?#");
+  boost::string_ref raw = url.substr(0, query);
 
-  auto first = std::begin(url);
-  auto last = (std::string::npos == found) ? std::end(url)
-                                           : std::next(first, +found);
+  std::string loc;
+  if (!decode_path(raw, loc)) {
+    make_simple_answer(400, "Bad path");
+    return;
+  }
 
-  // TODO: Add encoding support T_T
-  std::string loc(first, last);
+  core const& core = conn_->get_core();
 
+  // The web root is listed when it has no index
   if (loc == "/") {
-    loc = "/index.html";
+    file_info index;
+    if (!core.get_autoindex() ||
+        (get_file_info(conn_->get_webroot() + "/index.html", index) &&
+         index.is_regular)) {
+      loc = "/index.html";
+    }
+  }
+
+  // The path is built lexically, so every file has a single cache key
+  // matching paths reported by the web root watcher.
+  boost::filesystem::path rel;
+  for (boost::filesystem::path const& elem : boost::filesystem::path(loc)) {
+    if (elem == "..") {
+      rel.remove_filename();
+    }
+    else if (elem != "." && elem != "/") {
+      rel /= elem;
+    }
   }
 
   boost::filesystem::path path(conn_->get_webroot());
-  path /= boost::filesystem::path(loc);
+  path /= rel;
 
   BOOST_LOG_SEV(log_, logging::trace)
     << "Converted path: " << path;
 
   if (!path.has_filename()) {
-    make_simple_answer(204, "No Content", "Is not a file");
+    make_simple_answer(204, "Is not a file");
     return;
   }
 
-  if (!boost::filesystem::exists(path)) {
-    make_simple_answer(404, "Not Found", "Sorry :(");
+  std::string const key = path.string();
+  boost::string_ref content_type = core.get_mime_types().find(key);
+  bool compressible = core.get_gzip() && is_compressible(content_type);
+  bool vary = core.get_precompressed() || compressible;
+
+  // Compressed siblings prepared in advance are preferred
+  if (core.get_precompressed() && !accept_encoding_.empty()) {
+    if (accepts_encoding(accept_encoding_, "br") &&
+        send_static(key + ".br", content_type, "br", vary)) {
+      return;
+    }
+    if (accepts_encoding(accept_encoding_, "gzip") &&
+        send_static(key + ".gz", content_type, "gzip", vary)) {
+      return;
+    }
+  }
+
+  // Ranges are served from the identity, so they stay cheap to seek
+  if (compressible && range_.empty() &&
+      accepts_encoding(accept_encoding_, "gzip") &&
+      send_compressed(key, content_type)) {
+    return;
+  }
+
+  if (send_static(key, content_type, boost::string_ref(), vary)) {
+    return;
+  }
+
+  file_info info;
+  if (core.get_autoindex() && get_file_info(key, info) && info.is_directory) {
+    // Relative links of the listing are resolved against its URL,
+    // which must end with a slash. The location is built from the
+    // normalized path, so it is always local to this server.
+    if (raw.empty() || raw[raw.size() - 1] != '/') {
+      // A leading "//" is a root name for the lexical path, and it
+      // would make the location protocol-relative
+      std::string path = rel.generic_string();
+      std::string redirect = "/";
+      append_encoded_path(redirect,
+          path.substr(std::min(path.find_first_not_of('/'), path.size())));
+      if (redirect[redirect.size() - 1] != '/') {
+        redirect += '/';
+      }
+      if (query != boost::string_ref::npos && url[query] == '?') {
+        redirect.append(url.data() + query, url.size() - query);
+      }
+      send_redirect(redirect);
+      return;
+    }
+
+    std::string location = "/" + rel.generic_string();
+    if (location[location.size() - 1] != '/') {
+      location += '/';
+    }
+    send_directory(key, location);
     return;
   }
 
+  make_simple_answer(404, "Sorry :(");
+}
+
+bool http_connection::send_static(std::string const& key,
+                                  boost::string_ref content_type,
+                                  boost::string_ref content_encoding,
+                                  bool vary)
+{
+  // Hot files are served without touching the file system. A sibling
+  // sent as the coding of another file has an entry of its own.
+  file_cache& cache = conn_->get_core().get_file_cache();
+  std::string const cache_key = coded_cache_key(key, content_encoding);
+  if (cached_response_ptr cached = cache.find(cache_key)) {
+    BOOST_LOG_SEV(log_, logging::trace) << "Cache hit: " << key;
+    send_cached_file(cached);
+    return true;
+  }
+
+  // Taken before the file is examined, so a change seen by the watcher
+  // meanwhile keeps a response of the old file out of the cache
+  std::size_t generation = cache.generation(cache_key);
+
+  // Directories and special files are not sent as they are
+  file_info info;
+  if (!get_file_info(key, info) || !info.is_regular) {
+    return false;
+  }
+
+  std::string etag = make_etag(info);
+  std::string validators = make_validators(etag, info.mtime, vary);
+  if (is_not_modified(etag, info.mtime)) {
+    send_not_modified(validators);
+    return true;
+  }
+
+  if (cache.enabled() && cache.is_cacheable(info.size)) {
+    if (cached_response_ptr loaded = load_response(key, info, content_type,
+                                                   content_encoding, vary)) {
+      cache.insert(cache_key, loaded, generation);
+      send_cached_file(loaded);
+      return true;
+    }
+  }
+
+  // Larger files are shared from the page cache by all connections
+  mapping_cache& mappings = conn_->get_core().get_mapping_cache();
+  if (mappings.is_mappable(info.size)) {
+    if (mapped_file_ptr mapped = mappings.get(key, info)) {
+      send_mapped(mapped, info.mtime, content_type, content_encoding,
+                  validators);
+      return true;
+    }
+  }
+
+  boost::uint64_t size = 0;
 #ifdef ENABLE_SEGMENTED_TRANSFER
-  // TODO: Segmented transfer
   auto f = boost::make_shared<std::ifstream>();
-  f->open(path.string(), std::ios::binary);
+  f->open(key, std::ios::binary);
   if (f->is_open()) {
-    auto buf = boost::make_shared<std::ifstream>();
-    auto cb = [f](){
-
-    }
+    f->seekg(0, std::ios::end);
+    size = static_cast<boost::uint64_t>(f->tellg());
+    f->seekg(0, std::ios::beg);
+    file_ = f;
   }
 #else
-  std::ifstream f;
-  f.open(path.string(), std::ios::binary);
-  if (f.is_open()) {
-    std::string content;
-    f.seekg(0, std::ios::end);
-    content.reserve(f.tellg());
-    f.seekg(0, std::ios::beg);
-    content.assign(std::istreambuf_iterator<char>(f),
-                   std::istreambuf_iterator<char>());
-    make_simple_answer(200, "OK", content);
+  auto f = boost::make_shared<file_handle>(key);
+  if (f->is_open()) {
+    size = f->size();
+    file_ = f;
   }
 #endif
+
+  if (!file_) {
+    make_simple_answer(500, "Whoops!");
+    return true;
+  }
+
+  // Ranges are taken against the opened file, which may differ from
+  // the one described by `info` if it has just been replaced
+  range_result ranges = select_ranges(etag, info.mtime, size);
+  if (ranges == range_unsatisfiable) {
+    file_.reset();
+    send_range_not_satisfiable(size);
+    return true;
+  }
+
+  if (ranges == range_satisfiable) {
+    make_partial_header(size, content_type, content_encoding, validators);
+  }
   else {
-    make_simple_answer(500, "Internal Error", "Whoops!");
+    ranges_.assign(1, byte_range(0, size));
+    make_header(200, size, content_type, validators, content_encoding);
   }
+
+  if (head_request_) {
+    file_.reset();
+    send_header_only();
+    return true;
+  }
+  if (!check_header()) {
+    file_.reset();
+    return true;
+  }
+
+#ifdef ENABLE_SEGMENTED_TRANSFER
+  std::size_t chunk_size = conn_->get_core().get_chunk_size();
+  for (std::vector<char>& chunk : chunks_) {
+    chunk.resize(chunk_size);
+  }
+#endif
+
+  send_window(0);
+  return true;
 }
 
-void http_connection::make_simple_answer(unsigned short code,
-                                         std::string const& repl,
-                                         std::string const& body)
+bool http_connection::send_compressed(std::string const& key,
+                                      boost::string_ref content_type)
 {
-  BOOST_LOG_SEV(log_, logging::trace)
-    << "Answer: " << code << " " << repl;
+#ifdef ENABLE_GZIP
+  core const& core = conn_->get_core();
 
-  /*Date: Mon, 27 Jul 2009 12:28:53 GMT
-  Server: Apache/2.2.14 (Win32)
-  Last-Modified: Wed, 22 Jul 2009 19:15:56 GMT
-  Content-Length: 88
-  Content-Type: text/html
-  Connection: Closed*/
+  // Validators of the identity are taken without stat(2) when it is hot
+  cached_response_ptr identity = core.get_file_cache().find(key);
 
-  std::ostringstream ss;
-  ss << "HTTP/1.0 " << code << " " << repl << "\r\nConnection: Closed\r\n";
-  if (body.size()) {
-    ss << "Content-Length: " << body.size() << "\r\n"
-          "Content-Type: text/html\r\n"
-          "\r\n"
-       << body;
+  std::string etag;
+  std::time_t last_modified;
+  boost::uint64_t size;
+  if (identity) {
+    etag = identity->etag;
+    last_modified = identity->last_modified;
+    size = identity->data.size() - identity->header_size;
   }
   else {
-    ss << "\r\n";
+    file_info info;
+    if (!get_file_info(key, info) || !info.is_regular) {
+      return false;
+    }
+    etag = make_etag(info);
+    last_modified = info.mtime;
+    size = info.size;
   }
-  auto buf = boost::make_shared<std::string>(ss.str());
 
-  conn_->do_write_cb(boost::asio::buffer(*buf), [buf](){});
-}
+  if (size < core.get_gzip_min_size() || size > core.get_gzip_max_size()) {
+    return false;
+  }
 
-template <typename Iterator>
-bool http_connection::process_request(Iterator & first, Iterator const& last)
-{
-  auto iter = first;
+  // The variant has own entity tag, and the key of its cache entry is
+  // versioned by it, so stale variants are never found and just age out
+  etag.insert(etag.size() - 1, "-gzip");
+  std::string variant_key = key;
+  variant_key += '\n';
+  variant_key += etag;
 
-  std::string mtd, url, ver;
+  file_cache& variants = core.get_compressed_cache();
+  if (cached_response_ptr cached = variants.find(variant_key)) {
+    BOOST_LOG_SEV(log_, logging::trace) << "Compressed cache hit: " << key;
+    send_cached_file(cached);
+    return true;
+  }
 
-  // Iterate over every line
-  const std::string delim("\r\n");
-  for (std::size_t i = 0; iter != last; ++i) {
-    auto found = std::search(iter, last, std::begin(delim), std::end(delim));
-    // Empty line is the marker of the end of headers
-    if (iter == found) {
-      auto size = std::distance(found, last) - delim.size();
-      if (size > 0) {
-        BOOST_LOG_SEV(log_, logging::trace)
-          << "Request has body of " << size << " bytes";
-        make_simple_answer(400, "Bad Request",
-                           "I don't understand what you want");
-      }
-      else {
-        send_file(url);
+  if (is_not_modified(etag, last_modified)) {
+    send_not_modified(make_validators(etag, last_modified, true));
+    return true;
+  }
+
+  // Deflate runs in the worker pool, the connection waits for it
+  // without any pending operation. The request fields are not needed
+  // anymore: conditions are checked already and ranges are absent.
+  // The wait is limited like a write, the deadline of the head would
+  // close a keep-alive connection whose timeout is short.
+  conn_->start_response_deadline();
+  auto self = shared_from_this();
+  boost::shared_ptr<connection> conn = conn_;
+  std::size_t generation = variants.generation(variant_key);
+  int level = core.get_gzip_level();
+  return core.get_compression_pool()->post(
+      [self, conn, identity, key, variant_key, etag, last_modified, size,
+       content_type, level, generation, &variants]() {
+    std::string body;
+    const char* data;
+    if (identity) {
+      data = identity->data.data() + identity->header_size;
+    }
+    else {
+      std::ifstream f(key, std::ios::binary);
+      body.resize(static_cast<std::size_t>(size));
+      f.read(&body[0], static_cast<std::streamsize>(size));
+      if (static_cast<boost::uint64_t>(f.gcount()) != size) {
+        body.clear();
       }
-      break;
+      data = body.data();
     }
 
-    // First line is request string, while other is fields
-    if (i == 0) {
-      if (parse_request(iter, found, mtd, url, ver)) {
-        BOOST_LOG_SEV(log_, logging::trace) << "MTD: " << mtd;
-        BOOST_LOG_SEV(log_, logging::trace) << "URL: " << url;
-        BOOST_LOG_SEV(log_, logging::trace) << "VER: " << ver;
-      }
-      else {
-        BOOST_LOG_SEV(log_, logging::error)
-          << "Parsing request failed";
-        return false;
+    std::string compressed;
+    cached_response_ptr response;
+    if ((identity || !body.empty()) &&
+        gzip_compress(data, static_cast<std::size_t>(size), level, compressed)) {
+      if (auto rendered = make_response(etag, last_modified, compressed.size(),
+                                        content_type, "gzip", true)) {
+        rendered->data += compressed;
+        response = rendered;
+        variants.insert(variant_key, response, generation);
       }
     }
-    else {
-      // TODO: parse fields
+
+    conn->post_in_strand([self, key, content_type, response]() {
+      self->handle_compressed(key, content_type, response);
+    });
+  });
+#else
+  (void)key;
+  (void)content_type;
+  return false;
+#endif
+}
+
+void http_connection::handle_compressed(std::string const& key,
+                                        boost::string_ref content_type,
+                                        cached_response_ptr const& response)
+{
+  if (!conn_) {
+    return;
+  }
+
+  if (response) {
+    send_cached(response);
+  }
+  else if (!send_static(key, content_type, boost::string_ref(), true)) {
+    make_simple_answer(404, "Sorry :(");
+  }
+}
+
+void http_connection::send_cached_file(cached_response_ptr const& response)
+{
+  if (is_not_modified(response->etag, response->last_modified)) {
+    send_not_modified(response->validators());
+    return;
+  }
+
+  boost::uint64_t size = response->data.size() - response->header_size;
+  switch (select_ranges(response->etag, response->last_modified, size)) {
+  case range_satisfiable:
+    send_cached_ranges(response);
+    break;
+  case range_unsatisfiable:
+    send_range_not_satisfiable(size);
+    break;
+  default:
+    send_cached(response);
+  }
+}
+
+void http_connection::send_mapped(mapped_file_ptr const& mapped,
+                                  std::time_t last_modified,
+                                  boost::string_ref content_type,
+                                  boost::string_ref content_encoding,
+                                  boost::string_ref validators)
+{
+  boost::uint64_t size = mapped->size();
+  std::vector<boost::asio::const_buffer> buffers;
+  switch (select_ranges(mapped->etag(), last_modified, size)) {
+  case range_satisfiable:
+    make_partial_header(size, content_type, content_encoding, validators);
+    append_range_buffers(mapped->data(), buffers);
+    break;
+  case range_unsatisfiable:
+    send_range_not_satisfiable(size);
+    return;
+  default:
+    make_header(200, size, content_type, validators, content_encoding);
+    buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+    buffers.push_back(boost::asio::buffer(mapped->data(),
+                                          static_cast<std::size_t>(size)));
+  }
+
+  if (head_request_) {
+    send_header_only();
+    return;
+  }
+  if (!check_header()) {
+    return;
+  }
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers,
+                     [self, mapped]() { self->handle_response_sent(); });
+}
+
+range_result http_connection::select_ranges(boost::string_ref etag,
+                                            std::time_t last_modified,
+                                            boost::uint64_t size)
+{
+  ranges_.clear();
+  parts_.clear();
+
+  // A stale partial representation would be combined with the new one
+  if (range_.empty() || (!if_range_.empty() &&
+                         !if_range_matches(if_range_, etag, last_modified))) {
+    return range_ignored;
+  }
+  return parse_ranges(range_, size, max_ranges, ranges_);
+}
+
+/// Append "bytes first-last/size" of a range.
+static void append_range(header_builder& header, byte_range const& range,
+                         boost::uint64_t size)
+{
+  header.append("bytes ", 6)
+        .append_uint(range.offset)
+        .append("-", 1)
+        .append_uint(range.offset + range.length - 1)
+        .append("/", 1)
+        .append_uint(size);
+}
+
+void http_connection::make_partial_header(boost::uint64_t size,
+                                          boost::string_ref content_type,
+                                          boost::string_ref content_encoding,
+                                          boost::string_ref validators)
+{
+  make_status_line(206);
+  header_.append(validators);
+
+  if (ranges_.size() == 1) {
+    header_.append("Content-Range: ", 15);
+    append_range(header_, ranges_[0], size);
+    header_.append("\r\n", 2);
+    make_entity_header(header_, ranges_[0].length, content_type,
+                       content_encoding);
+    return;
+  }
+
+  // Delimiters of the parts are rendered up front, so the length of
+  // the body is known. The last one closes the body.
+  char boundary[17];
+  static const char digits[] = "0123456789abcdef";
+  boost::uint64_t seed = static_cast<boost::uint64_t>(
+      boost::chrono::steady_clock::now().time_since_epoch().count()) ^
+      reinterpret_cast<std::size_t>(this);
+  seed *= 0x9e3779b97f4a7c15ULL;
+  for (std::size_t i = 0; i < 16; ++i) {
+    boundary[i] = digits[(seed >> (i * 4)) & 0xf];
+  }
+  boundary[16] = 0;
+
+  boost::uint64_t content_length = 0;
+  header_builder part;
+  for (byte_range const& range : ranges_) {
+    part.clear();
+    part.append("\r\n--", 4)
+        .append(boundary)
+        .append("\r\n", 2)
+        .field("Content-Type", content_type)
+        .append("Content-Range: ", 15);
+    append_range(part, range, size);
+    part.append("\r\n\r\n", 4);
+
+    parts_.push_back(part.str().to_string());
+    content_length += part.size() + range.length;
+  }
+  parts_.push_back("\r\n--" + std::string(boundary) + "--\r\n");
+  content_length += parts_.back().size();
+
+  if (!content_encoding.empty()) {
+    header_.field("Content-Encoding", content_encoding);
+  }
+  header_.append("Content-Type: multipart/byteranges; boundary=")
+         .append(boundary)
+         .append("\r\n", 2)
+         .field("Content-Length", content_length)
+         .end();
+}
+
+void http_connection::send_range_not_satisfiable(boost::uint64_t size)
+{
+  make_status_line(416);
+  header_.append("Content-Range: bytes */")
+         .append_uint(size)
+         .append("\r\n", 2)
+         .field("Content-Length", boost::uint64_t(0))
+         .end();
+  send_header_only();
+}
+
+void http_connection::send_cached_ranges(cached_response_ptr const& response)
+{
+  boost::uint64_t size = response->data.size() - response->header_size;
+  make_partial_header(size, response->content_type,
+                      response->content_encoding, response->validators());
+  if (head_request_) {
+    send_header_only();
+    return;
+  }
+  if (!check_header()) {
+    return;
+  }
+
+  std::vector<boost::asio::const_buffer> buffers;
+  append_range_buffers(response->data.data() + response->header_size, buffers);
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers,
+                     [self, response]() { self->handle_response_sent(); });
+}
+
+void http_connection::append_range_buffers(
+    const char* body, std::vector<boost::asio::const_buffer>& buffers)
+{
+  buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+  for (std::size_t i = 0; i < ranges_.size(); ++i) {
+    if (!parts_.empty()) {
+      buffers.push_back(boost::asio::buffer(parts_[i]));
     }
-    iter = std::next(found, delim.size());
+    buffers.push_back(boost::asio::buffer(
+        body + ranges_[i].offset, static_cast<std::size_t>(ranges_[i].length)));
   }
+  if (!parts_.empty()) {
+    buffers.push_back(boost::asio::buffer(parts_.back()));
+  }
+}
 
-  first = iter;
+void http_connection::window_prefix(
+    std::size_t idx, std::vector<boost::asio::const_buffer>& buffers)
+{
+  if (idx == 0) {
+    buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+  }
+  if (!parts_.empty()) {
+    buffers.push_back(boost::asio::buffer(parts_[idx]));
+  }
+}
+
+void http_connection::handle_window_sent(std::size_t idx)
+{
+  if (idx + 1 < ranges_.size()) {
+    send_window(idx + 1);
+    return;
+  }
+
+  file_.reset();
+  if (parts_.empty()) {
+    handle_response_sent();
+    return;
+  }
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(boost::asio::buffer(parts_.back()),
+                     [self]() { self->handle_response_sent(); });
+}
+
+std::string http_connection::make_validators(std::string const& etag,
+                                            std::time_t last_modified,
+                                            bool vary)
+{
+  char date[date_cache::date_size];
+  date_cache::format(last_modified, date);
+
+  header_builder header;
+  header.field("ETag", etag)
+        .field("Last-Modified", boost::string_ref(date, sizeof(date)));
+  if (vary) {
+    header.field("Vary", "Accept-Encoding");
+  }
+  return std::string(header.data(), header.size());
+}
+
+bool http_connection::is_not_modified(boost::string_ref etag,
+                                      std::time_t last_modified) const
+{
+  // If-Modified-Since is ignored when If-None-Match is present (RFC 7232)
+  if (!if_none_match_.empty()) {
+    return etag_matches(if_none_match_, etag);
+  }
+
+  std::time_t since;
+  return !if_modified_since_.empty() &&
+      date_cache::parse(if_modified_since_, since) && last_modified <= since;
+}
+
+void http_connection::send_not_modified(boost::string_ref validators)
+{
+  make_status_line(304);
+  header_.append(validators);
+  header_.end();
+  send_header_only();
+}
+
+boost::shared_ptr<cached_response> http_connection::make_response(
+    std::string const& etag, std::time_t last_modified,
+    boost::uint64_t content_length, boost::string_ref content_type,
+    boost::string_ref content_encoding, bool vary)
+{
+  auto response = boost::make_shared<cached_response>();
+  response->etag = etag;
+  response->last_modified = last_modified;
+  response->content_type.assign(content_type.data(), content_type.size());
+  response->content_encoding.assign(content_encoding.data(),
+                                    content_encoding.size());
+
+  header_builder header;
+  header.append(make_validators(etag, last_modified, vary));
+  response->validators_size = header.size();
+  make_entity_header(header, content_length, content_type, content_encoding);
+  if (header.overflow()) {
+    return boost::shared_ptr<cached_response>();
+  }
+
+  response->data.reserve(header.size() + content_length);
+  response->data.assign(header.data(), header.size());
+  response->header_size = response->data.size();
+  return response;
+}
+
+cached_response_ptr http_connection::load_response(
+    std::string const& path, file_info const& info,
+    boost::string_ref content_type, boost::string_ref content_encoding,
+    bool vary)
+{
+  std::ifstream f(path, std::ios::binary);
+  if (!f.is_open()) {
+    return cached_response_ptr();
+  }
+
+  boost::uint64_t size = info.size;
+  auto response = make_response(make_etag(info), info.mtime, size,
+                                content_type, content_encoding, vary);
+  if (!response) {
+    return cached_response_ptr();
+  }
+  response->data.resize(response->header_size + size);
+  f.read(&response->data[response->header_size],
+         static_cast<std::streamsize>(size));
+  if (static_cast<boost::uint64_t>(f.gcount()) != size) {
+    // The file was changed after its size was taken
+    return cached_response_ptr();
+  }
+
+  return response;
+}
+
+void http_connection::send_cached(cached_response_ptr const& response)
+{
+  // The status line depends on the request, so it is gathered
+  // with the shared part of the response into a single write.
+  make_status_line(200);
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+  buffers.push_back(boost::asio::buffer(response->data.data(),
+      head_request_ ? response->header_size : response->data.size()));
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers,
+                     [self, response]() { self->handle_response_sent(); });
+}
+
+#ifdef ENABLE_SEGMENTED_TRANSFER
+void http_connection::send_window(std::size_t idx)
+{
+  byte_range const& range = ranges_[idx];
+  window_ = idx;
+  file_->clear();
+  file_->seekg(static_cast<std::streamoff>(range.offset));
+  file_remaining_ = range.length;
+
+  // The prefix goes out together with the first chunk, and the second
+  // one is read while they are in flight.
+  if (read_chunk(0)) {
+    std::vector<boost::asio::const_buffer> buffers;
+    window_prefix(idx, buffers);
+    buffers.push_back(boost::asio::buffer(chunks_[0].data(), chunk_sizes_[0]));
+
+    auto self = shared_from_this();
+    conn_->do_write_cb(buffers, [self]() { self->handle_chunk_sent(0); });
+    read_chunk(1);
+  }
+}
+
+bool http_connection::read_chunk(std::size_t idx)
+{
+  std::size_t size = static_cast<std::size_t>(
+      std::min<boost::uint64_t>(chunks_[idx].size(), file_remaining_));
+
+  if (size) {
+    file_->read(chunks_[idx].data(), static_cast<std::streamsize>(size));
+    if (static_cast<std::size_t>(file_->gcount()) != size) {
+      // Content-Length may be already sent, so there is no way to recover
+      BOOST_LOG_SEV(log_, logging::error)
+        << "File is truncated while sending: "
+        << file_remaining_ << " bytes are missing";
+      file_.reset();
+      conn_->close();
+      conn_.reset();
+      return false;
+    }
+  }
+
+  file_remaining_ -= size;
+  chunk_sizes_[idx] = size;
   return true;
 }
 
+void http_connection::send_chunk(std::size_t idx)
+{
+  auto self = shared_from_this();
+  conn_->do_write_cb(boost::asio::buffer(chunks_[idx].data(), chunk_sizes_[idx]),
+                     [self, idx]() { self->handle_chunk_sent(idx); });
+
+  // Fill the second buffer while this one is in flight
+  read_chunk(idx ^ 1);
+}
+
+void http_connection::handle_chunk_sent(std::size_t idx)
+{
+  if (!file_) {
+    return;
+  }
+
+  std::size_t next = idx ^ 1;
+  if (chunk_sizes_[next]) {
+    send_chunk(next);
+  }
+  else {
+    handle_window_sent(window_);
+  }
+}
+#else
+void http_connection::send_window(std::size_t idx)
+{
+  std::vector<boost::asio::const_buffer> buffers;
+  window_prefix(idx, buffers);
+
+  // The prefix is written as usual, then the window goes directly from
+  // the page cache to the socket
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers, [self, idx]() {
+    byte_range const& range = self->ranges_[idx];
+    self->conn_->do_sendfile(self->file_->native_handle(),
+                             range.offset, range.length,
+                             [self, idx]() { self->handle_window_sent(idx); });
+  });
+}
+#endif
+
+void http_connection::send_directory(std::string const& dir,
+                                     std::string const& location)
+{
+  auto listing = boost::make_shared<directory_listing>(dir, location);
+  if (!listing->is_open()) {
+    make_simple_answer(403, "Forbidden");
+    return;
+  }
+
+  begin_stream(200, "text/html; charset=utf-8");
+  if (head_request_) {
+    end_stream();
+    return;
+  }
+  continue_listing(listing);
+}
+
+void http_connection::continue_listing(
+    boost::shared_ptr<directory_listing> const& listing)
+{
+  std::string piece;
+  if (!listing->next(piece)) {
+    end_stream();
+    return;
+  }
+
+  auto self = shared_from_this();
+  write_stream(boost::move(piece),
+               [self, listing]() { self->continue_listing(listing); });
+}
+
+void http_connection::begin_stream(unsigned short code,
+                                   boost::string_ref content_type)
+{
+  // The end of HTTP/1.0 body is the end of the connection
+  stream_chunked_ = http11_;
+  if (!stream_chunked_) {
+    keep_alive_ = false;
+  }
+
+  make_status_line(code);
+  header_.field("Content-Type", content_type);
+  if (stream_chunked_) {
+    header_.field("Transfer-Encoding", "chunked");
+  }
+  header_.end();
+  stream_header_pending_ = true;
+}
+
+namespace {
+
+/// Piece of a streamed body with its chunk size line, it is owned by
+/// the output queue until it is written.
+struct stream_piece
+{
+  std::string data;
+  char size_line[2 * sizeof(std::size_t) + 2];
+};
+
+} // namespace
+
+void http_connection::write_stream(std::string piece,
+                                   boost::function<void()> resume)
+{
+  // An empty chunk would end the body, so nothing is written for it
+  if (piece.empty() && !stream_header_pending_) {
+    conn_->on_writable(resume);
+    return;
+  }
+
+  auto owned = boost::make_shared<stream_piece>();
+  owned->data.swap(piece);
+
+  std::vector<boost::asio::const_buffer> buffers;
+  if (stream_header_pending_) {
+    buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+    stream_header_pending_ = false;
+  }
+
+  std::size_t size = owned->data.size();
+  if (size && stream_chunked_) {
+    static const char digits[] = "0123456789abcdef";
+    char* last = owned->size_line + sizeof(owned->size_line);
+    char* first = last - 2;
+    first[0] = '\r';
+    first[1] = '\n';
+    for (std::size_t n = size; n; n >>= 4) {
+      *--first = digits[n & 0xf];
+    }
+
+    buffers.push_back(boost::asio::buffer(first, last - first));
+    buffers.push_back(boost::asio::buffer(owned->data));
+    buffers.push_back(boost::asio::buffer("\r\n", 2));
+  }
+  else if (size) {
+    buffers.push_back(boost::asio::buffer(owned->data));
+  }
+
+  // The producer goes on while the output is below the high watermark,
+  // so pieces are gathered into larger writes
+  conn_->do_write_cb(buffers, [owned]() {});
+  conn_->on_writable(resume);
+}
+
+void http_connection::end_stream()
+{
+  std::vector<boost::asio::const_buffer> buffers;
+  if (stream_header_pending_) {
+    buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+    stream_header_pending_ = false;
+  }
+  if (stream_chunked_ && !head_request_) {
+    buffers.push_back(boost::asio::buffer("0\r\n\r\n", 5));
+  }
+
+  if (buffers.empty()) {
+    handle_response_sent();
+    return;
+  }
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers, [self]() { self->handle_response_sent(); });
+}
+
+void http_connection::send_metrics()
+{
+  std::ostringstream ss;
+  conn_->get_core().write_metrics(ss);
+  auto body = boost::make_shared<std::string>(ss.str());
+
+  make_header(200, body->size(), "text/plain; version=0.0.4");
+  if (head_request_) {
+    send_header_only();
+    return;
+  }
+  if (!check_header()) {
+    return;
+  }
+
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+  buffers.push_back(boost::asio::buffer(*body));
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers,
+                     [self, body]() { self->handle_response_sent(); });
+}
+
+void http_connection::send_redirect(boost::string_ref location)
+{
+  // A line break would split the response
+  if (location.find_first_of("\r\n") != boost::string_ref::npos) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Redirect location is refused: "
+      << boost::log::dump(location.data(),
+                          std::min<std::size_t>(location.size(), 256));
+    make_simple_answer(500, "Bad redirect");
+    return;
+  }
+
+  make_status_line(301);
+  header_.field("Location", location);
+  make_entity_header(header_, 0);
+  send_header_only();
+}
+
+void http_connection::make_simple_answer(unsigned short code,
+                                         boost::string_ref body)
+{
+  make_header(code, body.size());
+  if (head_request_) {
+    send_header_only();
+    return;
+  }
+  if (!check_header()) {
+    return;
+  }
+
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.push_back(boost::asio::buffer(header_.data(), header_.size()));
+  buffers.push_back(boost::asio::buffer(body.data(), body.size()));
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(buffers, [self]() { self->handle_response_sent(); });
+}
+
+void http_connection::send_header_only()
+{
+  if (!check_header()) {
+    return;
+  }
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(boost::asio::buffer(header_.data(), header_.size()),
+                     [self]() { self->handle_response_sent(); });
+}
+
+bool http_connection::check_header()
+{
+  if (!header_.overflow()) {
+    return true;
+  }
+
+  // The truncated header must not be sent, and the request can not be
+  // answered with the fields it needs
+  BOOST_LOG_SEV(log_, logging::error)
+    << "Response header is too long: "
+    << boost::log::dump(header_.data(), std::min<std::size_t>(header_.size(), 256));
+  keep_alive_ = false;
+  make_header(500, 0);
+
+  auto self = shared_from_this();
+  conn_->do_write_cb(boost::asio::buffer(header_.data(), header_.size()),
+                     [self]() { self->handle_response_sent(); });
+  return false;
+}
+
+void http_connection::make_header(unsigned short code,
+                                  boost::uint64_t content_length,
+                                  boost::string_ref content_type,
+                                  boost::string_ref validators,
+                                  boost::string_ref content_encoding)
+{
+  make_status_line(code);
+  header_.append(validators);
+  make_entity_header(header_, content_length, content_type, content_encoding);
+}
+
+void http_connection::make_status_line(unsigned short code)
+{
+  BOOST_LOG_SEV(log_, logging::trace) << "Answer: " << code;
+
+  status_ = code;
+  if (request_pending_) {
+    conn_->mark_response_start(request_start_);
+  }
+
+  header_.clear();
+  header_.status_line(http11_, code)
+         .field("Date", conn_->get_core().get_date_cache().get())
+         .field("Server", "eiptnd");
+  if (!keep_alive_) {
+    header_.field("Connection", "close");
+  }
+  else if (!http11_) {
+    header_.field("Connection", "keep-alive");
+  }
+}
+
+void http_connection::make_entity_header(header_builder& header,
+                                         boost::uint64_t content_length,
+                                         boost::string_ref content_type,
+                                         boost::string_ref content_encoding)
+{
+  if (!content_encoding.empty()) {
+    header.field("Content-Encoding", content_encoding);
+  }
+  header.field("Content-Length", content_length);
+  if (content_length) {
+    header.field("Content-Type", content_type);
+  }
+  header.end();
+}
+
+void http_connection::handle_response_sent()
+{
+  if (request_pending_) {
+    finish_request();
+  }
+
+  if (!keep_alive_) {
+    // Requests may be pipelined after the last one, so they are drained
+    conn_->linger_close();
+    conn_.reset();
+    return;
+  }
+
+  // Wait for the next request, it may be already pipelined in the buffer
+  handle_start();
+}
+
+void http_connection::begin_request()
+{
+  request_pending_ = true;
+  head_request_ = false;
+  status_ = 0;
+  request_start_ = boost::chrono::steady_clock::now();
+  request_sent_bytes_ = conn_->bytes_sent();
+}
+
+void http_connection::finish_request()
+{
+  request_pending_ = false;
+  bool access_pending = access_pending_;
+  access_pending_ = false;
+
+  io_shard::thread_context* context = shard_->this_thread_context();
+  if (!conn_ || !context) {
+    return;
+  }
+
+  boost::uint64_t latency = static_cast<boost::uint64_t>(
+      boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+        boost::chrono::steady_clock::now() - request_start_).count());
+
+  if (status_ < thread_metrics::max_status) {
+    context->metrics.responses[status_].inc();
+  }
+  context->metrics.response.record(latency);
+
+  if (!access_pending || !context->access_log_buffer) {
+    return;
+  }
+
+  access_record record = access_record();
+  record.timestamp = access_log::now();
+  record.latency = latency;
+  record.bytes_sent = conn_->bytes_sent() - request_sent_bytes_;
+  access_log::set_endpoint(record, conn_->remote_endpoint());
+  record.status = status_;
+  record.method = static_cast<boost::uint8_t>(method_);
+  if (http11_) {
+    record.flags |= access_record::http11_flag;
+  }
+
+  context->access_log_buffer->append(record, target_);
+}
+
+void http_connection::process_request(request_head const& head)
+{
+  BOOST_LOG_SEV(log_, logging::trace) << "MTD: " << head.method;
+  BOOST_LOG_SEV(log_, logging::trace) << "URL: " << head.target;
+  BOOST_LOG_SEV(log_, logging::trace) << "VER: " << head.version;
+
+  bool has_body = false;
+  bool has_close = false;
+  bool has_keep_alive = false;
+  bool is_conditional = head.method == "GET" || head.method == "HEAD";
+
+  for (std::size_t i = 0; i < head.headers_count; ++i) {
+    request_header const& field = head.headers[i];
+    if (boost::iequals(field.name, "Connection")) {
+      has_close = has_close || has_connection_option(field.value, "close");
+      has_keep_alive = has_keep_alive ||
+          has_connection_option(field.value, "keep-alive");
+    }
+    else if (boost::iequals(field.name, "Content-Length")) {
+      has_body = has_body || field.value != "0";
+    }
+    else if (boost::iequals(field.name, "Transfer-Encoding")) {
+      has_body = true;
+    }
+    else if (is_conditional && boost::iequals(field.name, "If-None-Match")) {
+      if_none_match_ = field.value;
+    }
+    else if (is_conditional &&
+             boost::iequals(field.name, "If-Modified-Since")) {
+      if_modified_since_ = field.value;
+    }
+    else if (boost::iequals(field.name, "Accept-Encoding")) {
+      accept_encoding_ = field.value;
+    }
+    else if (head.method == "GET" && boost::iequals(field.name, "Range")) {
+      range_ = field.value;
+    }
+    else if (head.method == "GET" && boost::iequals(field.name, "If-Range")) {
+      if_range_ = field.value;
+    }
+  }
+
+  http11_ = (head.version == "HTTP/1.1");
+  head_request_ = (head.method == "HEAD");
+
+  io_shard::thread_context* context = shard_->this_thread_context();
+  if (context && context->access_log_buffer) {
+    access_pending_ = true;
+    method_ = access_log::method_code(head.method);
+    target_.assign(head.target.data(), head.target.size());
+  }
+
+  bool wants_keep_alive = http11_ ? !has_close : has_keep_alive;
+  ++requests_count_;
+  keep_alive_ = wants_keep_alive && !has_body &&
+      requests_count_ < conn_->get_core().get_keepalive_requests();
+
+  if (has_body) {
+    BOOST_LOG_SEV(log_, logging::trace)
+      << "Request has body";
+    make_simple_answer(400, "I don't understand what you want");
+  }
+  else if (!conn_->get_core().get_metrics_url().empty() &&
+           head.target.substr(0, head.target.find_first_of("?#")) ==
+             conn_->get_core().get_metrics_url()) {
+    send_metrics();
+  }
+  else {
+    send_file(head.target);
+  }
+
+  if_none_match_.clear();
+  if_modified_since_.clear();
+  range_.clear();
+  if_range_.clear();
+  accept_encoding_.clear();
+}
+
 void http_connection::handle_start()
 {
-  conn_->do_read_until(in_buf_, "\r\n\r\n");
+  parser_.reset();
+
+  // A single deadline covers the whole head, however it is split
+  core const& core = conn_->get_core();
+  conn_->start_read_deadline(requests_count_ ? core.get_keepalive_timeout()
+                                             : core.get_header_timeout());
+
+  // The next request may be already pipelined in the buffer
+  if (in_buf_.size()) {
+    parse_buffered();
+  }
+  else {
+    read_request();
+  }
+}
+
+void http_connection::read_request()
+{
+  conn_->do_read_more(in_buf_, 1);
 }
 
 void http_connection::handle_read(std::size_t bytes_transferred)
@@ -200,30 +1360,45 @@ void http_connection::handle_read(std::size_t bytes_transferred)
   BOOST_LOG_SEV(log_, logging::trace)
     << "handle_read(): bytes=" << bytes_transferred;
 
-  auto bufs = in_buf_.data();
-  auto first = boost::asio::buffers_begin(bufs);
-  auto last = boost::asio::buffers_end(bufs);
+  parse_buffered();
+}
 
-  std::vector<char> data(first, last);
-  BOOST_LOG_SEV(log_, logging::flood)
-    << "do_read_until(): " << boost::log::dump(data.data(), data.size());
+void http_connection::parse_buffered()
+{
+  const char* data = boost::asio::buffer_cast<const char*>(in_buf_.data());
+  std::size_t size = in_buf_.size();
 
-#ifdef ENABLE_HTTP_11_SUPPORT
-  if (process_request(first, last)) {
-    in_buf_.consume(std::distance(first, last));
-    handle_start();
-  }
-  else {
-    conn_->close();
-    conn_.reset();
+  request_parser::result_type result = parser_.parse(data, size);
+  if (result == request_parser::indeterminate) {
+    if (size >= max_request_head_size) {
+      begin_request();
+      keep_alive_ = false;
+      make_simple_answer(431, "Too long");
+      return;
+    }
+    read_request();
+    return;
   }
-#else
-  if (!process_request(first, last)) {
-    make_simple_answer(500, "Internal Error", "Whaat?");
+
+  if (result == request_parser::bad) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Parsing request failed: "
+      << boost::log::dump(data, std::min<std::size_t>(size, 256));
+    begin_request();
+    keep_alive_ = false;
+    make_simple_answer(400, "Whaat?");
+    return;
   }
-  conn_->close();
-  conn_.reset();
-#endif
+
+  BOOST_LOG_SEV(log_, logging::flood)
+    << "Request: " << boost::log::dump(data, parser_.consumed());
+
+  // Consuming keeps the data in place until the next read, while
+  // the response could be completed (and the next request started)
+  // before process_request() returns.
+  in_buf_.consume(parser_.consumed());
+  begin_request();
+  process_request(parser_.head());
 }
 
 void http_connection::handle_write()
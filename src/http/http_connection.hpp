@@ -1,15 +1,37 @@
 #ifndef HTTP_CONNECTION_HPP
 #define HTTP_CONNECTION_HPP
 
+#include <iosfwd>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/chrono/system_clocks.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "../connection.hpp"
+#include "byte_ranges.hpp"
+#include "file_cache.hpp"
+#include "file_info.hpp"
+#include "header_builder.hpp"
+#include "mapping_cache.hpp"
+#include "request_parser.hpp"
+
+#ifndef ENABLE_SEGMENTED_TRANSFER
+#include "file_handle.hpp"
+#endif
+
+#if !defined(ENABLE_SENDFILE_TRANSFER) && !defined(ENABLE_SEGMENTED_TRANSFER)
+/// Without sendfile(2) files are streamed through a small buffer ring.
+# define ENABLE_SEGMENTED_TRANSFER
+#endif
 
 
 namespace eiptnd {
 
+class directory_listing;
+
 class http_connection
   : public boost::enable_shared_from_this<http_connection>
   , private boost::noncopyable
@@ -17,27 +39,268 @@ class http_connection
 public:
   http_connection(boost::shared_ptr<connection> connection);
 
+  /// Take a handler from the pool of the calling thread or construct
+  /// a new one. The object returns to the pool when it is released.
+  static boost::shared_ptr<http_connection> create(
+      boost::shared_ptr<connection> connection);
+
   void handle_start();
   void handle_read(std::size_t bytes_transferred);
   void handle_write();
 
-  template <typename Iterator>
-  bool process_request(Iterator & first, Iterator const& last);
+  /// Wait for more data of the current request.
+  void read_request();
+
+  /// Parse received data and process the request if it is complete.
+  void parse_buffered();
+
+  void process_request(request_head const& head);
+
+  /// Respond with a short message. The body is written as a separate
+  /// buffer, so it must outlive the write (e.g. be a string literal).
+  void make_simple_answer(unsigned short code, boost::string_ref body);
+
+  /// Write the rendered header alone and complete the response. Bodies
+  /// are omitted this way for HEAD requests.
+  void send_header_only();
+
+  /// Is the rendered header complete. A header which overflowed its
+  /// buffer is replaced by 500 response closing the connection.
+  bool check_header();
+
+  /// Render the status line and header fields of a response with a body
+  /// of given size into the header buffer. `validators` are pre-rendered
+  /// ETag and Last-Modified fields of the body.
+  void make_header(unsigned short code, boost::uint64_t content_length,
+                   boost::string_ref content_type = "text/html",
+                   boost::string_ref validators = boost::string_ref(),
+                   boost::string_ref content_encoding = boost::string_ref());
+
+  /// Render the status line and general header fields of the current
+  /// response into the header buffer.
+  void make_status_line(unsigned short code);
+
+  /// Header fields describing a body of given size, ending the header.
+  static void make_entity_header(
+      header_builder& header, boost::uint64_t content_length,
+      boost::string_ref content_type = "text/html",
+      boost::string_ref content_encoding = boost::string_ref());
+
+  /// Respond with counters of the server.
+  void send_metrics();
+
+  /// Respond with an index of the directory, `location` is its URL path
+  /// ending with a slash.
+  void send_directory(std::string const& dir, std::string const& location);
+  void continue_listing(boost::shared_ptr<directory_listing> const& listing);
+
+  /// Streaming of a body which length is unknown in advance. HTTP/1.1
+  /// clients get it in the chunked transfer coding, the connection is
+  /// closed after the body for HTTP/1.0 ones. The header is written
+  /// along with the first piece.
+  void begin_stream(unsigned short code, boost::string_ref content_type);
+
+  /// Queue a piece of the body. `resume` is called when the producer
+  /// may go on: at once while the output of the connection is below the
+  /// high watermark, otherwise after it drains, so the output held for
+  /// a slow client is bounded.
+  void write_stream(std::string piece, boost::function<void()> resume);
+
+  /// Write the last chunk and complete the response.
+  void end_stream();
+
+  /// Send a file or a listing of the directory requested by `url`.
+  void send_file(boost::string_ref url);
+
+  /// Respond with 301 pointing to `location`.
+  void send_redirect(boost::string_ref location);
+
+  /// Send a file with given representation, false if it does not exist.
+  bool send_static(std::string const& key, boost::string_ref content_type,
+                   boost::string_ref content_encoding, bool vary);
+
+  /// Send a file compressed by gzip, from the cache of compressed variants
+  /// or by the worker pool. False if the identity should be sent instead.
+  bool send_compressed(std::string const& key, boost::string_ref content_type);
+
+  /// Complete a response which waited for compression. The identity is
+  /// sent when it has failed.
+  void handle_compressed(std::string const& key, boost::string_ref content_type,
+                         cached_response_ptr const& response);
+
+  /// Render ETag and Last-Modified header fields of a file, with Vary
+  /// when its representation depends on Accept-Encoding.
+  static std::string make_validators(std::string const& etag,
+                                     std::time_t last_modified, bool vary);
+
+  /// Do conditional fields of the current request match the file,
+  /// so its body need not be sent.
+  bool is_not_modified(boost::string_ref etag, std::time_t last_modified) const;
+
+  /// Respond with 304 repeating validators of the file.
+  void send_not_modified(boost::string_ref validators);
+
+  /// Render the header of a response for the cache, the body of given
+  /// length should be appended to its data. Null if it is too long.
+  static boost::shared_ptr<cached_response> make_response(
+      std::string const& etag, std::time_t last_modified,
+      boost::uint64_t content_length, boost::string_ref content_type,
+      boost::string_ref content_encoding, bool vary);
+
+  /// Read a whole file and render a response for the cache.
+  cached_response_ptr load_response(std::string const& path,
+                                    file_info const& info,
+                                    boost::string_ref content_type,
+                                    boost::string_ref content_encoding,
+                                    bool vary);
+
+  /// Write pre-rendered response with a single write operation.
+  void send_cached(cached_response_ptr const& response);
+
+  /// Respond from the cache taking conditional and range fields of the
+  /// request into account.
+  void send_cached_file(cached_response_ptr const& response);
 
-  void make_simple_answer(unsigned short code,
-                          std::string const& repl,
-                          std::string const& body);
+  /// Respond with the whole mapped file or its ranges, the buffers point
+  /// into the mapping which is held until they are written.
+  void send_mapped(mapped_file_ptr const& mapped, std::time_t last_modified,
+                   boost::string_ref content_type,
+                   boost::string_ref content_encoding,
+                   boost::string_ref validators);
 
-  void send_file(std::string const& url);
+  /// Take ranges of the current request for a body of given size into
+  /// `ranges_`, unless If-Range shows that the file has been changed.
+  range_result select_ranges(boost::string_ref etag, std::time_t last_modified,
+                             boost::uint64_t size);
+
+  /// Render the header of 206 response for `ranges_`. Several ranges are
+  /// sent as multipart/byteranges, their delimiters are put to `parts_`.
+  void make_partial_header(boost::uint64_t size, boost::string_ref content_type,
+                           boost::string_ref content_encoding,
+                           boost::string_ref validators);
+
+  /// Respond with 416 to ranges which are all beyond the body.
+  void send_range_not_satisfiable(boost::uint64_t size);
+
+  /// Write `ranges_` of a cached body with a single write operation.
+  void send_cached_ranges(cached_response_ptr const& response);
+
+  /// Gather the header and `ranges_` of a body held in memory, with
+  /// delimiters of their parts.
+  void append_range_buffers(const char* body,
+                            std::vector<boost::asio::const_buffer>& buffers);
+
+  /// Send window `idx` of `ranges_` from the opened file, preceded by
+  /// the header or the delimiter of its part.
+  void send_window(std::size_t idx);
+
+  /// Bytes which are written before window `idx`.
+  void window_prefix(std::size_t idx,
+                     std::vector<boost::asio::const_buffer>& buffers);
+
+  /// Continue with the next window or complete the response.
+  void handle_window_sent(std::size_t idx);
+
+  /// Called when the whole response has been written to the socket.
+  void handle_response_sent();
+
+  /// Start measuring the request which head has been received.
+  void begin_request();
+
+  /// Account the response in metrics and the access log of the thread.
+  void finish_request();
+
+#ifdef ENABLE_SEGMENTED_TRANSFER
+  /// Windows are streamed chunk by chunk through the buffer ring.
+  bool read_chunk(std::size_t idx);
+  void send_chunk(std::size_t idx);
+  void handle_chunk_sent(std::size_t idx);
+#endif
 
 private:
+  /// Deleter of pooled handlers.
+  static void recycle(http_connection* p);
+
+  /// Drop the connection and the request state, keeping allocated buffers.
+  void reset();
+
   /// Logger instance and attributes.
   logging::logger log_;
 
   boost::shared_ptr<connection> conn_;
 
+  /// The shard which owns the pool of the handler.
+  io_shard* shard_;
+
+  /// Limit of the request line and header fields size.
+  static const std::size_t max_request_head_size = 64 * 1024;
+
   /// Buffer for incoming data.
   boost::asio::streambuf in_buf_;
+
+  /// Parser of the request which is being received.
+  request_parser parser_;
+
+  /// Header of the response. Only one response is written at a time,
+  /// so it is valid until the write is completed.
+  header_builder header_;
+
+  /// Count of requests received through the connection.
+  std::size_t requests_count_;
+
+  /// Protocol version and persistence of the current request.
+  bool http11_;
+  bool keep_alive_;
+
+  /// The current response has the header of GET one without the body.
+  bool head_request_;
+
+  /// The current request as it is accounted in metrics.
+  bool request_pending_;
+  unsigned short status_;
+  boost::chrono::steady_clock::time_point request_start_;
+  boost::uint64_t request_sent_bytes_;
+
+  /// Conditional and negotiation fields of the current request. They point
+  /// into the input buffer, so they are valid only while it is processed.
+  boost::string_ref if_none_match_;
+  boost::string_ref if_modified_since_;
+  boost::string_ref range_;
+  boost::string_ref if_range_;
+  boost::string_ref accept_encoding_;
+
+  /// More ranges in a request are not worth to send separately.
+  static const std::size_t max_ranges = 16;
+
+  /// State of the streamed response: is the chunked coding applied and
+  /// is the header waiting for the first piece.
+  bool stream_chunked_;
+  bool stream_header_pending_;
+
+  /// Windows of the file which are sent as the current response, and
+  /// delimiters of multipart body (followed by the closing one).
+  std::vector<byte_range> ranges_;
+  std::vector<std::string> parts_;
+
+  /// Fields of the current request for the access log.
+  bool access_pending_;
+  access_method method_;
+  std::string target_;
+
+#ifdef ENABLE_SEGMENTED_TRANSFER
+  /// Ring of two buffers: one is in flight while the other is being read.
+  boost::array<std::vector<char>, 2> chunks_;
+  boost::array<std::size_t, 2> chunk_sizes_;
+
+  /// The file which is currently sent, count of unread bytes of the
+  /// current window and its index.
+  boost::shared_ptr<std::ifstream> file_;
+  boost::uint64_t file_remaining_;
+  std::size_t window_;
+#else
+  /// The file which is currently sent.
+  boost::shared_ptr<file_handle> file_;
+#endif
 };
 
 }
@@ -0,0 +1,176 @@
+#include "mapping_cache.hpp"
+
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/make_shared.hpp>
+#ifdef ENABLE_FILE_MAPPING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace eiptnd {
+
+mapped_file::mapped_file(std::string const& path, file_info const& info)
+  : data_(0)
+  , size_(0)
+{
+#ifdef ENABLE_FILE_MAPPING
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  // The file could be replaced after `info` was taken
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    file_info opened;
+    opened.is_regular = true;
+    opened.size = static_cast<boost::uint64_t>(st.st_size);
+    opened.mtime = st.st_mtime;
+    opened.inode = static_cast<boost::uint64_t>(st.st_ino);
+    etag_ = make_etag(opened);
+
+    if (etag_ == make_etag(info)) {
+      void* p = ::mmap(0, static_cast<std::size_t>(opened.size), PROT_READ,
+                       MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        // Responses are written from the beginning to the end, and
+        // reading ahead is started right away
+        std::size_t length = static_cast<std::size_t>(opened.size);
+        ::madvise(p, length, MADV_SEQUENTIAL);
+        ::madvise(p, length, MADV_WILLNEED);
+        data_ = static_cast<const char*>(p);
+        size_ = opened.size;
+      }
+    }
+  }
+
+  // The mapping keeps the file referenced
+  ::close(fd);
+#else
+  (void)path;
+  (void)info;
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+#ifdef ENABLE_FILE_MAPPING
+  if (data_) {
+    ::munmap(const_cast<char*>(data_), static_cast<std::size_t>(size_));
+  }
+#endif
+}
+
+mapping_cache::mapping_cache(std::size_t capacity, std::size_t max_file_size)
+#ifdef ENABLE_FILE_MAPPING
+  : capacity_(capacity)
+#else
+  : capacity_(0)
+#endif
+  // Single file could not take more than the whole table
+  , max_file_size_(std::min(max_file_size, capacity_))
+  , size_(0)
+{
+}
+
+bool
+mapping_cache::is_mappable(boost::uint64_t file_size) const
+{
+  return enabled() && file_size > 0 && file_size <= max_file_size_;
+}
+
+mapped_file_ptr
+mapping_cache::get(std::string const& path, file_info const& info)
+{
+  std::string const etag = make_etag(info);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    auto found = index_.find(path);
+    if (found != index_.end() && found->second->second->etag() == etag) {
+      lru_.splice(lru_.begin(), lru_, found->second);
+      return found->second->second;
+    }
+  }
+
+  // Mapping is done without the lock, concurrent requests for the same
+  // file may map it twice, the last one stays in the table
+  auto mapped = boost::make_shared<mapped_file>(path, info);
+  if (!mapped->is_open()) {
+    return mapped_file_ptr();
+  }
+
+  std::size_t size = static_cast<std::size_t>(mapped->size());
+  boost::mutex::scoped_lock lock(mutex_);
+
+  auto found = index_.find(path);
+  if (found != index_.end()) {
+    erase_entry(found->second);
+  }
+
+  while (size_ + size > capacity_) {
+    erase_entry(std::prev(lru_.end()));
+  }
+
+  lru_.push_front(entry_t(path, mapped));
+  index_[path] = lru_.begin();
+  size_ += size;
+  return mapped;
+}
+
+void
+mapping_cache::erase_entry(lru_list_t::iterator it)
+{
+  size_ -= static_cast<std::size_t>(it->second->size());
+  index_.erase(it->first);
+  lru_.erase(it);
+}
+
+void
+mapping_cache::erase(std::string const& path)
+{
+  if (!enabled()) {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  auto found = index_.find(path);
+  if (found != index_.end()) {
+    erase_entry(found->second);
+  }
+}
+
+void
+mapping_cache::erase_tree(std::string const& dir)
+{
+  if (!enabled()) {
+    return;
+  }
+
+  std::string path = dir;
+  while (!path.empty() && path[path.size() - 1] == '/') {
+    path.erase(path.size() - 1);
+  }
+  std::string const prefix = path + '/';
+
+  boost::mutex::scoped_lock lock(mutex_);
+  for (auto it = lru_.begin(); it != lru_.end(); ) {
+    auto next = std::next(it);
+    if (it->first == path || boost::starts_with(it->first, prefix)) {
+      erase_entry(it);
+    }
+    it = next;
+  }
+}
+
+std::size_t
+mapping_cache::size() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return size_;
+}
+
+} // namespace eiptnd
@@ -0,0 +1,99 @@
+#ifndef HTTP_MAPPING_CACHE_HPP
+#define HTTP_MAPPING_CACHE_HPP
+
+#include "file_info.hpp"
+
+#if defined(__linux__)
+/// Files are mapped by mmap(2), the cache is disabled elsewhere.
+# define ENABLE_FILE_MAPPING
+#endif
+
+#include <list>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+
+namespace eiptnd {
+
+/// Read-only shared mapping of a whole regular file. Its pages are
+/// only passed to the kernel by writes, never touched in user space,
+/// so a file truncated while it is sent fails the write with EFAULT
+/// instead of raising SIGBUS.
+class mapped_file
+  : private boost::noncopyable
+{
+public:
+  /// Map the file if it is still the one described by `info`.
+  mapped_file(std::string const& path, file_info const& info);
+  ~mapped_file();
+
+  bool is_open() const { return data_ != 0; }
+
+  const char* data() const { return data_; }
+
+  boost::uint64_t size() const { return size_; }
+
+  /// Entity tag of the mapped file, it identifies the content.
+  std::string const& etag() const { return etag_; }
+
+private:
+  const char* data_;
+  boost::uint64_t size_;
+  std::string etag_;
+};
+
+typedef boost::shared_ptr<const mapped_file> mapped_file_ptr;
+
+/// Mappings of medium-sized files shared by all connections, keyed by
+/// the resolved path. Concurrent responses for the same file are written
+/// from the same pages of the page cache without copies to the heap.
+/// Mappings evicted from the table stay valid until their last response
+/// is written.
+class mapping_cache
+  : private boost::noncopyable
+{
+public:
+  /// Zero `capacity` (total mapped bytes) disables the cache.
+  mapping_cache(std::size_t capacity, std::size_t max_file_size);
+
+  bool enabled() const { return capacity_ > 0; }
+
+  /// Is a file of given size served from a mapping.
+  bool is_mappable(boost::uint64_t file_size) const;
+
+  /// Mapping of the file described by `info`. A mapping of the file which
+  /// has been changed since is replaced. Null if it could not be mapped.
+  mapped_file_ptr get(std::string const& path, file_info const& info);
+
+  /// Drop the mapping of the file.
+  void erase(std::string const& path);
+
+  /// Drop mappings of all files under the directory.
+  void erase_tree(std::string const& dir);
+
+  /// Total size of mappings in the table.
+  std::size_t size() const;
+
+private:
+  typedef std::pair<std::string, mapped_file_ptr> entry_t;
+  typedef std::list<entry_t> lru_list_t;
+
+  void erase_entry(lru_list_t::iterator it);
+
+  std::size_t capacity_;
+  std::size_t max_file_size_;
+
+  mutable boost::mutex mutex_;
+  /// Most recently used mappings are at the front.
+  lru_list_t lru_;
+  boost::unordered_map<std::string, lru_list_t::iterator> index_;
+  std::size_t size_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_MAPPING_CACHE_HPP
@@ -0,0 +1,191 @@
+#include "mime_types.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/algorithm/string/case_conv.hpp>
+
+
+namespace eiptnd {
+
+namespace {
+
+struct mime_entry
+{
+  const char* extension;
+  const char* type;
+};
+
+/// Sorted by extension, it is checked below.
+constexpr mime_entry builtin_types[] = {
+  { "7z",          "application/x-7z-compressed" },
+  { "avif",        "image/avif" },
+  { "bin",         "application/octet-stream" },
+  { "bmp",         "image/bmp" },
+  { "css",         "text/css" },
+  { "csv",         "text/csv" },
+  { "eot",         "application/vnd.ms-fontobject" },
+  { "gif",         "image/gif" },
+  { "gz",          "application/gzip" },
+  { "htm",         "text/html" },
+  { "html",        "text/html" },
+  { "ico",         "image/x-icon" },
+  { "jpeg",        "image/jpeg" },
+  { "jpg",         "image/jpeg" },
+  { "js",          "text/javascript" },
+  { "json",        "application/json" },
+  { "map",         "application/json" },
+  { "md",          "text/markdown" },
+  { "mjs",         "text/javascript" },
+  { "mp3",         "audio/mpeg" },
+  { "mp4",         "video/mp4" },
+  { "oga",         "audio/ogg" },
+  { "ogg",         "audio/ogg" },
+  { "otf",         "font/otf" },
+  { "pdf",         "application/pdf" },
+  { "png",         "image/png" },
+  { "svg",         "image/svg+xml" },
+  { "tar",         "application/x-tar" },
+  { "ttf",         "font/ttf" },
+  { "txt",         "text/plain" },
+  { "wasm",        "application/wasm" },
+  { "wav",         "audio/wav" },
+  { "webm",        "video/webm" },
+  { "webmanifest", "application/manifest+json" },
+  { "webp",        "image/webp" },
+  { "woff",        "font/woff" },
+  { "woff2",       "font/woff2" },
+  { "xml",         "application/xml" },
+  { "zip",         "application/zip" }
+};
+
+const std::size_t builtin_types_count =
+    sizeof(builtin_types) / sizeof(builtin_types[0]);
+
+constexpr bool str_less(const char* a, const char* b)
+{
+  return *a != *b ? static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b)
+                  : (*a != 0 && str_less(a + 1, b + 1));
+}
+
+constexpr bool is_sorted_from(std::size_t i)
+{
+  return i + 1 >= sizeof(builtin_types) / sizeof(builtin_types[0]) ||
+      (str_less(builtin_types[i].extension, builtin_types[i + 1].extension) &&
+       is_sorted_from(i + 1));
+}
+
+static_assert(is_sorted_from(0), "builtin_types must be sorted by extension");
+
+/// Longer extensions are not known.
+const std::size_t max_extension_size = 16;
+
+/// Lower case extension of a file name, empty if there is none.
+boost::string_ref lower_extension(boost::string_ref file_name, char* buf)
+{
+  std::size_t dot = file_name.rfind('.');
+  std::size_t slash = file_name.rfind('/');
+  if (dot == boost::string_ref::npos ||
+      (slash != boost::string_ref::npos && dot < slash)) {
+    return boost::string_ref();
+  }
+
+  boost::string_ref extension = file_name.substr(dot + 1);
+  if (extension.size() > max_extension_size) {
+    return boost::string_ref();
+  }
+
+  for (std::size_t i = 0; i < extension.size(); ++i) {
+    char c = extension[i];
+    buf[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+  return boost::string_ref(buf, extension.size());
+}
+
+} // namespace
+
+boost::string_ref builtin_mime_type(boost::string_ref extension)
+{
+  const mime_entry* last = builtin_types + builtin_types_count;
+  const mime_entry* it = std::lower_bound(builtin_types, last, extension,
+      [](mime_entry const& entry, boost::string_ref ext) {
+        return boost::string_ref(entry.extension) < ext;
+      });
+  if (it != last && extension == it->extension) {
+    return it->type;
+  }
+  return boost::string_ref();
+}
+
+void
+mime_types::load(std::string const& file_name)
+{
+  std::ifstream f(file_name.c_str());
+  if (!f.is_open()) {
+    throw std::runtime_error("Unable to open " + file_name);
+  }
+
+  std::vector<std::pair<std::string, std::string> > entries;
+  std::string line;
+  while (std::getline(f, line)) {
+    line = line.substr(0, line.find('#'));
+    std::replace(line.begin(), line.end(), ';', ' ');
+
+    std::istringstream words(line);
+    std::string type, extension;
+    if (!(words >> type) || type == "types" || type == "{" || type == "}") {
+      continue;
+    }
+    if (type.size() > max_type_size) {
+      throw std::runtime_error("Content type is too long in " + file_name +
+                               ": " + type.substr(0, 64) + "...");
+    }
+    while (words >> extension) {
+      boost::algorithm::to_lower(extension);
+      entries.push_back(std::make_pair(extension, type));
+    }
+  }
+
+  // The last definition of an extension wins
+  std::stable_sort(entries.begin(), entries.end(),
+      [](std::pair<std::string, std::string> const& a,
+         std::pair<std::string, std::string> const& b) {
+        return a.first < b.first;
+      });
+  overrides_.clear();
+  for (std::pair<std::string, std::string> const& entry : entries) {
+    if (!overrides_.empty() && overrides_.back().first == entry.first) {
+      overrides_.back().second = entry.second;
+    }
+    else {
+      overrides_.push_back(entry);
+    }
+  }
+}
+
+boost::string_ref
+mime_types::find(boost::string_ref file_name) const
+{
+  char buf[max_extension_size];
+  boost::string_ref extension = lower_extension(file_name, buf);
+  if (extension.empty()) {
+    return default_type();
+  }
+
+  if (!overrides_.empty()) {
+    auto it = std::lower_bound(overrides_.begin(), overrides_.end(), extension,
+        [](std::pair<std::string, std::string> const& entry,
+           boost::string_ref ext) {
+          return boost::string_ref(entry.first) < ext;
+        });
+    if (it != overrides_.end() && extension == it->first) {
+      return it->second;
+    }
+  }
+
+  boost::string_ref type = builtin_mime_type(extension);
+  return type.empty() ? default_type() : type;
+}
+
+} // namespace eiptnd
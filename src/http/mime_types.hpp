@@ -0,0 +1,49 @@
+#ifndef HTTP_MIME_TYPES_HPP
+#define HTTP_MIME_TYPES_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Content type of a built-in extension (lower case, without the dot),
+/// empty if it is unknown. The table is sorted at compile time, so a
+/// lookup is a binary search over literals.
+boost::string_ref builtin_mime_type(boost::string_ref extension);
+
+/// Content types by file name extensions. Types loaded from a file
+/// override built-in ones. It is not changed after loading, so it is
+/// shared by all threads without locks.
+class mime_types
+{
+public:
+  /// Type of files which extension is unknown.
+  static boost::string_ref default_type()
+  { return "application/octet-stream"; }
+
+  /// Longer types would not fit the header of a response.
+  static const std::size_t max_type_size = 256;
+
+  /// Load extensions from a file in mime.types format: a type followed
+  /// by its extensions on every line, `#` starts a comment. The nginx
+  /// `types { ... }` syntax is accepted as well. It throws on types
+  /// longer than `max_type_size`.
+  void load(std::string const& file_name);
+
+  /// Content type of a file by its name.
+  boost::string_ref find(boost::string_ref file_name) const;
+
+  /// Count of loaded extensions.
+  std::size_t size() const { return overrides_.size(); }
+
+private:
+  /// Sorted by extension, they are matched in lower case.
+  std::vector<std::pair<std::string, std::string> > overrides_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_MIME_TYPES_HPP
@@ -0,0 +1,303 @@
+#include "request_parser.hpp"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Find the first byte equal to `a` or `b`. Delimiters of the request
+/// head are rare, so the input is scanned by vector blocks, and only
+/// the tail shorter than a block is checked byte by byte.
+const char* find_either(const char* first, const char* last, char a, char b)
+{
+#if defined(__AVX2__)
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  for (; last - first >= 32; first += 32) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, va),
+                        _mm256_cmpeq_epi8(block, vb))));
+    if (mask) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  for (; last - first >= 16; first += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(block, va),
+                     _mm_cmpeq_epi8(block, vb))));
+    if (mask) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; first != last; ++first) {
+    if (*first == a || *first == b) {
+      break;
+    }
+  }
+  return first;
+}
+
+/// Find the first byte equal to `a`, a control byte, a space or DEL.
+/// Tokens of the request line and header names end at such a byte, so
+/// they are checked for control bytes by the same scan.
+const char* find_delimiter(const char* first, const char* last, char a)
+{
+#if defined(__AVX2__)
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vspace = _mm256_set1_epi8(' ');
+  const __m256i vdel = _mm256_set1_epi8(0x7f);
+  const __m256i vnegative = _mm256_set1_epi8(-1);
+  for (; last - first >= 32; first += 32) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+    // Bytes above 0x7f are negative and not control ones
+    __m256i control = _mm256_andnot_si256(
+        _mm256_cmpgt_epi8(block, vspace), _mm256_cmpgt_epi8(block, vnegative));
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, va), control),
+                        _mm256_cmpeq_epi8(block, vdel))));
+    if (mask) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vspace = _mm_set1_epi8(' ');
+  const __m128i vdel = _mm_set1_epi8(0x7f);
+  const __m128i vnegative = _mm_set1_epi8(-1);
+  for (; last - first >= 16; first += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+    // Bytes above 0x7f are negative and not control ones
+    __m128i control = _mm_andnot_si128(
+        _mm_cmpgt_epi8(block, vspace), _mm_cmpgt_epi8(block, vnegative));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, va), control),
+                     _mm_cmpeq_epi8(block, vdel))));
+    if (mask) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; first != last; ++first) {
+    unsigned char c = static_cast<unsigned char>(*first);
+    if (*first == a || c <= ' ' || c == 0x7f) {
+      break;
+    }
+  }
+  return first;
+}
+
+/// Bytes of tokens of RFC 7230, methods are made of them.
+struct token_table
+{
+  token_table()
+  {
+    std::memset(allowed, 0, sizeof(allowed));
+    for (unsigned c = '0'; c <= '9'; ++c) {
+      allowed[c] = true;
+    }
+    for (unsigned c = 'a'; c <= 'z'; ++c) {
+      allowed[c] = allowed[c - 'a' + 'A'] = true;
+    }
+    for (const char* c = "!#$%&'*+-.^_`|~"; *c; ++c) {
+      allowed[static_cast<unsigned char>(*c)] = true;
+    }
+  }
+
+  bool allowed[256];
+};
+
+const token_table token_chars;
+
+bool is_token(const char* first, const char* last)
+{
+  for (; first != last; ++first) {
+    if (!token_chars.allowed[static_cast<unsigned char>(*first)]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+request_parser::request_parser()
+{
+  reset();
+}
+
+void
+request_parser::reset()
+{
+  state_ = method_state;
+  pos_ = 0;
+  token_first_ = 0;
+  headers_count_ = 0;
+  head_.headers_count = 0;
+}
+
+request_parser::result_type
+request_parser::parse(const char* data, std::size_t size)
+{
+  const char* const last = data + size;
+
+  while (pos_ < size) {
+    const char* p = data + pos_;
+
+    switch (state_) {
+    case method_state:
+    case target_state: {
+      // Control bytes end the token as well, and they are refused:
+      // the target is copied into header lines of redirects
+      const char* found = find_delimiter(p, last, ' ');
+      pos_ = found - data;
+      if (found == last) {
+        return indeterminate;
+      }
+      if (*found != ' ' || pos_ == token_first_) {
+        return bad;
+      }
+      if (state_ == method_state && !is_token(data + token_first_, found)) {
+        return bad;
+      }
+
+      span& s = (state_ == method_state) ? method_ : target_;
+      s.first = token_first_;
+      s.last = pos_;
+      token_first_ = ++pos_;
+      state_ = (state_ == method_state) ? target_state : version_state;
+      break;
+    }
+
+    case version_state: {
+      const char* found = find_either(p, last, '\r', '\n');
+      pos_ = found - data;
+      if (found == last) {
+        return indeterminate;
+      }
+      if (*found != '\r') {
+        return bad;
+      }
+
+      version_.first = token_first_;
+      version_.last = pos_;
+      boost::string_ref version = make_ref(data, version_);
+      if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+        return bad;
+      }
+      ++pos_;
+      state_ = request_line_lf_state;
+      break;
+    }
+
+    case request_line_lf_state:
+    case header_line_lf_state:
+      if (*p != '\n') {
+        return bad;
+      }
+      ++pos_;
+      state_ = header_start_state;
+      break;
+
+    case header_start_state:
+      if (*p == '\r') {
+        ++pos_;
+        state_ = final_lf_state;
+        break;
+      }
+      if (headers_count_ == request_head::max_headers) {
+        return bad;
+      }
+      token_first_ = pos_;
+      state_ = header_name_state;
+      break;
+
+    case header_name_state: {
+      const char* found = find_delimiter(p, last, ':');
+      pos_ = found - data;
+      if (found == last) {
+        return indeterminate;
+      }
+      if (*found != ':' || pos_ == token_first_) {
+        return bad;
+      }
+
+      names_[headers_count_].first = token_first_;
+      names_[headers_count_].last = pos_;
+      token_first_ = ++pos_;
+      state_ = header_value_state;
+      break;
+    }
+
+    case header_value_state: {
+      const char* found = find_either(p, last, '\r', '\n');
+      pos_ = found - data;
+      if (found == last) {
+        return indeterminate;
+      }
+      if (*found != '\r') {
+        return bad;
+      }
+
+      // Optional whitespace around the value is not a part of it
+      span& value = values_[headers_count_++];
+      value.first = token_first_;
+      value.last = pos_;
+      while (value.first < value.last && is_ows(data[value.first])) {
+        ++value.first;
+      }
+      while (value.last > value.first && is_ows(data[value.last - 1])) {
+        --value.last;
+      }
+      ++pos_;
+      state_ = header_line_lf_state;
+      break;
+    }
+
+    case final_lf_state:
+      if (*p != '\n') {
+        return bad;
+      }
+      ++pos_;
+      state_ = done_state;
+      fill_head(data);
+      return good;
+
+    case done_state:
+      return good;
+    }
+  }
+
+  return state_ == done_state ? good : indeterminate;
+}
+
+void
+request_parser::fill_head(const char* data)
+{
+  head_.method = make_ref(data, method_);
+  head_.target = make_ref(data, target_);
+  head_.version = make_ref(data, version_);
+
+  for (std::size_t i = 0; i < headers_count_; ++i) {
+    head_.headers[i].name = make_ref(data, names_[i]);
+    head_.headers[i].value = make_ref(data, values_[i]);
+  }
+  head_.headers_count = headers_count_;
+}
+
+} // namespace eiptnd
@@ -0,0 +1,114 @@
+#ifndef HTTP_REQUEST_PARSER_HPP
+#define HTTP_REQUEST_PARSER_HPP
+
+#include <cstddef>
+#include <boost/array.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace eiptnd {
+
+/// Optional whitespace of RFC 7230.
+inline bool is_ows(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+/// Strip optional whitespace around an element of a field value.
+inline boost::string_ref trim_ows(boost::string_ref s)
+{
+  while (!s.empty() && is_ows(s.front())) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() && is_ows(s.back())) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+/// Header field of a parsed request.
+struct request_header
+{
+  boost::string_ref name;
+  boost::string_ref value;
+};
+
+/// Request line and header fields which refer to the parsed buffer.
+/// They are valid while the buffer content is not changed.
+struct request_head
+{
+  enum { max_headers = 64 };
+
+  boost::string_ref method;
+  boost::string_ref target;
+  boost::string_ref version;
+
+  boost::array<request_header, max_headers> headers;
+  std::size_t headers_count;
+};
+
+/// Incremental parser of the request line and header fields. It is fed
+/// with the whole received data every time, continues from the position
+/// where the previous call stopped and allocates nothing. The buffer may
+/// be moved between calls (e.g. when it grows), but its parsed prefix
+/// must stay the same.
+class request_parser
+{
+public:
+  enum result_type { good, bad, indeterminate };
+
+  request_parser();
+
+  /// Prepare to parse the next request.
+  void reset();
+
+  /// Parse available data. The request head is ready on `good`.
+  result_type parse(const char* data, std::size_t size);
+
+  /// Size of the request head including the final empty line.
+  std::size_t consumed() const { return pos_; }
+
+  request_head const& head() const { return head_; }
+
+private:
+  enum state
+  {
+    method_state,
+    target_state,
+    version_state,
+    request_line_lf_state,
+    header_start_state,
+    header_name_state,
+    header_value_state,
+    header_line_lf_state,
+    final_lf_state,
+    done_state
+  };
+
+  /// Bounds of a token relative to the beginning of the buffer.
+  struct span
+  {
+    std::size_t first;
+    std::size_t last;
+  };
+
+  static boost::string_ref make_ref(const char* data, span const& s)
+  { return boost::string_ref(data + s.first, s.last - s.first); }
+
+  /// Convert spans to references into the buffer.
+  void fill_head(const char* data);
+
+  state state_;
+  std::size_t pos_;
+  std::size_t token_first_;
+
+  span method_, target_, version_;
+  boost::array<span, request_head::max_headers> names_, values_;
+  std::size_t headers_count_;
+
+  request_head head_;
+};
+
+} // namespace eiptnd
+
+#endif // HTTP_REQUEST_PARSER_HPP
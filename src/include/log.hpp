@@ -2,6 +2,7 @@
 #define LOG_HPP
 
 #include <boost/algorithm/string.hpp>
+#include <boost/atomic.hpp>
 #include <boost/log/core.hpp>
 #include <boost/log/sources/severity_channel_logger.hpp>
 #include <boost/log/sources/channel_logger.hpp>
@@ -62,13 +63,42 @@ inline std::basic_istream<CharT, TraitsT>& operator>> (
   for (std::size_t i = 0; level_strings[i]; ++i) {
     if (level_strings[i] == value) {
       level = static_cast<severity_level>(i);
-      break;
+      return is;
     }
   }
 
+  is.setstate(std::ios_base::failbit);
   return is;
 }
 
+#ifndef LOG_MIN_SEVERITY
+# define LOG_MIN_SEVERITY flood
+#endif
+
+/// Records less severe than this level are not compiled in.
+static const severity_level min_severity = LOG_MIN_SEVERITY;
+
+/// Records less severe than this level are dropped at runtime.
+inline boost::atomic<int>& severity_threshold()
+{
+  static boost::atomic<int> threshold(flood);
+  return threshold;
+}
+
+inline void set_severity_threshold(severity_level level)
+{
+  severity_threshold().store(level, boost::memory_order_relaxed);
+}
+
+/// Checked before a record is opened, so arguments of filtered out
+/// records are not evaluated. For constant levels below `min_severity`
+/// the whole statement is eliminated by the compiler.
+inline bool is_enabled(severity_level level)
+{
+  return level >= min_severity &&
+      level >= severity_threshold().load(boost::memory_order_relaxed);
+}
+
 typedef boost::log::sources::severity_channel_logger_mt<severity_level> logger_mt;
 typedef boost::log::sources::severity_channel_logger<severity_level> logger_st;
 typedef logger_mt logger;
@@ -76,4 +106,15 @@ typedef logger_mt logger;
 } // namespace logging
 } // namespace eiptnd
 
+#undef BOOST_LOG_SEV
+#undef BOOST_LOG_CHANNEL_SEV
+
+#define BOOST_LOG_SEV(logger, lvl)\
+    if (!::eiptnd::logging::is_enabled(lvl)) {} else\
+        BOOST_LOG_STREAM_SEV(logger, lvl)
+
+#define BOOST_LOG_CHANNEL_SEV(logger, chan, lvl)\
+    if (!::eiptnd::logging::is_enabled(lvl)) {} else\
+        BOOST_LOG_STREAM_CHANNEL_SEV(logger, chan, lvl)
+
 #endif // LOG_HPP
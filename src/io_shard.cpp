@@ -0,0 +1,186 @@
+#include "io_shard.hpp"
+
+#include "connection.hpp"
+#include "http/http_connection.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Context of the shard's thread which is run by the current thread.
+thread_local io_shard::thread_context* current_context = 0;
+
+} // namespace
+
+io_shard::thread_context::thread_context(io_shard* owner, std::size_t pool_size,
+                                         access_log* requests_log)
+  : owner(owner)
+  , connections(pool_size)
+  , http_connections(pool_size)
+  , access_log_buffer(requests_log ? new access_log::buffer(*requests_log) : 0)
+{
+}
+
+io_shard::io_shard(std::size_t threads_count, std::size_t pool_size,
+                   boost::shared_ptr<access_log> const& requests_log)
+  : threads_count_(threads_count)
+  , access_log_(requests_log)
+  , io_service_(boost::make_shared<boost::asio::io_service>(threads_count))
+  , next_timer_wheel_(0)
+  , flush_timer_(*io_service_)
+  , is_flushing_(access_log_ != 0)
+  , next_context_(0)
+{
+  for (std::size_t i = 0; i < threads_count_; ++i) {
+    timer_wheels_.push_back(boost::make_shared<timer_wheel>(
+        boost::ref(*io_service_), boost::posix_time::milliseconds(100)));
+    timer_wheels_.back()->start();
+
+    contexts_.push_back(boost::make_shared<thread_context>(
+        this, pool_size, access_log_.get()));
+  }
+
+  if (is_flushing_) {
+    start_flush_timer();
+  }
+}
+
+io_shard::~io_shard()
+{
+}
+
+io_shard::thread_context*
+io_shard::this_thread_context() const
+{
+  return (current_context && current_context->owner == this) ? current_context : 0;
+}
+
+pool_stats
+io_shard::connections_pool_stats() const
+{
+  pool_stats stats;
+  for (boost::shared_ptr<thread_context> const& context : contexts_) {
+    stats += context->connections.stats();
+  }
+  return stats;
+}
+
+pool_stats
+io_shard::http_connections_pool_stats() const
+{
+  pool_stats stats;
+  for (boost::shared_ptr<thread_context> const& context : contexts_) {
+    stats += context->http_connections.stats();
+  }
+  return stats;
+}
+
+void
+io_shard::collect_metrics(metrics_snapshot& snapshot) const
+{
+  for (boost::shared_ptr<thread_context> const& context : contexts_) {
+    snapshot += context->metrics;
+  }
+}
+
+void
+io_shard::flush_access_log()
+{
+  for (boost::shared_ptr<thread_context> const& context : contexts_) {
+    if (context->access_log_buffer) {
+      context->access_log_buffer->flush();
+    }
+  }
+}
+
+void
+io_shard::run(int cpu)
+{
+#if defined(__linux__)
+  if (cpu >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(cpuset), &cpuset);
+  }
+#else
+  (void)cpu;
+#endif
+
+  std::size_t idx = next_context_++ % contexts_.size();
+  current_context = contexts_[idx].get();
+
+  io_service_->run();
+
+  current_context = 0;
+}
+
+#ifdef ENABLE_IO_URING
+void
+io_shard::start_uring(std::size_t buffer_size)
+{
+  uring_.reset(new uring_engine(*io_service_, buffer_size));
+  uring_->start();
+}
+#endif
+
+void
+io_shard::start_flush_timer()
+{
+  flush_timer_.expires_from_now(boost::posix_time::seconds(1));
+  flush_timer_.async_wait(
+      boost::bind(&io_shard::handle_flush_timer, this, _1));
+}
+
+void
+io_shard::handle_flush_timer(const boost::system::error_code& ec)
+{
+  if (ec) {
+    return;
+  }
+
+  flush_access_log();
+
+  boost::mutex::scoped_lock lock(flush_mutex_);
+  if (is_flushing_) {
+    start_flush_timer();
+  }
+}
+
+void
+io_shard::stop_timers()
+{
+  {
+    boost::mutex::scoped_lock lock(flush_mutex_);
+    is_flushing_ = false;
+    boost::system::error_code ignored_ec;
+    flush_timer_.cancel(ignored_ec);
+  }
+
+  for (boost::shared_ptr<timer_wheel> const& wheel : timer_wheels_) {
+    wheel->stop();
+  }
+
+#ifdef ENABLE_IO_URING
+  if (uring_) {
+    uring_->stop();
+  }
+#endif
+}
+
+void
+io_shard::stop()
+{
+  io_service_->stop();
+}
+
+} // namespace eiptnd
@@ -0,0 +1,144 @@
+#ifndef IO_SHARD_HPP
+#define IO_SHARD_HPP
+
+#include "access_log.hpp"
+#include "metrics.hpp"
+#include "object_pool.hpp"
+#include "timer_wheel.hpp"
+#include "uring_engine.hpp"
+
+#include <vector>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+namespace eiptnd {
+
+class connection;
+class http_connection;
+
+/// Proactor with its threads and per thread resources. Connections
+/// accepted by a listener of the shard are served by it entirely.
+class io_shard
+  : private boost::noncopyable
+{
+public:
+  /// Resources owned by a single thread of the shard.
+  struct thread_context
+  {
+    thread_context(io_shard* owner, std::size_t pool_size,
+                   access_log* requests_log);
+
+    io_shard* owner;
+
+    /// Finished connections ready to be reused.
+    object_pool<connection> connections;
+    object_pool<http_connection> http_connections;
+
+    /// Served requests, null if the access log is disabled.
+    boost::scoped_ptr<access_log::buffer> access_log_buffer;
+
+    thread_metrics metrics;
+  };
+
+  /// Requests are written to `requests_log` unless it is null.
+  io_shard(std::size_t threads_count, std::size_t pool_size,
+           boost::shared_ptr<access_log> const& requests_log);
+  ~io_shard();
+
+  boost::shared_ptr<boost::asio::io_service> const& get_ios() const
+  { return io_service_; }
+
+  std::size_t threads_count() const
+  { return threads_count_; }
+
+  /// Handlers of a connection need a strand only when several
+  /// threads run the shard's io_service.
+  bool is_multithreaded() const
+  { return threads_count_ > 1; }
+
+  /// Timer wheels are distributed over connections in round-robin.
+  boost::shared_ptr<timer_wheel> const& get_timer_wheel() const
+  { return timer_wheels_[next_timer_wheel_++ % timer_wheels_.size()]; }
+
+  /// Context of the calling thread if it runs this shard, null otherwise.
+  thread_context* this_thread_context() const;
+
+  /// Sum of statistics of all threads' pools.
+  pool_stats connections_pool_stats() const;
+  pool_stats http_connections_pool_stats() const;
+
+  /// Add counters of all threads to the snapshot.
+  void collect_metrics(metrics_snapshot& snapshot) const;
+
+  /// Counters of the calling thread if it runs this shard, null otherwise.
+  thread_metrics* this_thread_metrics() const
+  {
+    thread_context* context = this_thread_context();
+    return context ? &context->metrics : 0;
+  }
+
+  /// Write requests collected by threads. It is called once a second
+  /// while the shard runs, and at the end to write the rest.
+  void flush_access_log();
+
+  /// Run io_service in the calling thread. The thread is bound to
+  /// the CPU if `cpu` is not negative.
+  void run(int cpu);
+
+#ifdef ENABLE_IO_URING
+  /// Serve sockets through io_uring, file bodies are sent with buffers
+  /// of `buffer_size` bytes. It throws system_error if the kernel does
+  /// not support it.
+  void start_uring(std::size_t buffer_size);
+
+  /// Engine serving sockets, null if the reactor and sendfile(2) are used.
+  uring_engine* get_uring() const
+  { return uring_.get(); }
+#endif
+
+  /// Stop timers and waiting for io_uring completions, so io_service
+  /// could run out of work.
+  void stop_timers();
+
+  /// Abort all the handlers immediately.
+  void stop();
+
+private:
+  void start_flush_timer();
+  void handle_flush_timer(const boost::system::error_code& ec);
+
+  std::size_t threads_count_;
+
+  boost::shared_ptr<access_log> access_log_;
+
+  boost::shared_ptr<boost::asio::io_service> io_service_;
+
+#ifdef ENABLE_IO_URING
+  /// It is destroyed before the io_service it waits on.
+  boost::scoped_ptr<uring_engine> uring_;
+#endif
+
+  /// Timeouts of connections, one wheel per thread.
+  std::vector<boost::shared_ptr<timer_wheel> > timer_wheels_;
+  mutable boost::atomic<std::size_t> next_timer_wheel_;
+
+  /// Flushes the access log, so records of idle threads are not kept
+  /// in memory. The mutex orders rescheduling with stop_timers().
+  boost::asio::deadline_timer flush_timer_;
+  boost::mutex flush_mutex_;
+  bool is_flushing_;
+
+  /// Contexts of threads, they are taken by threads at run().
+  std::vector<boost::shared_ptr<thread_context> > contexts_;
+  boost::atomic<std::size_t> next_context_;
+};
+
+} // namespace eiptnd
+
+#endif // IO_SHARD_HPP
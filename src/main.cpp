@@ -21,6 +21,22 @@ int main(int argc, char* argv[])
   general.add_options()
     ("help", "show this help message")
     ("foreground,F", "run in foreground mode")
+    ("log-level", po::value<eiptnd::logging::severity_level>()
+       ->default_value(eiptnd::logging::flood)->value_name("level"),
+       "least severe level of logged records (flood, trace, debug, info, "
+       "normal, notify, warning, error, critical)")
+    ("no-console", "do not write log records to the console")
+    ("log-async", "write log records from a dedicated thread")
+    ("log-queue-size", po::value<std::size_t>()->default_value(64 * 1024)
+       ->value_name("N"), "capacity of the asynchronous log queue")
+    ("log-overflow", po::value<std::string>()->default_value("block")
+       ->value_name("policy")->notifier([](std::string const& policy) {
+         if (policy != "block" && policy != "drop") {
+           throw po::validation_error(
+               po::validation_error::invalid_option_value,
+               "log-overflow", policy);
+         }
+       }), "what to do when the log queue is full (block, drop)")
   ;
 
   std::size_t num_threads = std::max(1u, boost::thread::hardware_concurrency());
@@ -36,6 +52,83 @@ int main(int argc, char* argv[])
                 ->value_name("directory"), "web root directory")
     ("num-threads", po::value<std::size_t>()->default_value(num_threads)
        ->value_name("N"), "number of connection handler threads count")
+    ("shard-per-core", "run own io_service and listeners in every thread")
+    ("accept-depth", po::value<std::size_t>()->default_value(num_threads)
+       ->value_name("N"), "pending accept operations per listener")
+    ("pin-threads", "bind every connection handler thread to a CPU")
+    ("pool-size", po::value<std::size_t>()->default_value(1024)
+       ->value_name("N"), "finished connections kept for reuse per thread")
+    ("keepalive-requests", po::value<std::size_t>()->default_value(1000)
+       ->value_name("N"), "requests limit per persistent connection")
+    ("header-timeout", po::value<long>()->default_value(30)
+       ->value_name("sec"), "time limit of receiving the first request")
+    ("keepalive-timeout", po::value<long>()->default_value(15)
+       ->value_name("sec"), "idle time limit of a persistent connection")
+    ("write-timeout", po::value<long>()->default_value(60)
+       ->value_name("sec"), "time limit of a stalled response writing")
+    ("linger-timeout", po::value<long>()->default_value(5)
+       ->value_name("sec"), "time limit of discarding unread requests "
+       "before closing a connection")
+    ("write-high-watermark", po::value<std::size_t>()
+       ->default_value(256 * 1024)->value_name("bytes"),
+       "output queued for a client above which it is not read from and "
+       "streamed responses are paused")
+    ("write-low-watermark", po::value<std::size_t>()
+       ->default_value(64 * 1024)->value_name("bytes"),
+       "output queued for a client below which it is resumed")
+    ("io-engine", po::value<std::string>()->default_value("asio")
+       ->value_name("engine")->notifier([](std::string const& engine) {
+         if (engine != "asio" && engine != "uring") {
+           throw po::validation_error(
+               po::validation_error::invalid_option_value,
+               "io-engine", engine);
+         }
+       }), "how connections are accepted and read and file bodies are "
+       "sent: asio (epoll and sendfile) or uring (io_uring multishot accept "
+       "and receive, linked file reads and sends; asio is used if the "
+       "kernel lacks it)")
+    ("chunk-size", po::value<std::size_t>()->default_value(64 * 1024)
+       ->value_name("bytes"), "buffer size for segmented file transfer "
+       "and io_uring requests")
+    ("cache-size", po::value<std::size_t>()->default_value(64 * 1024 * 1024)
+       ->value_name("bytes"), "memory limit of hot files cache (0 disables it)")
+    ("cache-max-file", po::value<std::size_t>()->default_value(1024 * 1024)
+       ->value_name("bytes"), "size limit of a file placed into the cache")
+    ("mmap-cache-size", po::value<std::size_t>()->default_value(0)
+       ->value_name("bytes"), "limit of files mapped and shared by "
+       "connections instead of being sent from the file (0 disables it)")
+    ("mmap-max-file", po::value<std::size_t>()
+       ->default_value(16 * 1024 * 1024)->value_name("bytes"),
+       "size limit of a mapped file, smaller ones which fit the cache "
+       "are cached")
+    ("mime-types", po::value<std::string>()->default_value("")
+       ->value_name("file"), "content types overriding built-in ones")
+    ("autoindex", "respond with listings of directories")
+    ("precompressed", "serve .br and .gz siblings of files to clients "
+       "accepting them (costs a stat per request when they are absent)")
+    ("gzip", "compress responses of compressible types on the fly")
+    ("gzip-level", po::value<int>()->default_value(6)
+       ->value_name("1-9"), "compression level of on-the-fly gzip")
+    ("gzip-min-size", po::value<std::size_t>()->default_value(256)
+       ->value_name("bytes"), "smaller files are sent uncompressed")
+    ("gzip-max-size", po::value<std::size_t>()->default_value(4 * 1024 * 1024)
+       ->value_name("bytes"), "larger files are sent uncompressed")
+    ("gzip-threads", po::value<std::size_t>()->default_value(1)
+       ->value_name("N"), "threads compressing responses")
+    ("gzip-queue-size", po::value<std::size_t>()->default_value(256)
+       ->value_name("N"), "responses waiting for compression before "
+       "others are sent uncompressed")
+    ("gzip-cache-size", po::value<std::size_t>()
+       ->default_value(16 * 1024 * 1024)->value_name("bytes"),
+       "memory limit of compressed responses cache")
+    ("access-log", po::value<std::string>()->default_value("")
+       ->value_name("directory"), "write binary access log files there")
+    ("access-log-file-size", po::value<std::size_t>()
+       ->default_value(64 * 1024 * 1024)->value_name("bytes"),
+       "size of an access log file before rotation")
+    ("metrics-url", po::value<std::string>()->default_value("")
+       ->value_name("path"), "serve metrics in Prometheus format there "
+       "(e.g. /__metrics)")
   ;
 
   po::options_description desc("Allowed Options");
@@ -0,0 +1,148 @@
+#include "metrics.hpp"
+
+#include <cstring>
+#include <ostream>
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Index of the most significant set bit, `value` must not be zero.
+unsigned int log2_floor(boost::uint64_t value)
+{
+  return 63u - static_cast<unsigned int>(__builtin_clzll(value));
+}
+
+void add_histogram(metrics_snapshot::histogram& to,
+                   latency_histogram const& from)
+{
+  for (std::size_t i = 0; i < latency_histogram::buckets_count; ++i) {
+    to.buckets[i] += from.bucket(i);
+  }
+  to.count += from.count();
+  to.sum += from.sum();
+}
+
+void write_histogram(std::ostream& os, const char* name, const char* help,
+                     metrics_snapshot::histogram const& histogram)
+{
+  os << "# HELP " << name << ' ' << help << "\n"
+        "# TYPE " << name << " histogram\n";
+
+  // Buckets are cumulative, upper bounds are in seconds
+  boost::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i + 1 < latency_histogram::buckets_count; ++i) {
+    cumulative += histogram.buckets[i];
+    os << name << "_bucket{le=\""
+       << static_cast<double>(latency_histogram::upper_bound(i)) / 1e9
+       << "\"} " << cumulative << '\n';
+  }
+  os << name << "_bucket{le=\"+Inf\"} " << histogram.count << '\n'
+     << name << "_sum " << static_cast<double>(histogram.sum) / 1e9 << '\n'
+     << name << "_count " << histogram.count << '\n';
+}
+
+} // namespace
+
+void
+latency_histogram::record(boost::uint64_t ns)
+{
+  std::size_t idx = 0;
+  if (ns >> min_bits) {
+    unsigned int msb = log2_floor(ns);
+    if (msb >= max_bits) {
+      idx = buckets_count - 1;
+    }
+    else {
+      std::size_t sub = static_cast<std::size_t>(
+          (ns >> (msb - sub_bits)) & (sub_buckets - 1));
+      idx = 1 + (msb - min_bits) * sub_buckets + sub;
+    }
+  }
+
+  buckets_[idx].inc();
+  count_.inc();
+  sum_.add(ns);
+}
+
+boost::uint64_t
+latency_histogram::upper_bound(std::size_t idx)
+{
+  if (idx == 0) {
+    return (boost::uint64_t(1) << min_bits) - 1;
+  }
+
+  std::size_t msb = min_bits + (idx - 1) / sub_buckets;
+  std::size_t sub = (idx - 1) % sub_buckets;
+  return (boost::uint64_t(1) << msb) +
+      ((sub + 1) << (msb - sub_bits)) - 1;
+}
+
+metrics_snapshot::metrics_snapshot()
+{
+  std::memset(this, 0, sizeof(*this));
+}
+
+metrics_snapshot&
+metrics_snapshot::operator+=(thread_metrics const& metrics)
+{
+  connections_opened += metrics.connections_opened.value();
+  connections_closed += metrics.connections_closed.value();
+  accept_errors += metrics.accept_errors.value();
+  bytes_received += metrics.bytes_received.value();
+  bytes_sent += metrics.bytes_sent.value();
+  for (std::size_t i = 0; i < thread_metrics::max_status; ++i) {
+    responses[i] += metrics.responses[i].value();
+  }
+  add_histogram(first_byte, metrics.first_byte);
+  add_histogram(response, metrics.response);
+  return *this;
+}
+
+void
+write_prometheus_metric(std::ostream& os, const char* name,
+                        const char* type, const char* help,
+                        boost::uint64_t value)
+{
+  os << "# HELP " << name << ' ' << help << "\n"
+        "# TYPE " << name << ' ' << type << '\n'
+     << name << ' ' << value << '\n';
+}
+
+void
+write_prometheus(std::ostream& os, metrics_snapshot const& snapshot)
+{
+  write_prometheus_metric(os, "eiptnd_connections_total", "counter",
+      "Accepted connections.", snapshot.connections_opened);
+  // Connections may be finished by another thread, so the difference
+  // is taken from totals
+  write_prometheus_metric(os, "eiptnd_connections_active", "gauge",
+      "Connections being served.",
+      snapshot.connections_opened >= snapshot.connections_closed
+        ? snapshot.connections_opened - snapshot.connections_closed : 0);
+  write_prometheus_metric(os, "eiptnd_accept_errors_total", "counter",
+      "Failed accept operations.", snapshot.accept_errors);
+  write_prometheus_metric(os, "eiptnd_received_bytes_total", "counter",
+      "Bytes read from clients.", snapshot.bytes_received);
+  write_prometheus_metric(os, "eiptnd_sent_bytes_total", "counter",
+      "Bytes written to clients.", snapshot.bytes_sent);
+
+  os << "# HELP eiptnd_responses_total Responses by status code.\n"
+        "# TYPE eiptnd_responses_total counter\n";
+  for (std::size_t i = 0; i < thread_metrics::max_status; ++i) {
+    if (snapshot.responses[i]) {
+      os << "eiptnd_responses_total{code=\"" << i << "\"} "
+         << snapshot.responses[i] << '\n';
+    }
+  }
+
+  write_histogram(os, "eiptnd_time_to_first_byte_seconds",
+                  "Time from receiving a request to writing its first part.",
+                  snapshot.first_byte);
+  write_histogram(os, "eiptnd_response_duration_seconds",
+                  "Time from receiving a request to sending its response.",
+                  snapshot.response);
+}
+
+} // namespace eiptnd
@@ -0,0 +1,129 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <iosfwd>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+
+namespace eiptnd {
+
+/// Counter which is changed by a single thread and read by any one.
+/// An increment is a plain load and store, there is no locked instruction.
+class metrics_counter
+{
+public:
+  metrics_counter() : value_(0) {}
+
+  void add(boost::uint64_t n)
+  { value_.store(value_.load(boost::memory_order_relaxed) + n,
+                 boost::memory_order_relaxed); }
+
+  void inc() { add(1); }
+
+  boost::uint64_t value() const
+  { return value_.load(boost::memory_order_relaxed); }
+
+private:
+  boost::atomic<boost::uint64_t> value_;
+};
+
+/// Histogram of durations in nanoseconds with log-linear buckets: every
+/// power of two range is split into `sub_buckets` equal parts, so the
+/// relative error is bounded like in HDR histograms. Values below 1us
+/// share the first bucket, ones above ~137s share the last one.
+class latency_histogram
+  : private boost::noncopyable
+{
+public:
+  enum
+  {
+    sub_bits = 2,
+    sub_buckets = 1 << sub_bits,
+    min_bits = 10,
+    max_bits = 37,
+    buckets_count = (max_bits - min_bits) * sub_buckets + 2
+  };
+
+  /// Add a value, only the owning thread may call it.
+  void record(boost::uint64_t ns);
+
+  /// Greatest value which falls into the bucket.
+  static boost::uint64_t upper_bound(std::size_t idx);
+
+  boost::uint64_t bucket(std::size_t idx) const
+  { return buckets_[idx].value(); }
+
+  boost::uint64_t count() const { return count_.value(); }
+  boost::uint64_t sum() const { return sum_.value(); }
+
+private:
+  metrics_counter buckets_[buckets_count];
+  metrics_counter count_;
+  metrics_counter sum_;
+};
+
+/// Counters of a single thread. They are padded, so threads
+/// do not share cache lines when updating their own counters.
+struct thread_metrics
+  : private boost::noncopyable
+{
+  enum { max_status = 600 };
+
+  char pad0_[64];
+
+  metrics_counter connections_opened;
+  metrics_counter connections_closed;
+  metrics_counter accept_errors;
+  metrics_counter bytes_received;
+  metrics_counter bytes_sent;
+
+  /// Responses indexed by status code.
+  metrics_counter responses[max_status];
+
+  /// From receiving a request head to writing the first entry of the
+  /// response, and to writing the whole response.
+  latency_histogram first_byte;
+  latency_histogram response;
+
+  char pad1_[64];
+};
+
+/// Totals of all threads at some moment.
+struct metrics_snapshot
+{
+  metrics_snapshot();
+
+  /// Add counters of a thread.
+  metrics_snapshot& operator+=(thread_metrics const& metrics);
+
+  boost::uint64_t connections_opened;
+  boost::uint64_t connections_closed;
+  boost::uint64_t accept_errors;
+  boost::uint64_t bytes_received;
+  boost::uint64_t bytes_sent;
+  boost::uint64_t responses[thread_metrics::max_status];
+
+  struct histogram
+  {
+    boost::uint64_t buckets[latency_histogram::buckets_count];
+    boost::uint64_t count;
+    boost::uint64_t sum;
+  };
+
+  histogram first_byte;
+  histogram response;
+};
+
+/// Render metrics in the Prometheus text exposition format.
+void write_prometheus(std::ostream& os, metrics_snapshot const& snapshot);
+
+/// Render a single value in the Prometheus text exposition format.
+void write_prometheus_metric(std::ostream& os, const char* name,
+                             const char* type, const char* help,
+                             boost::uint64_t value);
+
+} // namespace eiptnd
+
+#endif // METRICS_HPP
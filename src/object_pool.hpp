@@ -0,0 +1,106 @@
+#ifndef OBJECT_POOL_HPP
+#define OBJECT_POOL_HPP
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+
+namespace eiptnd {
+
+/// Statistics of object pools.
+struct pool_stats
+{
+  pool_stats() : size(0), hits(0), misses(0) {}
+
+  pool_stats& operator+=(pool_stats const& other)
+  {
+    size += other.size;
+    hits += other.hits;
+    misses += other.misses;
+    return *this;
+  }
+
+  /// Percentage of objects which were reused.
+  double hit_rate() const
+  { return hits + misses ? 100.0 * hits / (hits + misses) : 0.0; }
+
+  std::size_t size;
+  std::size_t hits;
+  std::size_t misses;
+};
+
+/// Free list of objects owned by a single thread. Released objects keep
+/// their resources (buffers capacity, strand, logger) and are handed out
+/// again instead of being constructed from scratch.
+template <typename T>
+class object_pool
+  : private boost::noncopyable
+{
+public:
+  explicit object_pool(std::size_t max_size)
+    : max_size_(max_size)
+    , size_(0)
+    , hits_(0)
+    , misses_(0)
+  {
+    free_.reserve(max_size_);
+  }
+
+  ~object_pool()
+  {
+    for (T* p : free_) {
+      delete p;
+    }
+  }
+
+  /// Take an object from the pool or return null if the pool is empty.
+  T* acquire()
+  {
+    if (free_.empty()) {
+      misses_.fetch_add(1, boost::memory_order_relaxed);
+      return 0;
+    }
+
+    T* p = free_.back();
+    free_.pop_back();
+    size_.store(free_.size(), boost::memory_order_relaxed);
+    hits_.fetch_add(1, boost::memory_order_relaxed);
+    return p;
+  }
+
+  /// Put an object back to the pool. Returns false if the pool is full.
+  bool release(T* p)
+  {
+    if (free_.size() >= max_size_) {
+      return false;
+    }
+
+    free_.push_back(p);
+    size_.store(free_.size(), boost::memory_order_relaxed);
+    return true;
+  }
+
+  /// Could be called from any thread.
+  pool_stats stats() const
+  {
+    pool_stats s;
+    s.size = size_.load(boost::memory_order_relaxed);
+    s.hits = hits_.load(boost::memory_order_relaxed);
+    s.misses = misses_.load(boost::memory_order_relaxed);
+    return s;
+  }
+
+private:
+  std::vector<T*> free_;
+  std::size_t max_size_;
+
+  /// Counters for statistics.
+  boost::atomic<std::size_t> size_;
+  boost::atomic<std::size_t> hits_;
+  boost::atomic<std::size_t> misses_;
+};
+
+} // namespace eiptnd
+
+#endif // OBJECT_POOL_HPP
@@ -6,60 +6,247 @@
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/thread.hpp>
+#ifdef ENABLE_IO_URING
+#include <unistd.h>
+#endif
 
 namespace eiptnd {
 
-tcp_server::tcp_server(core& core,
-               const std::string& bind_addr, unsigned short bind_port)
+/// Limit of connections accepted synchronously after a single completion.
+static const std::size_t max_accept_batch = 32;
+
+tcp_server::tcp_server(core& core, boost::shared_ptr<io_shard> const& shard,
+               const std::string& bind_addr, unsigned short bind_port,
+               bool reuse_port, std::size_t accept_depth)
   : log_(boost::log::keywords::channel = "net")
   , core_(core)
-  , io_service_(core_.get_ios())
+  , shard_(shard)
+  , io_service_(shard_->get_ios())
+  , strand_(shard_->is_multithreaded()
+            ? new boost::asio::io_service::strand(*io_service_) : 0)
   , acceptor_(*io_service_)
+  , protocol_(boost::asio::ip::tcp::v4())
+  , accept_depth_(std::max<std::size_t>(accept_depth, 1))
+  , retry_timer_(*io_service_)
+  , retry_count_(0)
 {
   using namespace boost::asio::ip;
 
   tcp::endpoint endpoint(address::from_string(bind_addr), bind_port);
-  acceptor_.open(endpoint.protocol());
+  protocol_ = endpoint.protocol();
+  acceptor_.open(protocol_);
   acceptor_.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+  if (reuse_port) {
+    typedef boost::asio::detail::socket_option::boolean<
+        SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+    acceptor_.set_option(reuse_port_option(true));
+  }
+#else
+  BOOST_ASSERT_MSG(!reuse_port, "SO_REUSEPORT is not supported");
+#endif
   acceptor_.bind(endpoint);
   acceptor_.listen();
+
+  // Waiting connections are drained without blocking
+  acceptor_.non_blocking(true);
 }
 
 void
 tcp_server::start_accept()
 {
-  BOOST_LOG_SEV(log_, logging::trace) << "start_accept()";
+#ifdef ENABLE_IO_URING
+  if (uring_engine* uring = shard_->get_uring()) {
+    BOOST_LOG_SEV(log_, logging::trace) << "start_accept(): io_uring";
+    start_uring_accept(uring);
+    return;
+  }
+#endif
+
+  BOOST_LOG_SEV(log_, logging::trace)
+    << "start_accept(): " << accept_depth_ << " operations";
+
+  for (std::size_t i = 0; i < accept_depth_; ++i) {
+    do_accept();
+  }
+}
+
+connection_ptr
+tcp_server::take_connection()
+{
+  connection_ptr new_connection;
+  new_connection.swap(spare_connection_);
+  if (!new_connection) {
+    new_connection = connection::create(boost::ref(core_), shard_);
+  }
+  return new_connection;
+}
 
-  new_connection_ = connection::create(boost::ref(core_));
-  acceptor_.async_accept(new_connection_->socket(),
-      boost::bind(&tcp_server::handle_accept, shared_from_this(), _1));
+void
+tcp_server::do_accept()
+{
+  connection_ptr new_connection = take_connection();
+  acceptor_.async_accept(new_connection->socket(),
+      make_connection_handler(strand_.get(), &new_connection->handler_memory_,
+        boost::bind(&tcp_server::handle_accept, shared_from_this(),
+                    new_connection, _1)));
 }
 
 void
-tcp_server::handle_accept(const boost::system::error_code& ec)
+tcp_server::handle_accept(connection_ptr new_connection,
+                          const boost::system::error_code& ec)
 {
   if (!ec) {
-    boost::system::error_code ignored;
-    BOOST_LOG_SEV(log_, logging::trace)
-      << "New connection from "
-      << new_connection_->socket().remote_endpoint(ignored)
-      << " is accepted";
+    start_connection(new_connection);
+    accept_ready();
+    do_accept();
+  }
+  else if (ec != boost::asio::error::operation_aborted) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Accept failed: " << ec.message() << " (" << ec.value() << ")";
+    if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+      metrics->accept_errors.inc();
+    }
+    retry_accept();
+  }
+}
 
-    new_connection_->on_connection();
+#ifdef ENABLE_IO_URING
+void
+tcp_server::start_uring_accept(uring_engine* uring)
+{
+  uring->async_accept(acceptor_.native_handle(),
+      make_connection_handler(strand_.get(), 0,
+        boost::bind(&tcp_server::handle_uring_accept, shared_from_this(),
+                    _1, _2, _3)));
+}
 
-    start_accept();
+void
+tcp_server::handle_uring_accept(const boost::system::error_code& ec, int fd,
+                                bool more)
+{
+  if (!ec) {
+    connection_ptr new_connection = take_connection();
+    boost::system::error_code assign_ec;
+    new_connection->socket().assign(protocol_, fd, assign_ec);
+    if (assign_ec) {
+      BOOST_LOG_SEV(log_, logging::error)
+        << "Accepted socket is refused: " << assign_ec.message()
+        << " (" << assign_ec.value() << ")";
+      ::close(fd);
+      spare_connection_.swap(new_connection);
+    }
+    else {
+      start_connection(new_connection);
+    }
   }
   else if (ec != boost::asio::error::operation_aborted) {
     BOOST_LOG_SEV(log_, logging::error)
       << "Accept failed: " << ec.message() << " (" << ec.value() << ")";
+    if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+      metrics->accept_errors.inc();
+    }
+  }
+
+  // The request ends on errors and cancelling, the kernel may also end
+  // it without an error, e.g. when completions overflow
+  if (!more && ec != boost::asio::error::operation_aborted &&
+      acceptor_.is_open()) {
+    if (ec) {
+      retry_accept();
+    }
+    else {
+      start_uring_accept(shard_->get_uring());
+    }
   }
 }
+#endif
+
+void
+tcp_server::retry_accept()
+{
+  // Avoid spinning when the error is persistent. Operations failing
+  // together share the wait, rearming it would cancel the earlier ones.
+  if (retry_count_++ == 0) {
+    retry_timer_.expires_from_now(boost::posix_time::milliseconds(100));
+    retry_timer_.async_wait(
+        make_connection_handler(strand_.get(), 0,
+          boost::bind(&tcp_server::handle_retry, shared_from_this(), _1)));
+  }
+}
+
+void
+tcp_server::handle_retry(const boost::system::error_code& ec)
+{
+  std::size_t count = retry_count_;
+  retry_count_ = 0;
+  if (ec || !acceptor_.is_open()) {
+    return;
+  }
+
+#ifdef ENABLE_IO_URING
+  if (uring_engine* uring = shard_->get_uring()) {
+    start_uring_accept(uring);
+    return;
+  }
+#endif
+
+  for (std::size_t i = 0; i < count; ++i) {
+    do_accept();
+  }
+}
+
+void
+tcp_server::accept_ready()
+{
+  for (std::size_t i = 0; i < max_accept_batch; ++i) {
+    // The last attempt usually finds the backlog empty, and its
+    // connection is kept for the next one
+    connection_ptr new_connection = take_connection();
+
+    boost::system::error_code ec;
+    acceptor_.accept(new_connection->socket(), ec);
+    if (ec) {
+      spare_connection_.swap(new_connection);
+      if (ec != boost::asio::error::would_block &&
+          ec != boost::asio::error::try_again) {
+        BOOST_LOG_SEV(log_, logging::error)
+          << "Accept failed: " << ec.message() << " (" << ec.value() << ")";
+        if (thread_metrics* metrics = shard_->this_thread_metrics()) {
+          metrics->accept_errors.inc();
+        }
+      }
+      break;
+    }
+
+    start_connection(new_connection);
+  }
+}
+
+void
+tcp_server::start_connection(connection_ptr const& new_connection)
+{
+  BOOST_LOG_SEV(log_, logging::trace) << "New connection is accepted";
+
+  // Setup of the connection is done outside of the accept handler,
+  // so other threads could serve it while this one is accepting.
+  io_service_->post(boost::bind(&connection::on_connection, new_connection));
+}
 
 void
 tcp_server::cancel()
 {
-  new_connection_->close();
-  acceptor_.close();
+  boost::system::error_code ignored_ec;
+  retry_timer_.cancel(ignored_ec);
+#ifdef ENABLE_IO_URING
+  if (uring_engine* uring = shard_->get_uring()) {
+    if (acceptor_.is_open()) {
+      // The multishot request holds the listener, closing does not end it
+      uring->cancel(acceptor_.native_handle());
+    }
+  }
+#endif
+  acceptor_.close(ignored_ec);
   /*boost::system::error_code ec;
   acceptor_.cancel(ec);
   if (ec) {
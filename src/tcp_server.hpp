@@ -4,10 +4,13 @@
 #include "connection.hpp"
 #include "log.hpp"
 
+#include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
 /*#include <boost/move/move.hpp>*/
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
 namespace eiptnd {
@@ -19,18 +22,48 @@ class tcp_server
   , private boost::noncopyable
 {
 public:
-  explicit tcp_server(core& core,
-                  const std::string& address, unsigned short port_num);
+  /// Listeners of different shards could be bound to the same endpoint
+  /// with `reuse_port`, so the kernel balances connections between them.
+  tcp_server(core& core, boost::shared_ptr<io_shard> const& shard,
+             const std::string& address, unsigned short port_num,
+             bool reuse_port, std::size_t accept_depth);
 
-  /// Initiate an asynchronous accept operation.
+  /// Initiate asynchronous accept operations. A single multishot
+  /// request accepts connections if the shard uses io_uring.
   void start_accept();
 
   /// Cancel accepting new connections
   void cancel();
 
 private:
+  /// Initiate a single asynchronous accept operation.
+  void do_accept();
+
   /// Handle completion of an asynchronous accept operation.
-  void handle_accept(const boost::system::error_code& ec);
+  void handle_accept(connection_ptr new_connection,
+                     const boost::system::error_code& ec);
+
+  /// Accept connections which are already waiting in the backlog.
+  void accept_ready();
+#ifdef ENABLE_IO_URING
+  /// Start accepting through the shard's io_uring.
+  void start_uring_accept(uring_engine* uring);
+
+  /// Handle a connection accepted through the shard's io_uring.
+  void handle_uring_accept(const boost::system::error_code& ec, int fd,
+                           bool more);
+#endif
+
+  /// Count a failed accept operation and restart it later.
+  void retry_accept();
+
+  /// Hand the accepted connection over to its own handlers.
+  void start_connection(connection_ptr const& new_connection);
+
+  /// Take the spare connection or create a new one.
+  connection_ptr take_connection();
+
+  void handle_retry(const boost::system::error_code& ec);
 
   /// Logger channels and attributes.
   logging::logger log_;
@@ -38,13 +71,31 @@ private:
   ///
   core& core_;
 
+  /// Shard serving accepted connections.
+  boost::shared_ptr<io_shard> shard_;
+
   boost::shared_ptr<boost::asio::io_service> io_service_;
 
+  /// Strand to serialize accept handlers of multithreaded shard.
+  boost::scoped_ptr<boost::asio::io_service::strand> strand_;
+
   /// Acceptor used to listen for incoming connections.
   boost::asio::ip::tcp::acceptor acceptor_;
 
-  /// The next connection to be accepted.
-  connection_ptr new_connection_;
+  /// Protocol of the listener, sockets accepted by io_uring are of it.
+  boost::asio::ip::tcp protocol_;
+
+  /// Count of simultaneously pending accept operations.
+  std::size_t accept_depth_;
+
+  /// Delays accepting after a failure (e.g. out of descriptors). Failed
+  /// operations are counted and restarted together when it expires.
+  boost::asio::deadline_timer retry_timer_;
+  std::size_t retry_count_;
+
+  /// Connection which was not accepted into by the last synchronous
+  /// attempt, it is used by the next one instead of a new object.
+  connection_ptr spare_connection_;
 };
 
 } // namespace eiptnd
@@ -0,0 +1,162 @@
+#include "timer_wheel.hpp"
+
+#include <vector>
+#include <boost/bind.hpp>
+
+
+namespace eiptnd {
+
+timer_wheel::timer_wheel(boost::asio::io_service& io_service, duration resolution)
+  : timer_(io_service)
+  , resolution_(resolution)
+  , current_(0)
+  , size_(0)
+  , is_ticking_(false)
+  , is_stopping_(false)
+{
+}
+
+void
+timer_wheel::start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  is_stopping_ = false;
+  if (!is_ticking_) {
+    is_ticking_ = true;
+    timer_.expires_from_now(resolution_);
+    start_timer();
+  }
+}
+
+void
+timer_wheel::stop()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  is_stopping_ = true;
+  if (is_ticking_ && size_ == 0) {
+    boost::system::error_code ignored_ec;
+    timer_.cancel(ignored_ec);
+  }
+}
+
+void
+timer_wheel::schedule(entry& e, duration timeout)
+{
+  boost::uint64_t ticks = static_cast<boost::uint64_t>(
+      (timeout.total_microseconds() + resolution_.total_microseconds() - 1) /
+      resolution_.total_microseconds());
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (e.is_linked()) {
+    e.unlink();
+    --size_;
+  }
+
+  e.deadline_ = current_ + ticks;
+  link(e);
+  ++size_;
+
+  // Wheel may be stopped already while the entry is scheduled at shutdown
+  if (!is_ticking_) {
+    is_ticking_ = true;
+    timer_.expires_from_now(resolution_);
+    start_timer();
+  }
+}
+
+void
+timer_wheel::cancel(entry& e)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (e.is_linked()) {
+    e.unlink();
+    --size_;
+  }
+}
+
+void
+timer_wheel::link(entry& e)
+{
+  boost::uint64_t delta = e.deadline_ > current_ ? e.deadline_ - current_ : 0;
+  boost::uint64_t when = delta ? e.deadline_ : current_ + 1;
+
+  std::size_t level = 0;
+  while (level + 1 < levels_count &&
+         delta >= (boost::uint64_t(1) << (slot_bits * (level + 1)))) {
+    ++level;
+  }
+
+  // Too far deadlines are placed into the farthest slot and relinked later
+  boost::uint64_t max_delta = (boost::uint64_t(1) << (slot_bits * levels_count)) - 1;
+  if (delta > max_delta) {
+    when = current_ + max_delta;
+  }
+
+  std::size_t slot = (when >> (slot_bits * level)) & (slots_count - 1);
+  wheel_[level][slot].push_back(e);
+}
+
+void
+timer_wheel::start_timer()
+{
+  timer_.async_wait(
+      boost::bind(&timer_wheel::handle_tick, shared_from_this(), _1));
+}
+
+void
+timer_wheel::handle_tick(const boost::system::error_code& ec)
+{
+  std::vector<boost::function<void()> > expired;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (ec || (is_stopping_ && size_ == 0)) {
+      is_ticking_ = false;
+      return;
+    }
+
+    ++current_;
+
+    // Move entries from the upper levels when lower ones wrap around
+    for (std::size_t level = 1; level < levels_count; ++level) {
+      boost::uint64_t level_mask = (boost::uint64_t(1) << (slot_bits * level)) - 1;
+      if (current_ & level_mask) {
+        break;
+      }
+
+      slot_t& slot = wheel_[level][(current_ >> (slot_bits * level)) & (slots_count - 1)];
+      while (!slot.empty()) {
+        entry& e = slot.front();
+        slot.pop_front();
+        link(e);
+      }
+    }
+
+    slot_t& slot = wheel_[0][current_ & (slots_count - 1)];
+    while (!slot.empty()) {
+      entry& e = slot.front();
+      slot.pop_front();
+      if (e.deadline_ > current_) {
+        link(e);
+      }
+      else {
+        --size_;
+        expired.push_back(e.on_expire);
+      }
+    }
+
+    timer_.expires_at(timer_.expires_at() + resolution_);
+    start_timer();
+  }
+
+  // Handlers are called without the lock, so they could reschedule
+  for (boost::function<void()>& handler : expired) {
+    handler();
+  }
+}
+
+} // namespace eiptnd
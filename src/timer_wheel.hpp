@@ -0,0 +1,94 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <boost/array.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+namespace eiptnd {
+
+/// Hierarchical timing wheel for coarse timeouts of a huge number of
+/// objects. Timed objects embed an entry, so (re)scheduling is an O(1)
+/// relinking without allocations, while io_service holds a single timer
+/// which advances the wheel every tick.
+class timer_wheel
+  : public boost::enable_shared_from_this<timer_wheel>
+  , private boost::noncopyable
+{
+public:
+  typedef boost::posix_time::time_duration duration;
+
+  class entry
+    : public boost::intrusive::list_base_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink> >
+  {
+  public:
+    entry() : deadline_(0) {}
+
+    /// Called from the wheel's tick handler when the deadline is reached.
+    /// It is called once, the entry must be scheduled again to be reused.
+    boost::function<void()> on_expire;
+
+  private:
+    friend class timer_wheel;
+
+    /// Deadline in ticks of the wheel.
+    boost::uint64_t deadline_;
+  };
+
+  timer_wheel(boost::asio::io_service& io_service, duration resolution);
+
+  /// Start ticking.
+  void start();
+
+  /// Stop ticking as soon as there are no scheduled entries.
+  void stop();
+
+  /// (Re)schedule the entry to expire after the timeout.
+  void schedule(entry& e, duration timeout);
+
+  /// Remove the entry from the wheel if it is scheduled.
+  void cancel(entry& e);
+
+private:
+  typedef boost::intrusive::list<
+      entry, boost::intrusive::constant_time_size<false> > slot_t;
+
+  static const std::size_t slot_bits = 6;
+  static const std::size_t slots_count = 1 << slot_bits;
+  static const std::size_t levels_count = 4;
+
+  /// Put the entry into the slot corresponding to its deadline.
+  void link(entry& e);
+
+  void start_timer();
+  void handle_tick(const boost::system::error_code& ec);
+
+  boost::asio::deadline_timer timer_;
+  duration resolution_;
+
+  /// Protects everything below.
+  boost::mutex mutex_;
+
+  boost::array<boost::array<slot_t, slots_count>, levels_count> wheel_;
+
+  /// Count of ticks elapsed since the start.
+  boost::uint64_t current_;
+
+  /// Count of scheduled entries.
+  std::size_t size_;
+
+  bool is_ticking_;
+  bool is_stopping_;
+};
+
+} // namespace eiptnd
+
+#endif // TIMER_WHEEL_HPP
@@ -0,0 +1,922 @@
+#include "uring_engine.hpp"
+
+#ifdef ENABLE_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <boost/asio/buffer.hpp>
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/system/system_error.hpp>
+#include <endian.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+namespace eiptnd {
+
+namespace {
+
+/// Every request takes two submission entries at most, and they are
+/// passed to the kernel at once, so the queue is never long.
+const unsigned submission_entries = 64;
+
+/// Completions are reaped by a single handler, a long queue keeps
+/// them from overflowing into the kernel's backlog under load.
+const unsigned completion_entries = 4096;
+
+/// Buffers registered with the ring, requests sent concurrently
+/// above it use buffers of their own.
+const std::size_t registered_buffers = 64;
+
+/// Buffers provided for received data, a power of two. Requests are
+/// small and are copied out of them right away, so they are reused
+/// quickly. Receiving stops with ENOBUFS when all of them are taken.
+const unsigned receive_buffers = 256;
+const std::size_t receive_buffer_size = 4096;
+
+/// Group of the provided buffers.
+const unsigned short receive_buffer_group = 0;
+
+int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, 0, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg,
+                      unsigned nr_args)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode,
+                                    arg, nr_args));
+}
+
+void throw_error(int error, const char* what)
+{
+  throw boost::system::system_error(
+      boost::system::error_code(error, boost::system::system_category()),
+      what);
+}
+
+template <typename T>
+T* ring_field(void* map, unsigned offset)
+{
+  return reinterpret_cast<T*>(static_cast<char*>(map) + offset);
+}
+
+/// Entries of the ring of provided buffers. The tail of the ring
+/// overlays the reserved field of the first entry. The entries are
+/// indexed by hand, the flexible array of io_uring_buf_ring is laid
+/// out after the tail by C++ compilers.
+io_uring_buf* ring_buffers(void* ring)
+{
+  return static_cast<io_uring_buf*>(ring);
+}
+
+boost::system::error_code make_error(int error)
+{
+  return boost::system::error_code(error, boost::system::system_category());
+}
+
+} // namespace
+
+/// A chunk being read and sent.
+struct uring_engine::operation
+{
+  int socket;
+
+  /// Registered buffer or -1 if `data` points to `own_data`.
+  int buffer_index;
+  char* data;
+  std::vector<char> own_data;
+
+  /// Bytes of the chunk and sent ones.
+  std::size_t size;
+  std::size_t sent;
+
+  /// Requests waiting for completion, the last one finishes the operation.
+  boost::atomic<unsigned> pending;
+
+  /// Error of passing requests to the kernel.
+  int submit_error;
+
+  /// The socket refused more data, the rest is sent when it is writable.
+  bool blocked;
+  boost::system::error_code error;
+
+  send_handler handler;
+};
+
+/// A request completing many times: accepting or receiving.
+struct uring_engine::multishot
+{
+  /// Entry in the table and the count of requests which took it.
+  boost::uint32_t slot;
+  boost::uint32_t generation;
+
+  int fd;
+
+  /// One of them is set.
+  accept_handler on_accept;
+  receive_handler on_receive;
+};
+
+uring_engine::uring_engine(boost::asio::io_service& io_service,
+                           std::size_t buffer_size)
+  : log_(boost::log::keywords::channel = "uring")
+  , io_service_(io_service)
+  , ring_fd_(-1)
+  , sq_map_(0)
+  , sq_map_size_(0)
+  , cq_map_(0)
+  , cq_map_size_(0)
+  , sqes_(0)
+  , sqes_size_(0)
+  , sq_pending_(0)
+  , buffer_size_(std::max<std::size_t>(buffer_size, 1))
+  , buffer_ring_(0)
+  , buffer_ring_tail_(0)
+  , event_(io_service)
+  , event_value_(0)
+  , in_flight_(0)
+  , waiting_(false)
+  , stopping_(false)
+{
+  try {
+    setup();
+  }
+  catch (...) {
+    release();
+    throw;
+  }
+}
+
+uring_engine::~uring_engine()
+{
+  release();
+}
+
+void
+uring_engine::setup()
+{
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+  params.cq_entries = completion_entries;
+
+  ring_fd_ = io_uring_setup(submission_entries, &params);
+  if (ring_fd_ < 0) {
+    throw_error(errno, "io_uring_setup");
+  }
+
+  // Completions must not be lost when the queue is full
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    throw_error(EOPNOTSUPP, "io_uring_setup");
+  }
+
+  sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_map) {
+    sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+  }
+
+  sq_map_ = ::mmap(0, sq_map_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_map_ == MAP_FAILED) {
+    sq_map_ = 0;
+    throw_error(errno, "mmap");
+  }
+
+  if (single_map) {
+    cq_map_ = sq_map_;
+  }
+  else {
+    cq_map_ = ::mmap(0, cq_map_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_map_ == MAP_FAILED) {
+      cq_map_ = 0;
+      throw_error(errno, "mmap");
+    }
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = ::mmap(0, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    throw_error(errno, "mmap");
+  }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  sq_head_ = ring_field<unsigned>(sq_map_, params.sq_off.head);
+  sq_tail_ = ring_field<unsigned>(sq_map_, params.sq_off.tail);
+  sq_flags_ = ring_field<unsigned>(sq_map_, params.sq_off.flags);
+  sq_mask_ = *ring_field<unsigned>(sq_map_, params.sq_off.ring_mask);
+  sq_array_ = ring_field<unsigned>(sq_map_, params.sq_off.array);
+  cq_head_ = ring_field<unsigned>(cq_map_, params.cq_off.head);
+  cq_tail_ = ring_field<unsigned>(cq_map_, params.cq_off.tail);
+  cq_mask_ = *ring_field<unsigned>(cq_map_, params.cq_off.ring_mask);
+  cqes_ = ring_field<io_uring_cqe>(cq_map_, params.cq_off.cqes);
+
+  // Requests of the engine must be known to the kernel
+  const unsigned probe_ops = 256;
+  std::vector<char> probe_data(sizeof(io_uring_probe) +
+                               probe_ops * sizeof(io_uring_probe_op));
+  io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(&probe_data[0]);
+  if (io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, probe_ops) < 0) {
+    throw_error(errno, "io_uring_register(IORING_REGISTER_PROBE)");
+  }
+  const unsigned needed_ops[] = {
+    IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_SEND, IORING_OP_POLL_ADD,
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_ASYNC_CANCEL
+  };
+  for (unsigned op : needed_ops) {
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      throw_error(EOPNOTSUPP, "io_uring_register(IORING_REGISTER_PROBE)");
+    }
+  }
+
+  setup_receive_buffers();
+  probe_multishot();
+
+  int event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd == -1) {
+    throw_error(errno, "eventfd");
+  }
+  event_.assign(event_fd);
+  if (io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+    throw_error(errno, "io_uring_register(IORING_REGISTER_EVENTFD)");
+  }
+
+  // Pinned memory is limited, the engine works without registered buffers
+  buffers_.resize(registered_buffers * buffer_size_);
+  std::vector<iovec> iovecs(registered_buffers);
+  for (std::size_t i = 0; i < registered_buffers; ++i) {
+    iovecs[i].iov_base = &buffers_[i * buffer_size_];
+    iovecs[i].iov_len = buffer_size_;
+  }
+  if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, &iovecs[0],
+                        static_cast<unsigned>(iovecs.size())) < 0) {
+    BOOST_LOG_SEV(log_, logging::warning)
+      << "Buffers are not registered: " << std::strerror(errno);
+    std::vector<char>().swap(buffers_);
+  }
+  else {
+    for (std::size_t i = registered_buffers; i > 0; --i) {
+      free_buffers_.push_back(static_cast<int>(i - 1));
+    }
+  }
+
+  BOOST_LOG_SEV(log_, logging::info)
+    << "Ring of " << params.sq_entries << " entries with "
+    << free_buffers_.size() << " registered buffers of "
+    << buffer_size_ << " bytes and " << receive_buffers
+    << " provided buffers of " << receive_buffer_size << " bytes";
+}
+
+void
+uring_engine::setup_receive_buffers()
+{
+  std::size_t ring_size = receive_buffers * sizeof(io_uring_buf);
+  void* ring = ::mmap(0, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ring == MAP_FAILED) {
+    throw_error(errno, "mmap");
+  }
+  buffer_ring_ = ring;
+
+  io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<std::uintptr_t>(ring);
+  reg.ring_entries = receive_buffers;
+  reg.bgid = receive_buffer_group;
+  if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    throw_error(errno, "io_uring_register(IORING_REGISTER_PBUF_RING)");
+  }
+
+  receive_buffers_.resize(receive_buffers * receive_buffer_size);
+  for (unsigned i = 0; i < receive_buffers; ++i) {
+    release_buffer(static_cast<int>(i));
+  }
+}
+
+void
+uring_engine::probe_multishot()
+{
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                   0, fds) < 0) {
+    throw_error(errno, "socketpair");
+  }
+
+  int error = 0;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    io_uring_sqe* recv = get_sqe();
+    recv->opcode = IORING_OP_RECV;
+    recv->ioprio = IORING_RECV_MULTISHOT;
+    recv->flags = IOSQE_BUFFER_SELECT;
+    recv->buf_group = receive_buffer_group;
+    recv->fd = fds[0];
+    recv->user_data = multishot_request;
+    submit_pending(error);
+  }
+
+  // The first piece of data must leave the request armed, and
+  // cancelling by the descriptor must end it
+  io_uring_cqe cqe;
+  std::memset(&cqe, 0, sizeof(cqe));
+  if (!error && ::send(fds[1], "x", 1, MSG_NOSIGNAL) == 1) {
+    wait_completion(cqe);
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      release_buffer(static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+  }
+
+  bool armed = !error && cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+  if (armed) {
+    boost::mutex::scoped_lock lock(mutex_);
+    io_uring_sqe* cancel = get_sqe();
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->fd = fds[0];
+    cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    submit_pending(error);
+  }
+
+  bool cancelled = false;
+  for (unsigned i = 0; armed && !error && i < 2; ++i) {
+    wait_completion(cqe);
+    if (cqe.user_data == multishot_request) {
+      cancelled = cqe.res == -ECANCELED && !(cqe.flags & IORING_CQE_F_MORE);
+    }
+  }
+
+  // A request left armed is ended by closing the ring
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  if (error) {
+    throw_error(error, "io_uring_enter");
+  }
+  if (!cancelled) {
+    throw_error(EOPNOTSUPP, "IORING_RECV_MULTISHOT");
+  }
+}
+
+void
+uring_engine::wait_completion(io_uring_cqe& cqe)
+{
+  for (;;) {
+    unsigned head = *cq_head_;
+    if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      cqe = cqes_[head & cq_mask_];
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      return;
+    }
+    if (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR) {
+      throw_error(errno, "io_uring_enter");
+    }
+  }
+}
+
+void
+uring_engine::release()
+{
+  if (in_flight_) {
+    // Only a forced stop leaves them, the operations are not freed
+    // because the kernel may still complete them
+    BOOST_LOG_SEV(log_, logging::warning)
+      << in_flight_ << " requests are abandoned";
+  }
+
+  boost::system::error_code ignored_ec;
+  event_.close(ignored_ec);
+
+  if (sqes_) {
+    ::munmap(sqes_, sqes_size_);
+    sqes_ = 0;
+  }
+  if (cq_map_ && cq_map_ != sq_map_) {
+    ::munmap(cq_map_, cq_map_size_);
+  }
+  cq_map_ = 0;
+  if (sq_map_) {
+    ::munmap(sq_map_, sq_map_size_);
+    sq_map_ = 0;
+  }
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+  if (buffer_ring_) {
+    ::munmap(buffer_ring_, receive_buffers * sizeof(io_uring_buf));
+    buffer_ring_ = 0;
+  }
+
+  // Requests abandoned by a forced stop keep their handlers
+  for (boost::uint32_t slot : free_multishots_) {
+    delete multishots_[slot];
+  }
+}
+
+void
+uring_engine::start()
+{
+  waiting_ = true;
+  start_wait();
+}
+
+void
+uring_engine::stop()
+{
+  stopping_ = true;
+
+  // Wake up the handler, so it stops waiting if nothing is in flight
+  ::eventfd_write(event_.native_handle(), 1);
+}
+
+void
+uring_engine::async_send_file(int socket, int fd, boost::uint64_t offset,
+                              boost::uint64_t count, send_handler handler)
+{
+  operation* op = new operation;
+  op->socket = socket;
+  op->buffer_index = -1;
+  op->data = 0;
+  op->size = static_cast<std::size_t>(
+      std::min<boost::uint64_t>(count, buffer_size_));
+  op->sent = 0;
+  op->pending = 0;
+  op->submit_error = 0;
+  op->blocked = false;
+  op->handler.swap(handler);
+
+  add_in_flight();
+
+  if (op->size == 0) {
+    io_service_.post(boost::bind(&uring_engine::finish, this, op));
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!free_buffers_.empty()) {
+    op->buffer_index = free_buffers_.back();
+    free_buffers_.pop_back();
+    op->data = &buffers_[op->buffer_index * buffer_size_];
+  }
+  else {
+    op->own_data.resize(op->size);
+    op->data = &op->own_data[0];
+  }
+
+  io_uring_sqe* read = get_sqe();
+  read->opcode = op->buffer_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  read->flags = IOSQE_IO_LINK;
+  read->fd = fd;
+  read->off = offset;
+  read->addr = reinterpret_cast<std::uintptr_t>(op->data);
+  read->len = static_cast<boost::uint32_t>(op->size);
+  if (op->buffer_index >= 0) {
+    read->buf_index = static_cast<boost::uint16_t>(op->buffer_index);
+  }
+  read->user_data = reinterpret_cast<std::uintptr_t>(op) | read_request;
+
+  prepare_send(op);
+  submit_locked(op);
+}
+
+void
+uring_engine::async_accept(int listener, accept_handler handler)
+{
+  add_in_flight();
+
+  boost::mutex::scoped_lock lock(mutex_);
+  multishot* ms = take_multishot(listener);
+  ms->on_accept.swap(handler);
+
+  io_uring_sqe* accept = get_sqe();
+  accept->opcode = IORING_OP_ACCEPT;
+  accept->ioprio = IORING_ACCEPT_MULTISHOT;
+  accept->fd = listener;
+  accept->accept_flags = SOCK_CLOEXEC;
+  accept->user_data = multishot_key(ms);
+  submit_multishot(ms);
+}
+
+boost::uint64_t
+uring_engine::async_receive(int socket, receive_handler handler)
+{
+  add_in_flight();
+
+  boost::mutex::scoped_lock lock(mutex_);
+  multishot* ms = take_multishot(socket);
+  ms->on_receive.swap(handler);
+
+  io_uring_sqe* recv = get_sqe();
+  recv->opcode = IORING_OP_RECV;
+  recv->ioprio = IORING_RECV_MULTISHOT;
+  recv->flags = IOSQE_BUFFER_SELECT;
+  recv->buf_group = receive_buffer_group;
+  recv->fd = socket;
+  recv->user_data = multishot_key(ms);
+  submit_multishot(ms);
+  return recv->user_data;
+}
+
+void
+uring_engine::cancel_receive(boost::uint64_t key)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  io_uring_sqe* cancel = get_sqe();
+  cancel->opcode = IORING_OP_ASYNC_CANCEL;
+  cancel->addr = key;
+
+  int error = 0;
+  if (submit_pending(error)) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Cancelling receiving failed: " << std::strerror(error);
+  }
+}
+
+void
+uring_engine::release_buffer(int buffer)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  io_uring_buf& entry =
+      ring_buffers(buffer_ring_)[buffer_ring_tail_ & (receive_buffers - 1)];
+  entry.addr = reinterpret_cast<std::uintptr_t>(
+      &receive_buffers_[static_cast<std::size_t>(buffer) * receive_buffer_size]);
+  entry.len = static_cast<boost::uint32_t>(receive_buffer_size);
+  entry.bid = static_cast<boost::uint16_t>(buffer);
+  __atomic_store_n(&ring_buffers(buffer_ring_)[0].resv, ++buffer_ring_tail_,
+                   __ATOMIC_RELEASE);
+}
+
+void
+uring_engine::cancel(int fd)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  io_uring_sqe* cancel = get_sqe();
+  cancel->opcode = IORING_OP_ASYNC_CANCEL;
+  cancel->fd = fd;
+  cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+
+  // Its completion tells nothing, requests of the descriptor complete
+  int error = 0;
+  if (submit_pending(error)) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Cancelling requests failed: " << std::strerror(error);
+  }
+}
+
+uring_engine::multishot*
+uring_engine::take_multishot(int fd)
+{
+  multishot* ms;
+  if (!free_multishots_.empty()) {
+    ms = multishots_[free_multishots_.back()];
+    free_multishots_.pop_back();
+  }
+  else {
+    ms = new multishot;
+    ms->slot = static_cast<boost::uint32_t>(multishots_.size());
+    ms->generation = 0;
+    multishots_.push_back(ms);
+  }
+
+  // Keys of ended requests taking the entry before match no request
+  ++ms->generation;
+  ms->fd = fd;
+  return ms;
+}
+
+uring_engine::multishot*
+uring_engine::find_multishot(boost::uint64_t key)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  multishot* ms = multishots_[static_cast<std::size_t>(key >> 34)];
+  BOOST_ASSERT(multishot_key(ms) == key);
+  return ms;
+}
+
+void
+uring_engine::release_multishot(multishot* ms)
+{
+  ms->on_accept.clear();
+  ms->on_receive.clear();
+
+  boost::mutex::scoped_lock lock(mutex_);
+  free_multishots_.push_back(ms->slot);
+}
+
+boost::uint64_t
+uring_engine::multishot_key(multishot const* ms)
+{
+  return (boost::uint64_t(ms->slot) << 34) |
+         (boost::uint64_t(ms->generation) << 2) | multishot_request;
+}
+
+void
+uring_engine::add_in_flight()
+{
+  ++in_flight_;
+  if (!waiting_.exchange(true)) {
+    io_service_.post(boost::bind(&uring_engine::start_wait, this));
+  }
+}
+
+io_uring_sqe*
+uring_engine::get_sqe()
+{
+  // Entries are passed to the kernel right after they are prepared,
+  // so the queue is empty here
+  unsigned index = (*sq_tail_ + sq_pending_++) & sq_mask_;
+  sq_array_[index] = index;
+  io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void
+uring_engine::prepare_send(operation* op)
+{
+  io_uring_sqe* send = get_sqe();
+  send->opcode = IORING_OP_SEND;
+  send->fd = op->socket;
+  send->addr = reinterpret_cast<std::uintptr_t>(op->data + op->sent);
+  send->len = static_cast<boost::uint32_t>(op->size - op->sent);
+  send->msg_flags = MSG_NOSIGNAL;
+  send->user_data = reinterpret_cast<std::uintptr_t>(op) | send_request;
+}
+
+void
+uring_engine::prepare_poll(operation* op)
+{
+  io_uring_sqe* poll = get_sqe();
+  poll->opcode = IORING_OP_POLL_ADD;
+  poll->flags = IOSQE_IO_LINK;
+  poll->fd = op->socket;
+  boost::uint32_t events = POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+  // The mask is read as two swapped halves
+  events = (events << 16) | (events >> 16);
+#endif
+  poll->poll32_events = events;
+  poll->user_data = reinterpret_cast<std::uintptr_t>(op) | poll_request;
+}
+
+void
+uring_engine::submit_locked(operation* op)
+{
+  // Completions may be reaped by another thread before entering returns
+  unsigned count = sq_pending_;
+  op->pending += count;
+
+  int error = 0;
+  if (unsigned refused = submit_pending(error)) {
+    op->submit_error = error;
+    if (!(op->pending -= refused)) {
+      io_service_.post(boost::bind(&uring_engine::finish, this, op));
+    }
+  }
+}
+
+void
+uring_engine::submit_multishot(multishot* ms)
+{
+  int error = 0;
+  if (submit_pending(error)) {
+    io_service_.post(boost::bind(&uring_engine::fail_multishot, this, ms,
+                                 error));
+  }
+}
+
+void
+uring_engine::fail_multishot(multishot* ms, int error)
+{
+  boost::system::error_code ec = make_error(error);
+  if (ms->on_accept) {
+    ms->on_accept(ec, -1, false);
+  }
+  else {
+    ms->on_receive(ec, 0, 0, -1, false);
+  }
+  release_multishot(ms);
+  --in_flight_;
+}
+
+unsigned
+uring_engine::submit_pending(int& error)
+{
+  unsigned count = sq_pending_;
+  sq_pending_ = 0;
+
+  unsigned tail = *sq_tail_ + count;
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  unsigned submitted = 0;
+  while (submitted < count) {
+    int n = io_uring_enter(ring_fd_, count - submitted, 0, 0);
+    if (n > 0) {
+      submitted += static_cast<unsigned>(n);
+    }
+    else if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    else {
+      // Entries the kernel has not taken are dropped
+      error = n < 0 ? errno : EBUSY;
+      __atomic_store_n(sq_tail_, __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE),
+                       __ATOMIC_RELEASE);
+      break;
+    }
+  }
+  return count - submitted;
+}
+
+void
+uring_engine::start_wait()
+{
+  event_.async_read_some(boost::asio::buffer(&event_value_, sizeof(event_value_)),
+      boost::bind(&uring_engine::handle_event, this, _1));
+}
+
+void
+uring_engine::handle_event(const boost::system::error_code& ec)
+{
+  if (ec) {
+    if (ec != boost::asio::error::operation_aborted) {
+      BOOST_LOG_SEV(log_, logging::error)
+        << "Waiting for completions failed: " << ec.message()
+        << " (" << ec.value() << ")";
+    }
+    waiting_ = false;
+    return;
+  }
+
+  for (;;) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      io_uring_cqe const& cqe = cqes_[head & cq_mask_];
+      boost::uint64_t user_data = cqe.user_data;
+      int result = cqe.res;
+      unsigned flags = cqe.flags;
+      __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+
+      if (!user_data) {
+        // Cancelling is done
+        continue;
+      }
+
+      request_kind kind = static_cast<request_kind>(
+          user_data & request_kind_mask);
+      if (kind == multishot_request) {
+        handle_multishot(find_multishot(user_data), result, flags);
+      }
+      else {
+        void* request = reinterpret_cast<void*>(static_cast<std::uintptr_t>(
+            user_data & ~boost::uint64_t(request_kind_mask)));
+        handle_completion(static_cast<operation*>(request), kind, result);
+      }
+    }
+
+    // Completions kept by the kernel on overflow are flushed by entering
+    if (!(__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) {
+      break;
+    }
+    io_uring_enter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS);
+  }
+
+  if (stopping_) {
+    // Requests submitted meanwhile restart waiting themselves
+    waiting_ = false;
+    if (!in_flight_ || waiting_.exchange(true)) {
+      return;
+    }
+  }
+
+  start_wait();
+}
+
+void
+uring_engine::handle_completion(operation* op, request_kind kind, int result)
+{
+  if (kind == read_request) {
+    if (result < 0) {
+      op->error = make_error(-result);
+    }
+    else if (static_cast<std::size_t>(result) < op->size) {
+      // The file was truncated, the linked send is cancelled
+      op->error = boost::asio::error::eof;
+    }
+  }
+  else if (kind == poll_request) {
+    // The socket is writable or failed, the linked send tells
+    if (result < 0 && result != -ECANCELED) {
+      op->error = make_error(-result);
+    }
+  }
+  else if (result > 0) {
+    op->sent += static_cast<std::size_t>(result);
+  }
+  else if (result == 0 || result == -EAGAIN) {
+    op->blocked = true;
+  }
+  else if (result != -ECANCELED || !op->error) {
+    op->error = make_error(-result);
+  }
+
+  if (--op->pending) {
+    return;
+  }
+
+  if (!op->error && op->sent < op->size) {
+    // The rest of a short send, the chunk and its buffer are kept
+    // while a full socket is waited for
+    boost::mutex::scoped_lock lock(mutex_);
+    if (op->blocked) {
+      op->blocked = false;
+      prepare_poll(op);
+    }
+    prepare_send(op);
+    submit_locked(op);
+    return;
+  }
+
+  finish(op);
+}
+
+void
+uring_engine::handle_multishot(multishot* ms, int result, unsigned flags)
+{
+  bool more = (flags & IORING_CQE_F_MORE) != 0;
+  boost::system::error_code ec;
+  if (result < 0) {
+    ec = make_error(-result);
+  }
+
+  if (ms->on_accept) {
+    ms->on_accept(ec, result < 0 ? -1 : result, more);
+  }
+  else {
+    const char* data = 0;
+    std::size_t size = 0;
+    int buffer = -1;
+    if (flags & IORING_CQE_F_BUFFER) {
+      buffer = static_cast<int>(flags >> IORING_CQE_BUFFER_SHIFT);
+      data = &receive_buffers_[static_cast<std::size_t>(buffer) *
+                               receive_buffer_size];
+      size = result > 0 ? static_cast<std::size_t>(result) : 0;
+    }
+    if (result == 0) {
+      ec = boost::asio::error::eof;
+    }
+    ms->on_receive(ec, data, size, buffer, more);
+  }
+
+  if (!more) {
+    release_multishot(ms);
+    --in_flight_;
+  }
+}
+
+void
+uring_engine::finish(operation* op)
+{
+  boost::system::error_code ec = op->error;
+  if (!ec && op->submit_error) {
+    ec = make_error(op->submit_error);
+  }
+  std::size_t sent = op->sent;
+
+  send_handler handler;
+  handler.swap(op->handler);
+
+  if (op->buffer_index >= 0) {
+    boost::mutex::scoped_lock lock(mutex_);
+    free_buffers_.push_back(op->buffer_index);
+  }
+  delete op;
+  --in_flight_;
+
+  handler(ec, sent);
+}
+
+} // namespace eiptnd
+
+#endif // ENABLE_IO_URING
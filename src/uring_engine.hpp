@@ -0,0 +1,246 @@
+#ifndef URING_ENGINE_HPP
+#define URING_ENGINE_HPP
+
+#include "log.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  ifdef IORING_RECV_MULTISHOT
+/// Connections may be accepted, read and sent file bodies through
+/// io_uring(7) instead of the reactor and sendfile(2).
+#   define ENABLE_IO_URING
+#  endif
+# endif
+#endif
+
+#ifdef ENABLE_IO_URING
+
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+namespace eiptnd {
+
+/// Serves sockets through an io_uring instance.
+///
+/// Listeners are accepted from and connections are received from by
+/// multishot requests: a single request keeps completing as connections
+/// and data arrive, without being rearmed. Data is received into buffers
+/// provided to the kernel by a ring, and a buffer is picked only when
+/// the data is there, so idle connections hold no memory.
+///
+/// A chunk of a file is read into a registered buffer and sent by
+/// a request linked to the read, so one system call submits both.
+/// Reads of files missing the page cache are done by kernel workers
+/// and do not stall threads of the io_service.
+///
+/// Completions are signalled by an eventfd watched by the io_service
+/// and their handlers are called by its threads.
+class uring_engine
+  : private boost::noncopyable
+{
+public:
+  /// Receives the count of bytes sent.
+  typedef boost::function<void(const boost::system::error_code&, std::size_t)>
+      send_handler;
+
+  /// Receives an accepted socket. `more` is false for the last call,
+  /// accepting has to be started again to go on.
+  typedef boost::function<void(const boost::system::error_code&, int, bool)>
+      accept_handler;
+
+  /// Receives data in the provided `buffer`, it must be passed to
+  /// release_buffer() once the data is consumed. The end of the stream
+  /// is reported as `eof`. `more` is false for the last call, receiving
+  /// has to be started again to go on, e.g. after `no_buffer_space`.
+  typedef boost::function<void(const boost::system::error_code&,
+                               const char*, std::size_t, int, bool)>
+      receive_handler;
+
+  /// Set up a ring with buffers of `buffer_size` bytes for files. It
+  /// throws system_error if the kernel lacks io_uring or a request it
+  /// needs, multishot receiving in particular (Linux 6.0).
+  uring_engine(boost::asio::io_service& io_service, std::size_t buffer_size);
+  ~uring_engine();
+
+  /// Start waiting for completions.
+  void start();
+
+  /// Stop waiting for completions once requests in flight are done.
+  void stop();
+
+  /// Send at most one buffer of the `count` bytes of file `fd` starting
+  /// from `offset`. The descriptors must stay open until `handler` is
+  /// called, it is called by a thread of the io_service. A socket which
+  /// refuses data is waited for, the chunk is sent whole or fails.
+  void async_send_file(int socket, int fd, boost::uint64_t offset,
+                       boost::uint64_t count, send_handler handler);
+
+  /// Accept connections of the non-blocking `listener` until it fails
+  /// or is cancelled. Handlers are called by threads of the io_service.
+  void async_accept(int listener, accept_handler handler);
+
+  /// Receive data of `socket` until the end of the stream, a failure
+  /// or cancelling. Returns the key cancel_receive() takes.
+  boost::uint64_t async_receive(int socket, receive_handler handler);
+
+  /// Stop receiving started by async_receive(), while other requests
+  /// of the socket go on. The key of a request which has ended matches
+  /// no request.
+  void cancel_receive(boost::uint64_t key);
+
+  /// Return a buffer of received data to the kernel.
+  void release_buffer(int buffer);
+
+  /// Cancel requests of the descriptor, their handlers are called with
+  /// `operation_aborted`. It is called before the descriptor is closed,
+  /// the requests are not ended by closing it.
+  void cancel(int fd);
+
+  /// Bytes sent by a single request at most.
+  std::size_t buffer_size() const
+  { return buffer_size_; }
+
+private:
+  struct operation;
+  struct multishot;
+
+  /// Requests are told by the lowest bits of their data, operations
+  /// are aligned. Data of multishot requests is their key: the entry
+  /// in the table and its generation. Data of cancel requests is zero.
+  enum request_kind
+  {
+    read_request = 0,
+    send_request = 1,
+    poll_request = 2,
+    multishot_request = 3,
+    request_kind_mask = 3
+  };
+
+  void setup();
+  void setup_receive_buffers();
+  void release();
+
+  /// Check multishot receiving and cancelling by descriptor on a socket
+  /// pair, the kernel accepts both of them before it supports them.
+  void probe_multishot();
+
+  /// Wait for a completion in setup, before completions are handled.
+  void wait_completion(io_uring_cqe& cqe);
+
+  /// Count a new request, so completions are waited for.
+  void add_in_flight();
+
+  /// Take a submission entry, the mutex must be locked.
+  io_uring_sqe* get_sqe();
+
+  /// Queue sending of the rest of the chunk.
+  void prepare_send(operation* op);
+
+  /// Queue waiting for the socket to become writable, the request
+  /// queued next is linked to it.
+  void prepare_poll(operation* op);
+
+  /// Pass prepared entries to the kernel, the mutex must be locked.
+  /// Returns the count of refused entries, `error` tells why.
+  unsigned submit_pending(int& error);
+
+  /// Pass prepared entries of the operation to the kernel, the mutex
+  /// must be locked. Refused entries fail the operation.
+  void submit_locked(operation* op);
+
+  /// Take an entry of the table for a request of `fd`, the mutex must
+  /// be locked.
+  multishot* take_multishot(int fd);
+
+  /// Entry of the request completed with the `key`.
+  multishot* find_multishot(boost::uint64_t key);
+
+  /// Return the entry of an ended request to the table.
+  void release_multishot(multishot* ms);
+
+  static boost::uint64_t multishot_key(multishot const* ms);
+
+  /// Submit the prepared multishot request, the mutex must be locked.
+  void submit_multishot(multishot* ms);
+
+  void start_wait();
+  void handle_event(const boost::system::error_code& ec);
+  void handle_completion(operation* op, request_kind kind, int result);
+  void handle_multishot(multishot* ms, int result, unsigned flags);
+
+  /// Call the handler of a multishot request which was not submitted.
+  void fail_multishot(multishot* ms, int error);
+
+  /// Release the operation and call its handler.
+  void finish(operation* op);
+
+  /// Logger instance and attributes.
+  logging::logger log_;
+
+  boost::asio::io_service& io_service_;
+
+  /// Descriptor of the ring and its mapped queues.
+  int ring_fd_;
+  void* sq_map_;
+  std::size_t sq_map_size_;
+  void* cq_map_;
+  std::size_t cq_map_size_;
+  io_uring_sqe* sqes_;
+  std::size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_flags_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+
+  /// Entries prepared and not passed to the kernel yet.
+  unsigned sq_pending_;
+
+  /// Guards the submission queue and the buffers, submitted by any
+  /// thread. Completions are reaped by one handler at a time.
+  boost::mutex mutex_;
+
+  /// Buffers registered with the ring. Requests take a buffer of their
+  /// own when all of them are busy or the registration was refused.
+  std::size_t buffer_size_;
+  std::vector<char> buffers_;
+  std::vector<int> free_buffers_;
+
+  /// Buffers provided to the kernel for received data and the ring
+  /// they are provided by.
+  std::vector<char> receive_buffers_;
+  void* buffer_ring_;
+  unsigned short buffer_ring_tail_;
+
+  /// Multishot requests by their keys, entries are reused with a new
+  /// generation so keys of ended requests stay unique.
+  std::vector<multishot*> multishots_;
+  std::vector<boost::uint32_t> free_multishots_;
+
+  /// The eventfd notified of completions.
+  boost::asio::posix::stream_descriptor event_;
+  boost::uint64_t event_value_;
+
+  boost::atomic<std::size_t> in_flight_;
+  boost::atomic<bool> waiting_;
+  boost::atomic<bool> stopping_;
+};
+
+} // namespace eiptnd
+
+#endif // ENABLE_IO_URING
+
+#endif // URING_ENGINE_HPP
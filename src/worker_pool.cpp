@@ -0,0 +1,62 @@
+#include "worker_pool.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+
+
+namespace eiptnd {
+
+worker_pool::worker_pool(std::size_t threads, std::size_t max_pending)
+  : log_(boost::log::keywords::channel = "worker-pool")
+  , work_(new boost::asio::io_service::work(io_service_))
+  , max_pending_(max_pending)
+  , pending_(0)
+  , rejected_(0)
+{
+  for (std::size_t i = 0; i < threads; ++i) {
+    threads_.create_thread(
+        boost::bind(&boost::asio::io_service::run, &io_service_));
+  }
+}
+
+worker_pool::~worker_pool()
+{
+  stop();
+}
+
+bool
+worker_pool::post(boost::function<void()> job)
+{
+  if (pending_.fetch_add(1, boost::memory_order_relaxed) >= max_pending_) {
+    pending_.fetch_sub(1, boost::memory_order_relaxed);
+    rejected_.fetch_add(1, boost::memory_order_relaxed);
+    return false;
+  }
+
+  io_service_.post(boost::bind(&worker_pool::run_job, this, job));
+  return true;
+}
+
+void
+worker_pool::run_job(boost::function<void()> const& job)
+{
+  try {
+    job();
+  }
+  catch (...) {
+    BOOST_LOG_SEV(log_, logging::error)
+      << "Exception in a job: "
+      << boost::current_exception_diagnostic_information();
+  }
+  pending_.fetch_sub(1, boost::memory_order_relaxed);
+}
+
+void
+worker_pool::stop()
+{
+  work_.reset();
+  io_service_.stop();
+  threads_.join_all();
+}
+
+} // namespace eiptnd
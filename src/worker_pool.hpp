@@ -0,0 +1,58 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include "log.hpp"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+
+namespace eiptnd {
+
+/// Threads running CPU bound jobs (e.g. compression), so io_service
+/// threads serving connections are never blocked by them. Jobs report
+/// their results by posting handlers back to connections.
+class worker_pool
+  : private boost::noncopyable
+{
+public:
+  /// At most `max_pending` jobs are queued or running at a time.
+  worker_pool(std::size_t threads, std::size_t max_pending);
+  ~worker_pool();
+
+  /// Queue a job, false if the pool is overloaded and the caller
+  /// should do without it.
+  bool post(boost::function<void()> job);
+
+  /// Complete running jobs, drop queued ones and join the threads.
+  void stop();
+
+  std::size_t pending() const
+  { return pending_.load(boost::memory_order_relaxed); }
+
+  /// Count of jobs refused because of the overload.
+  std::size_t rejected() const
+  { return rejected_.load(boost::memory_order_relaxed); }
+
+private:
+  void run_job(boost::function<void()> const& job);
+
+  /// Logger instance and attributes.
+  logging::logger log_;
+
+  boost::asio::io_service io_service_;
+  boost::scoped_ptr<boost::asio::io_service::work> work_;
+  boost::thread_group threads_;
+
+  std::size_t max_pending_;
+  boost::atomic<std::size_t> pending_;
+  boost::atomic<std::size_t> rejected_;
+};
+
+} // namespace eiptnd
+
+#endif // WORKER_POOL_HPP
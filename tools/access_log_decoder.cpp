@@ -0,0 +1,202 @@
+/// Converts binary access log files to Common Log Format or JSON lines.
+///
+/// Usage: access-log-decoder [--json] file...
+
+#include "../src/access_log_format.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace eiptnd;
+
+namespace {
+
+std::string format_address(access_record const& record)
+{
+  char buf[64];
+  if (!(record.flags & access_record::ipv6_flag)) {
+    std::snprintf(buf, sizeof(buf), "%u.%u.%u.%u",
+                  record.address[0], record.address[1],
+                  record.address[2], record.address[3]);
+    return buf;
+  }
+
+  // Groups are not compressed, but it is still a valid notation
+  std::string result;
+  for (int i = 0; i < 16; i += 2) {
+    std::snprintf(buf, sizeof(buf), i ? ":%x" : "%x",
+                  (record.address[i] << 8) | record.address[i + 1]);
+    result += buf;
+  }
+  return result;
+}
+
+std::tm utc_time(boost::uint64_t timestamp)
+{
+  std::time_t seconds = static_cast<std::time_t>(timestamp / 1000000000u);
+  return *std::gmtime(&seconds);
+}
+
+std::string json_escape(std::string const& value)
+{
+  std::string result;
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += static_cast<char>(c);
+    }
+    else if (c < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      result += buf;
+    }
+    else {
+      result += static_cast<char>(c);
+    }
+  }
+  return result;
+}
+
+void print_clf(access_record const& record, std::string const& url)
+{
+  std::tm tm = utc_time(record.timestamp);
+  char date[64];
+  std::strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+
+  std::cout << format_address(record) << " - - [" << date << "] \""
+            << access_method_name(record.method) << ' ' << url << ' '
+            << (record.flags & access_record::http11_flag ? "HTTP/1.1"
+                                                          : "HTTP/1.0")
+            << "\" " << record.status << ' ' << record.bytes_sent << '\n';
+}
+
+void print_json(access_record const& record, std::string const& url)
+{
+  std::tm tm = utc_time(record.timestamp);
+  char date[64];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+  char fraction[16];
+  std::snprintf(fraction, sizeof(fraction), ".%09lluZ",
+                static_cast<unsigned long long>(record.timestamp % 1000000000u));
+
+  std::cout << "{\"time\":\"" << date << fraction << "\""
+            << ",\"remote_addr\":\"" << format_address(record) << "\""
+            << ",\"remote_port\":" << record.port
+            << ",\"method\":\"" << access_method_name(record.method) << "\""
+            << ",\"url\":\"" << json_escape(url) << "\""
+            << ",\"protocol\":\""
+            << (record.flags & access_record::http11_flag ? "HTTP/1.1"
+                                                          : "HTTP/1.0")
+            << "\",\"status\":" << record.status
+            << ",\"bytes_sent\":" << record.bytes_sent
+            << ",\"latency_ns\":" << record.latency << "}\n";
+}
+
+bool decode(char const* file_name, bool json)
+{
+  std::ifstream f(file_name, std::ios::binary);
+  if (!f.is_open()) {
+    std::cerr << file_name << ": unable to open" << std::endl;
+    return false;
+  }
+  std::vector<char> data((std::istreambuf_iterator<char>(f)),
+                         std::istreambuf_iterator<char>());
+
+  access_file_header file_header;
+  if (data.size() < sizeof(file_header)) {
+    std::cerr << file_name << ": not an access log" << std::endl;
+    return false;
+  }
+  std::memcpy(&file_header, data.data(), sizeof(file_header));
+  if (std::memcmp(file_header.magic, ACCESS_LOG_MAGIC,
+                  sizeof(file_header.magic)) != 0 ||
+      file_header.version != access_file_header::current_version ||
+      file_header.record_size != sizeof(access_record)) {
+    std::cerr << file_name << ": unsupported format" << std::endl;
+    return false;
+  }
+
+  std::size_t pos = sizeof(file_header);
+  while (data.size() - pos >= sizeof(access_block_header)) {
+    access_block_header block;
+    std::memcpy(&block, &data[pos], sizeof(block));
+    if (!block.records_count) {
+      break;
+    }
+
+    std::size_t records_size = block.records_count * sizeof(access_record);
+    std::size_t size = sizeof(block) + records_size + block.strings_size;
+    if (data.size() - pos < size) {
+      std::cerr << file_name << ": truncated block at " << pos << std::endl;
+      return false;
+    }
+
+    const char* records = &data[pos + sizeof(block)];
+    const char* strings = records + records_size;
+    for (std::size_t i = 0; i < block.records_count; ++i) {
+      access_record record;
+      std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+
+      std::string url;
+      if (static_cast<std::size_t>(record.url_offset) + record.url_size
+            <= block.strings_size) {
+        url.assign(strings + record.url_offset, record.url_size);
+      }
+
+      if (json) {
+        print_json(record, url);
+      }
+      else {
+        print_clf(record, url);
+      }
+    }
+
+    pos += size + access_block_padding(size);
+    if (pos > data.size()) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  bool json = false;
+  std::vector<char const*> files;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+    }
+    else if (std::strcmp(argv[i], "--help") == 0) {
+      std::cout << "Usage: " << argv[0] << " [--json] file..." << std::endl;
+      return EXIT_SUCCESS;
+    }
+    else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (files.empty()) {
+    std::cerr << "Usage: " << argv[0] << " [--json] file..." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int result = EXIT_SUCCESS;
+  for (char const* file_name : files) {
+    if (!decode(file_name, json)) {
+      result = EXIT_FAILURE;
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Cost of logging in the request path: keep-alive requests per second of a
+# build logging at runtime levels against a build with the logging compiled
+# out. Every configuration is run RUNS times, the median rate is reported.
+#
+# Usage: tools/compare_logging.sh build_dir silent_build_dir webroot path
+#                                 [server options]
+#
+# The builds are configured the same way except for the severity, e.g.:
+#   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release
+#   cmake -S . -B build-silent -DCMAKE_BUILD_TYPE=Release \
+#         -DLOG_MIN_SEVERITY=silence
+#
+# Environment:
+#   PORT         port of the server (8090)
+#   DURATION     seconds of every run (5)
+#   CONNECTIONS  concurrent connections of http-bench (4)
+#   RUNS         runs of every configuration (3)
+#   LEVELS       runtime levels of build_dir to measure (flood normal)
+
+set -e
+
+if [ $# -lt 4 ]; then
+  sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+  exit 1
+fi
+
+build=$1
+silent_build=$2
+webroot=$3
+path=$4
+shift 4
+
+port=${PORT:-8090}
+duration=${DURATION:-5}
+connections=${CONNECTIONS:-4}
+runs=${RUNS:-3}
+levels=${LEVELS:-flood normal}
+
+# Median responses per second of a server started with given arguments.
+# It runs in a subshell, which stops the server when it is interrupted.
+measure() {
+  binary=$1
+  shift
+  server=
+  trap '[ -z "$server" ] || kill $server 2>/dev/null' EXIT
+  rates=
+  i=0
+  while [ $i -lt "$runs" ]; do
+    "$binary" -p "$port" -d "$webroot" --keepalive-requests=1000000000 \
+      "$@" > /dev/null 2>&1 &
+    server=$!
+    sleep 1
+    "$build/http-bench" --connections "$connections" --duration 1 \
+      127.0.0.1 "$port" "$path" > /dev/null || true
+    rate=$("$build/http-bench" --connections "$connections" \
+      --duration "$duration" 127.0.0.1 "$port" "$path" |
+      awk '/responses\/s/ { print $1 }') || true
+    kill $server
+    wait $server 2>/dev/null || true
+    server=
+    rates="$rates ${rate:-0}"
+    i=$((i + 1))
+  done
+  echo $rates | tr ' ' '\n' | sort -n | awk '
+    { rate[NR] = $1 }
+    END { print rate[int((NR + 1) / 2)] }'
+}
+
+baseline=$(measure "$silent_build/final" "$@")
+printf "%-24s %8s responses/s\n" "compiled out" "$baseline"
+for level in $levels; do
+  rate=$(measure "$build/final" --log-level=$level "$@")
+  echo "$rate $baseline" | awk -v level="--log-level=$level" '{
+    printf "%-24s %8s responses/s  %+.1f%%\n", level, $1,
+           $2 ? 100 * ($1 - $2) / $2 : 0
+  }'
+done
@@ -0,0 +1,125 @@
+#!/bin/sh
+# Heap allocations per request of the server, counted by libmalloc-count.so
+# over an http-bench run of keep-alive requests, or per connection with
+# CLOSE=1. Allocations of the start and of a warm-up run are excluded: the
+# counters are dumped and reset by SIGUSR2 right before and after the
+# measured run.
+#
+# Usage: tools/count_allocations.sh build_dir webroot path [server options]
+#
+# Environment:
+#   PORT         port of the server (8090)
+#   DURATION     seconds of the measured run (5)
+#   CONNECTIONS  concurrent connections of http-bench (4)
+#   CLOSE        send every request through a new connection (0), the hit
+#                rate of the connections pool over the run is reported too
+#   BACKTRACE    depth of call stacks to list allocation sites by (0). They
+#                are resolved by addr2line, so the build should have debug
+#                info (-DCMAKE_BUILD_TYPE=RelWithDebInfo). Sites are
+#                attributed to the first frame outside of the allocator,
+#                the ones of boost::asio are summed up separately.
+#
+# E.g. tools/count_allocations.sh build www /index.html --num-threads=4
+# or, comparing pooled connections with constructed ones:
+#      CLOSE=1 tools/count_allocations.sh build www /index.html
+#      CLOSE=1 tools/count_allocations.sh build www /index.html --pool-size=0
+
+set -e
+
+if [ $# -lt 3 ]; then
+  sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+  exit 1
+fi
+
+build=$1
+webroot=$2
+path=$3
+shift 3
+
+port=${PORT:-8090}
+duration=${DURATION:-5}
+connections=${CONNECTIONS:-4}
+backtrace=${BACKTRACE:-0}
+
+bench_options=
+unit=response
+if [ "${CLOSE:-0}" != 0 ]; then
+  bench_options=--close
+  unit=connection
+fi
+
+pool_counters() {
+  curl -s "http://127.0.0.1:$port/metrics" | awk '
+    /^eiptnd_connection_pool_hits_total / { hits = $2 }
+    /^eiptnd_connection_pool_misses_total / { misses = $2 }
+    END { print hits + 0, misses + 0 }'
+}
+
+output=$(mktemp)
+trap 'kill $server 2>/dev/null; rm -f "$output"' EXIT
+
+LD_PRELOAD=$build/libmalloc-count.so MALLOC_COUNT_OUTPUT=$output \
+MALLOC_COUNT_BACKTRACE=$backtrace \
+  "$build/final" --no-console --log-level=critical -p "$port" -d "$webroot" \
+  --keepalive-requests=1000000000 --metrics-url=/metrics "$@" &
+server=$!
+sleep 1
+
+"$build/http-bench" --connections "$connections" --duration 1 \
+  $bench_options 127.0.0.1 "$port" "$path" > /dev/null || true
+
+pool_before=$(pool_counters)
+kill -USR2 $server
+sleep 1
+: > "$output"
+
+result=$("$build/http-bench" --connections "$connections" \
+  --duration "$duration" $bench_options 127.0.0.1 "$port" "$path") || true
+kill -USR2 $server
+sleep 1
+
+echo "$result"
+responses=$(echo "$result" | awk '/responses,/ { print $1 }')
+awk -v responses="$responses" -v unit=$unit '/^malloc-count:/ {
+  print
+  printf "%.1f allocations, %.0f bytes per %s\n",
+         $2 / responses, $4 / responses, unit
+  exit
+}' "$output"
+
+if [ $unit = connection ]; then
+  echo "$pool_before $(pool_counters)" | awk '{
+    hits = $3 - $1; taken = hits + $4 - $2
+    printf "Connections pool hit rate %.1f%% (%d of %d)\n",
+           taken ? 100 * hits / taken : 0, hits, taken
+  }'
+fi
+
+[ "$backtrace" -gt 0 ] || exit 0
+
+# Resolve every site to the first frame which is not the allocator itself
+echo
+echo "Allocation sites per $unit:"
+asio=0
+while read -r count frames; do
+  case $count in ''|*[!0-9]*) continue ;; esac
+  caller=
+  for frame in $frames; do
+    module=${frame%+*}
+    [ -f "$module" ] || continue
+    name=$(addr2line -Cf -e "$module" "${frame##*+}" | head -n 1)
+    case $name in
+      '??'|operator\ new*|malloc|calloc|realloc|*allocator*|*new_allocator*) ;;
+      *) caller=$name; break ;;
+    esac
+  done
+  case $caller in boost::asio::*) asio=$((asio + count)) ;; esac
+  awk -v count="$count" -v responses="$responses" -v caller="${caller:-??}" \
+    'BEGIN { printf "%8.2f  %s\n", count / responses, caller }'
+done <<EOF
+$(sed -n '2,$p' "$output")
+EOF
+awk -v asio=$asio -v responses="$responses" \
+  -v unit=$unit 'BEGIN {
+    printf "%.2f allocations per %s from boost::asio\n", asio / responses, unit
+  }'
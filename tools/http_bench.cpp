@@ -0,0 +1,307 @@
+/// Load generator comparing I/O engines of the server. Every connection
+/// requests the same path over and over through a persistent connection,
+/// and the rate of responses and bytes is reported at the end. With
+/// --close every request is sent through a new connection instead.
+/// A connection closed by the server after a response (e.g. at its
+/// keep-alive limit) is opened again, failed ones are counted as errors
+/// and opened again after a pause.
+///
+/// Usage: http-bench [--connections N] [--duration sec] [--threads N]
+///                   [--close] host port path
+///
+/// E.g. run the server with --io-engine=asio and then with
+/// --io-engine=uring, and compare the results for a large file.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+struct totals
+{
+  std::atomic<unsigned long long> responses{0};
+  std::atomic<unsigned long long> bytes{0};
+  std::atomic<unsigned long long> errors{0};
+};
+
+/// A persistent connection sending the request after every response,
+/// or a series of connections sending a request each. The connection is
+/// opened again when the server closes it.
+class client
+  : public std::enable_shared_from_this<client>
+{
+public:
+  client(boost::asio::io_service& io_service,
+         boost::asio::ip::tcp::endpoint const& endpoint,
+         std::string const& request, bool reconnect,
+         clock_type::time_point deadline, totals& result)
+    : socket_(io_service)
+    , retry_timer_(io_service)
+    , endpoint_(endpoint)
+    , request_(request)
+    , reconnect_(reconnect)
+    , deadline_(deadline)
+    , result_(result)
+    , close_after_(false)
+    , responses_(0)
+    , body_left_(0)
+  {
+  }
+
+  void start()
+  {
+    close_after_ = false;
+    responses_ = 0;
+    socket_.async_connect(endpoint_,
+        boost::bind(&client::handle_connect, shared_from_this(), _1));
+  }
+
+private:
+  void handle_connect(const boost::system::error_code& ec)
+  {
+    if (ec) {
+      fail(ec);
+      return;
+    }
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    send_request();
+  }
+
+  void send_request()
+  {
+    if (clock_type::now() >= deadline_) {
+      boost::system::error_code ignored_ec;
+      socket_.close(ignored_ec);
+      return;
+    }
+    boost::asio::async_write(socket_, boost::asio::buffer(request_),
+        boost::bind(&client::handle_write, shared_from_this(), _1));
+  }
+
+  void handle_write(const boost::system::error_code& ec)
+  {
+    if (ec) {
+      fail(ec);
+      return;
+    }
+    boost::asio::async_read_until(socket_, header_, "\r\n\r\n",
+        boost::bind(&client::handle_header, shared_from_this(), _1, _2));
+  }
+
+  void handle_header(const boost::system::error_code& ec,
+                     std::size_t header_size)
+  {
+    if ((ec == boost::asio::error::eof ||
+         ec == boost::asio::error::connection_reset) &&
+        responses_ && !header_.size()) {
+      // The server has closed the persistent connection between responses,
+      // the request is sent again through a new one
+      restart();
+      return;
+    }
+    if (ec) {
+      fail(ec);
+      return;
+    }
+
+    std::string header(boost::asio::buffers_begin(header_.data()),
+                       boost::asio::buffers_begin(header_.data()) + header_size);
+    header_.consume(header_size);
+
+    if (header.compare(0, 9, "HTTP/1.1 ") != 0 || header[9] != '2') {
+      fail(boost::asio::error::invalid_argument);
+      return;
+    }
+
+    body_left_ = 0;
+    for (std::size_t pos = header.find("\r\n"); pos != std::string::npos;
+         pos = header.find("\r\n", pos + 2)) {
+      char const* field = header.c_str() + pos + 2;
+      if (strncasecmp(field, "Content-Length:", 15) == 0) {
+        body_left_ = std::strtoull(field + 15, 0, 10);
+      }
+      else if (strncasecmp(field, "Connection:", 11) == 0) {
+        field += 11;
+        field += std::strspn(field, " \t");
+        close_after_ = strncasecmp(field, "close", 5) == 0;
+      }
+    }
+    result_.bytes += header_size;
+
+    // A part of the body may be read along with the header
+    std::size_t buffered = std::min<std::size_t>(header_.size(), body_left_);
+    header_.consume(buffered);
+    body_left_ -= buffered;
+    result_.bytes += buffered;
+    read_body();
+  }
+
+  void read_body()
+  {
+    if (!body_left_) {
+      ++result_.responses;
+      ++responses_;
+      if (reconnect_ || close_after_) {
+        restart();
+        return;
+      }
+      send_request();
+      return;
+    }
+    socket_.async_read_some(boost::asio::buffer(body_, std::min<std::size_t>(
+                                sizeof(body_), body_left_)),
+        boost::bind(&client::handle_body, shared_from_this(), _1, _2));
+  }
+
+  void handle_body(const boost::system::error_code& ec,
+                   std::size_t bytes_transferred)
+  {
+    if (ec) {
+      fail(ec);
+      return;
+    }
+    body_left_ -= bytes_transferred;
+    result_.bytes += bytes_transferred;
+    read_body();
+  }
+
+  /// Open a new connection unless the time is over.
+  void restart()
+  {
+    boost::system::error_code ignored_ec;
+    socket_.close(ignored_ec);
+    header_.consume(header_.size());
+    if (clock_type::now() < deadline_) {
+      start();
+    }
+  }
+
+  void fail(const boost::system::error_code& ec)
+  {
+    if (clock_type::now() < deadline_) {
+      ++result_.errors;
+      std::cerr << "Connection failed: " << ec.message() << std::endl;
+
+      boost::system::error_code ignored_ec;
+      socket_.close(ignored_ec);
+      retry_timer_.expires_from_now(std::chrono::milliseconds(100));
+      retry_timer_.async_wait(
+          boost::bind(&client::restart, shared_from_this()));
+    }
+  }
+
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::steady_timer retry_timer_;
+  boost::asio::ip::tcp::endpoint endpoint_;
+  std::string const& request_;
+  bool reconnect_;
+  clock_type::time_point deadline_;
+  totals& result_;
+
+  /// The server closes the connection after the current response.
+  bool close_after_;
+
+  /// Responses received through the current connection.
+  unsigned long long responses_;
+
+  boost::asio::streambuf header_;
+  unsigned long long body_left_;
+  char body_[64 * 1024];
+};
+
+void usage(char const* name)
+{
+  std::cerr << "Usage: " << name << " [--connections N] [--duration sec] "
+               "[--threads N] [--close] host port path" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  std::size_t connections = 64;
+  long duration = 10;
+  std::size_t threads = 1;
+  bool close = false;
+  std::vector<char const*> args;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+      connections = std::strtoul(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+      duration = std::strtol(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = std::strtoul(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--close") == 0) {
+      close = true;
+    }
+    else if (std::strcmp(argv[i], "--help") == 0) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  if (args.size() != 3 || !connections || duration <= 0 || !threads) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  boost::asio::io_service io_service;
+  boost::asio::ip::tcp::endpoint endpoint;
+  try {
+    boost::asio::ip::tcp::resolver resolver(io_service);
+    endpoint = *resolver.resolve(
+        boost::asio::ip::tcp::resolver::query(args[0], args[1]));
+  }
+  catch (const boost::system::system_error& e) {
+    std::cerr << "Unable to resolve " << args[0] << ": " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string const request = std::string("GET ") + args[2] +
+      " HTTP/1.1\r\nHost: " + args[0] + "\r\n" +
+      (close ? "Connection: close\r\n\r\n" : "\r\n");
+
+  totals result;
+  clock_type::time_point started = clock_type::now();
+  clock_type::time_point deadline = started + std::chrono::seconds(duration);
+  for (std::size_t i = 0; i < connections; ++i) {
+    std::make_shared<client>(boost::ref(io_service), endpoint, request,
+                             close, deadline, boost::ref(result))->start();
+  }
+
+  boost::thread_group pool;
+  for (std::size_t i = 1; i < threads; ++i) {
+    pool.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+  }
+  io_service.run();
+  pool.join_all();
+
+  double seconds = std::chrono::duration<double>(
+      clock_type::now() - started).count();
+  std::printf("%llu responses, %llu errors in %.2f s\n",
+              result.responses.load(), result.errors.load(), seconds);
+  std::printf("%.0f responses/s, %.1f MiB/s\n",
+              result.responses.load() / seconds,
+              result.bytes.load() / seconds / (1024 * 1024));
+
+  return result.errors.load() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,356 @@
+/// Heap allocation counter to preload into the server (glibc only):
+///
+///   LD_PRELOAD=./libmalloc-count.so ./final ...
+///
+/// Calls of malloc(), calloc(), realloc() and the aligned variants are
+/// counted, operator new of libstdc++ goes through malloc(). The totals
+/// since the previous dump are written and reset on the signal and at
+/// exit, so a run is measured by signalling the server before and after
+/// it. Settings are taken from the environment:
+///
+///   MALLOC_COUNT_SIGNAL     signal number which dumps the counters (SIGUSR2)
+///   MALLOC_COUNT_OUTPUT     file the dumps are appended to (stderr)
+///   MALLOC_COUNT_BACKTRACE  depth of call stacks to account allocations by,
+///                           0 disables it (default), 16 at most
+///
+/// Call stacks are written as `module+0xoffset` frames, the offsets are
+/// file addresses which `addr2line -Cfe module` resolves.
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <unistd.h>
+
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* p, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+}
+
+namespace {
+
+enum kind { malloc_kind, calloc_kind, realloc_kind, aligned_kind, kinds_count };
+
+const char* const kind_names[kinds_count] = {
+  "malloc", "calloc", "realloc", "aligned"
+};
+
+std::atomic<unsigned long long> calls[kinds_count];
+std::atomic<unsigned long long> bytes;
+
+/// Allocations of the library itself and of the unwinder are not counted.
+__thread bool in_hook __attribute__((tls_model("initial-exec")));
+
+/// Table of call stacks with open addressing. Stacks are inserted under
+/// the lock, it is held shortly and only when backtraces are enabled.
+const std::size_t max_depth = 16;
+const std::size_t max_sites = 4096;
+const std::size_t max_probes = 64;
+
+struct site
+{
+  std::size_t depth;
+  void* frames[max_depth];
+  unsigned long long count;
+};
+
+site sites[max_sites];
+unsigned long long sites_dropped;
+std::atomic_flag sites_lock = ATOMIC_FLAG_INIT;
+
+std::size_t backtrace_depth;
+int output_fd = STDERR_FILENO;
+
+/// Dumps are written by a thread woken through the pipe, not in the
+/// signal handler where formatting and dladdr() are not safe.
+int wakeup_pipe[2] = { -1, -1 };
+
+__attribute__((noinline))
+void record_site()
+{
+  // Frames of this function and of the hook are skipped
+  void* frames[max_depth + 2];
+  int n = backtrace(frames, static_cast<int>(backtrace_depth + 2));
+  if (n <= 2) {
+    return;
+  }
+  std::size_t depth = static_cast<std::size_t>(n) - 2;
+
+  std::size_t hash = depth;
+  for (std::size_t i = 0; i < depth; ++i) {
+    hash = hash * 31 + reinterpret_cast<std::size_t>(frames[i + 2]);
+  }
+
+  while (sites_lock.test_and_set(std::memory_order_acquire)) {
+  }
+  std::size_t idx = hash % max_sites;
+  for (std::size_t probe = 0; probe < max_probes; ++probe) {
+    site& s = sites[(idx + probe) % max_sites];
+    if (!s.count) {
+      s.depth = depth;
+      std::memcpy(s.frames, frames + 2, depth * sizeof(void*));
+      s.count = 1;
+      break;
+    }
+    if (s.depth == depth &&
+        std::memcmp(s.frames, frames + 2, depth * sizeof(void*)) == 0) {
+      ++s.count;
+      break;
+    }
+    if (probe + 1 == max_probes) {
+      ++sites_dropped;
+    }
+  }
+  sites_lock.clear(std::memory_order_release);
+}
+
+inline void count(kind k, std::size_t size)
+{
+  if (in_hook) {
+    return;
+  }
+  calls[k].fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  if (backtrace_depth) {
+    in_hook = true;
+    record_site();
+    in_hook = false;
+  }
+}
+
+void write_all(const char* data, std::size_t size)
+{
+  while (size) {
+    ssize_t written = ::write(output_fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+}
+
+/// Append a frame as the module and the file address in it.
+int format_frame(char* buf, std::size_t size, void* frame)
+{
+  // Return addresses point past the call, the call itself is resolved
+  char* addr = static_cast<char*>(frame) - 1;
+  Dl_info info;
+  link_map* map = 0;
+  if (dladdr1(addr, &info, reinterpret_cast<void**>(&map), RTLD_DL_LINKMAP)
+      && map && info.dli_fname && *info.dli_fname) {
+    return std::snprintf(buf, size, " %s+%#lx", info.dli_fname,
+        static_cast<unsigned long>(addr - reinterpret_cast<char*>(map->l_addr)));
+  }
+  return std::snprintf(buf, size, " %p", static_cast<void*>(addr));
+}
+
+bool more_frequent(site const* a, site const* b)
+{
+  return a->count > b->count;
+}
+
+/// Write and reset the counters.
+void dump()
+{
+  unsigned long long counts[kinds_count];
+  unsigned long long total = 0;
+  for (std::size_t k = 0; k < kinds_count; ++k) {
+    counts[k] = calls[k].exchange(0);
+    total += counts[k];
+  }
+  unsigned long long total_bytes = bytes.exchange(0);
+
+  char line[4096];
+  int len = std::snprintf(line, sizeof(line),
+      "malloc-count: %llu allocations, %llu bytes (", total, total_bytes);
+  for (std::size_t k = 0; k < kinds_count; ++k) {
+    len += std::snprintf(line + len, sizeof(line) - len, "%s%s %llu",
+                         k ? ", " : "", kind_names[k], counts[k]);
+  }
+  len += std::snprintf(line + len, sizeof(line) - len, ")\n");
+  write_all(line, static_cast<std::size_t>(len));
+
+  if (!backtrace_depth) {
+    return;
+  }
+
+  // Sites are sorted by count in a copy, so allocating threads wait
+  // for the lock only while it is taken
+  static site snapshot[max_sites];
+  static site* order[max_sites];
+  while (sites_lock.test_and_set(std::memory_order_acquire)) {
+  }
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < max_sites; ++i) {
+    if (sites[i].count) {
+      snapshot[n] = sites[i];
+      order[n] = &snapshot[n];
+      ++n;
+    }
+  }
+  unsigned long long dropped = sites_dropped;
+  std::memset(sites, 0, sizeof(sites));
+  sites_dropped = 0;
+  sites_lock.clear(std::memory_order_release);
+
+  std::sort(order, order + n, more_frequent);
+  for (std::size_t i = 0; i < n; ++i) {
+    len = std::snprintf(line, sizeof(line), "%12llu", order[i]->count);
+    for (std::size_t f = 0; f < order[i]->depth; ++f) {
+      if (static_cast<std::size_t>(len) >= sizeof(line) - 1) {
+        break;
+      }
+      len += format_frame(line + len, sizeof(line) - len, order[i]->frames[f]);
+    }
+    len = std::min<int>(len, static_cast<int>(sizeof(line)) - 2);
+    line[len++] = '\n';
+    write_all(line, static_cast<std::size_t>(len));
+  }
+  if (dropped) {
+    len = std::snprintf(line, sizeof(line),
+                        "%12llu allocations from other stacks\n", dropped);
+    write_all(line, static_cast<std::size_t>(len));
+  }
+}
+
+void handle_signal(int)
+{
+  int saved_errno = errno;
+  char c = 0;
+  if (::write(wakeup_pipe[1], &c, 1) < 0) {
+    // Nothing to do, a dump is pending already if the pipe is full
+  }
+  errno = saved_errno;
+}
+
+void* dump_thread(void*)
+{
+  in_hook = true;
+  for (;;) {
+    char c;
+    ssize_t n = ::read(wakeup_pipe[0], &c, 1);
+    if (n > 0) {
+      dump();
+    }
+    else if (n < 0 && errno != EINTR) {
+      return 0;
+    }
+  }
+}
+
+struct initializer
+{
+  initializer()
+  {
+    in_hook = true;
+
+    if (const char* depth = std::getenv("MALLOC_COUNT_BACKTRACE")) {
+      backtrace_depth = std::min<std::size_t>(
+          std::strtoul(depth, 0, 10), max_depth);
+      // The unwinder is loaded on the first call, it allocates
+      void* frame;
+      backtrace(&frame, 1);
+    }
+
+    if (const char* path = std::getenv("MALLOC_COUNT_OUTPUT")) {
+      int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (fd >= 0) {
+        output_fd = fd;
+      }
+    }
+
+    int signo = SIGUSR2;
+    if (const char* s = std::getenv("MALLOC_COUNT_SIGNAL")) {
+      signo = std::atoi(s);
+    }
+    pthread_t thread;
+    if (::pipe2(wakeup_pipe, O_CLOEXEC) == 0 &&
+        pthread_create(&thread, 0, &dump_thread, 0) == 0) {
+      pthread_detach(thread);
+      struct sigaction action;
+      std::memset(&action, 0, sizeof(action));
+      action.sa_handler = &handle_signal;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      sigaction(signo, &action, 0);
+    }
+
+    in_hook = false;
+  }
+
+  ~initializer()
+  {
+    in_hook = true;
+    dump();
+  }
+} init;
+
+} // namespace
+
+extern "C" {
+
+void* malloc(std::size_t size)
+{
+  count(malloc_kind, size);
+  return __libc_malloc(size);
+}
+
+void* calloc(std::size_t n, std::size_t size)
+{
+  count(calloc_kind, n * size);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, std::size_t size)
+{
+  count(realloc_kind, size);
+  return __libc_realloc(p, size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size)
+{
+  count(aligned_kind, size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size)
+{
+  count(aligned_kind, size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** p, std::size_t alignment, std::size_t size)
+{
+  if (!alignment || (alignment & (alignment - 1)) ||
+      alignment % sizeof(void*)) {
+    return EINVAL;
+  }
+  count(aligned_kind, size);
+  void* result = __libc_memalign(alignment, size);
+  if (!result) {
+    return ENOMEM;
+  }
+  *p = result;
+  return 0;
+}
+
+} // extern "C"
@@ -0,0 +1,134 @@
+/// Throughput of the request parser. Every sample is parsed as the server
+/// does it: request by request through the whole buffer, with the parser
+/// reset after each head. Samples are the built-in corpus or files with
+/// raw request heads.
+///
+/// Usage: request-parser-bench [--duration ms] [file...]
+///
+/// The scan kernel follows the build: AVX2 with -DENABLE_AVX2=ON, SSE2
+/// by default, and request-parser-bench-scalar is the byte loop.
+
+#include "../src/http/request_parser.hpp"
+#include "request_samples.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace eiptnd;
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+const char* kernel_name()
+{
+#if defined(__AVX2__)
+  return "AVX2";
+#elif defined(__SSE2__)
+  return "SSE2";
+#else
+  return "scalar";
+#endif
+}
+
+/// Parse all requests of `data`, the count of parsed ones or 0 if it
+/// holds a bad or incomplete one.
+std::size_t parse_all(request_parser& parser, std::string const& data,
+                      std::size_t& checksum)
+{
+  std::size_t count = 0;
+  for (std::size_t offset = 0; offset < data.size(); ) {
+    parser.reset();
+    if (parser.parse(data.data() + offset, data.size() - offset)
+        != request_parser::good) {
+      return 0;
+    }
+    checksum += parser.head().headers_count + parser.head().target.size();
+    offset += parser.consumed();
+    ++count;
+  }
+  return count;
+}
+
+void usage(char const* name)
+{
+  std::cerr << "Usage: " << name << " [--duration ms] [file...]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  long duration = 1000;
+  std::vector<samples::sample> corpus;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+      duration = std::strtol(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--help") == 0) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    else {
+      std::ifstream file(argv[i], std::ios::binary);
+      if (!file) {
+        std::cerr << "Unable to open " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+      samples::sample s = { argv[i], std::string(
+          std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()) };
+      corpus.push_back(s);
+    }
+  }
+
+  if (duration <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (corpus.empty()) {
+    corpus = samples::corpus();
+  }
+
+  std::printf("%s kernel\n", kernel_name());
+
+  request_parser parser;
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.size(); ++i) {
+    std::string const& data = corpus[i].data;
+    std::size_t requests = parse_all(parser, data, checksum);
+    if (!requests) {
+      std::cerr << corpus[i].name << ": not a complete request" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // The clock is read once per batch, so it does not dominate small heads
+    std::size_t const batch = 1 + (64 * 1024) / data.size();
+    unsigned long long rounds = 0;
+    clock_type::time_point started = clock_type::now();
+    clock_type::time_point deadline = started + std::chrono::milliseconds(duration);
+    clock_type::time_point now;
+    do {
+      for (std::size_t n = 0; n < batch; ++n) {
+        parse_all(parser, data, checksum);
+      }
+      rounds += batch;
+      now = clock_type::now();
+    } while (now < deadline);
+
+    double seconds = std::chrono::duration<double>(now - started).count();
+    std::printf("%-24s %6zu bytes %3zu requests  %6.2f GB/s  %6.1f ns/request\n",
+                corpus[i].name, data.size(), requests,
+                rounds * data.size() / seconds / 1e9,
+                seconds * 1e9 / (rounds * requests));
+  }
+
+  // Keep the results alive, so the parsing is not optimized away
+  return checksum ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,281 @@
+/// Fuzz driver of the request parser. Each input is parsed request by
+/// request as a pipelined stream, once at a whole and once growing by a
+/// byte in a freshly allocated buffer, as the server feeds it from the
+/// socket. Both ways must agree on every result and every field, and the
+/// fields must lie inside the consumed head.
+///
+/// Built with -DENABLE_FUZZING=ON (clang) it is a libFuzzer target,
+/// otherwise a standalone mutation loop over the sample corpus, which
+/// first checks that malformed samples are rejected:
+///
+/// Usage: request-parser-fuzz [--iterations N] [--seed N] [file...]
+
+#include "../src/http/request_parser.hpp"
+#include "request_samples.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace eiptnd;
+
+namespace {
+
+/// Input of the current run, dumped when an invariant is broken.
+const char* input_data;
+std::size_t input_size;
+
+void fail(const char* what)
+{
+  std::fprintf(stderr, "Invariant is broken: %s\nInput (%zu bytes): \"",
+               what, input_size);
+  for (std::size_t i = 0; i < input_size; ++i) {
+    unsigned char c = static_cast<unsigned char>(input_data[i]);
+    if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+      std::fputc(c, stderr);
+    }
+    else {
+      std::fprintf(stderr, "\\x%02x", c);
+    }
+  }
+  std::fprintf(stderr, "\"\n");
+  std::abort();
+}
+
+/// Fields of a parsed head as offsets, so heads of different buffers
+/// can be compared.
+std::vector<std::size_t> head_offsets(request_parser const& parser,
+                                      const char* data)
+{
+  request_head const& head = parser.head();
+  std::vector<std::size_t> result;
+  std::size_t const consumed = parser.consumed();
+
+  boost::string_ref fields[3] = { head.method, head.target, head.version };
+  std::vector<boost::string_ref> refs(fields, fields + 3);
+  if (head.headers_count > request_head::max_headers) {
+    fail("too many header fields");
+  }
+  for (std::size_t i = 0; i < head.headers_count; ++i) {
+    refs.push_back(head.headers[i].name);
+    refs.push_back(head.headers[i].value);
+  }
+
+  for (std::size_t i = 0; i < refs.size(); ++i) {
+    if (refs[i].data() < data ||
+        refs[i].data() + refs[i].size() > data + consumed) {
+      fail("a field is outside of the head");
+    }
+    result.push_back(static_cast<std::size_t>(refs[i].data() - data));
+    result.push_back(refs[i].size());
+  }
+  return result;
+}
+
+/// Parse the head at `offset` feeding the parser with growing copies of
+/// the data, as if it arrived byte by byte.
+request_parser::result_type parse_incrementally(
+    request_parser& parser, const char* data, std::size_t size,
+    std::size_t offset, std::vector<std::size_t>& offsets)
+{
+  parser.reset();
+  request_parser::result_type result = request_parser::indeterminate;
+  for (std::size_t n = 1; n <= size - offset; ++n) {
+    // A new buffer every time: the parser may keep no pointers into it
+    std::vector<char> copy(data + offset, data + offset + n);
+    result = parser.parse(&copy[0], copy.size());
+    if (result == request_parser::good) {
+      offsets = head_offsets(parser, &copy[0]);
+    }
+    if (result != request_parser::indeterminate) {
+      break;
+    }
+  }
+  return result;
+}
+
+int check(const char* data, std::size_t size)
+{
+  input_data = data;
+  input_size = size;
+
+  request_parser whole, incremental;
+  for (std::size_t offset = 0; offset < size; ) {
+    whole.reset();
+    request_parser::result_type result = whole.parse(data + offset, size - offset);
+
+    std::vector<std::size_t> offsets, incremental_offsets;
+    if (result == request_parser::good) {
+      if (!whole.consumed() || whole.consumed() > size - offset) {
+        fail("consumed size is outside of the data");
+      }
+      if (data[offset + whole.consumed() - 1] != '\n') {
+        fail("the head does not end with a line feed");
+      }
+      offsets = head_offsets(whole, data + offset);
+    }
+
+    if (parse_incrementally(incremental, data, size, offset,
+                            incremental_offsets) != result) {
+      fail("results of whole and incremental parsing differ");
+    }
+    if (result != request_parser::good) {
+      break;
+    }
+    if (incremental.consumed() != whole.consumed()) {
+      fail("consumed sizes of whole and incremental parsing differ");
+    }
+    if (incremental_offsets != offsets) {
+      fail("fields of whole and incremental parsing differ");
+    }
+
+    offset += whole.consumed();
+  }
+  return 0;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, std::size_t size)
+{
+  return check(reinterpret_cast<const char*>(data), size);
+}
+
+#ifndef USE_LIBFUZZER
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+/// Bytes which are significant to the grammar of the head.
+const char interesting[] = { '\r', '\n', ' ', '\t', ':', '\0', '\x7f', '\xff' };
+
+std::size_t pick(unsigned long long& state, std::size_t bound)
+{
+  // xorshift64*
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return bound ? static_cast<std::size_t>(
+      (state * 2685821657736338717ULL) >> 33) % bound : 0;
+}
+
+void mutate(std::string& data, std::vector<samples::sample> const& corpus,
+            unsigned long long& state)
+{
+  std::size_t const count = 1 + pick(state, 8);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::size_t pos = pick(state, data.size() + 1);
+    switch (pick(state, 7)) {
+    case 0: // flip a bit
+      if (pos < data.size()) {
+        data[pos] = static_cast<char>(data[pos] ^ (1 << pick(state, 8)));
+      }
+      break;
+    case 1: // insert a delimiter
+      data.insert(pos, 1, interesting[pick(state, sizeof(interesting))]);
+      break;
+    case 2: // replace by a delimiter
+      if (pos < data.size()) {
+        data[pos] = interesting[pick(state, sizeof(interesting))];
+      }
+      break;
+    case 3: // erase a range
+      data.erase(pos, pick(state, 32));
+      break;
+    case 4: // duplicate a range
+      {
+        std::string const range = data.substr(pick(state, data.size() + 1),
+                                              pick(state, 64));
+        data.insert(pos, range);
+      }
+      break;
+    case 5: // truncate
+      data.resize(pos);
+      break;
+    default: // splice with another sample
+      {
+        std::string const& other = corpus[pick(state, corpus.size())].data;
+        data.insert(pos, other, pick(state, other.size() + 1), pick(state, 256));
+      }
+      break;
+    }
+  }
+}
+
+void usage(char const* name)
+{
+  std::cerr << "Usage: " << name << " [--iterations N] [--seed N] [file...]"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  unsigned long long iterations = 100000;
+  unsigned long long seed = 1;
+  std::vector<samples::sample> corpus = samples::corpus();
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = std::strtoull(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = std::strtoull(argv[++i], 0, 10);
+    }
+    else if (std::strcmp(argv[i], "--help") == 0) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    else {
+      std::ifstream file(argv[i], std::ios::binary);
+      if (!file) {
+        std::cerr << "Unable to open " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+      samples::sample s = { argv[i], std::string(
+          std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()) };
+      corpus.push_back(s);
+    }
+  }
+
+  // Samples themselves first, then their mutations
+  for (std::size_t i = 0; i < corpus.size(); ++i) {
+    check(corpus[i].data.data(), corpus[i].data.size());
+  }
+
+  std::vector<samples::sample> const malformed = samples::malformed();
+  for (std::size_t i = 0; i < malformed.size(); ++i) {
+    std::string const& data = malformed[i].data;
+    check(data.data(), data.size());
+    request_parser parser;
+    if (parser.parse(data.data(), data.size()) != request_parser::bad) {
+      input_data = data.data();
+      input_size = data.size();
+      fail((std::string("a malformed head is accepted, ") +
+            malformed[i].name).c_str());
+    }
+    corpus.push_back(malformed[i]);
+  }
+
+  unsigned long long state = seed ? seed : 1;
+  std::string data;
+  for (unsigned long long i = 0; i < iterations; ++i) {
+    data = corpus[pick(state, corpus.size())].data;
+    mutate(data, corpus, state);
+    // Long inputs are quadratic to feed byte by byte and find nothing new
+    if (data.size() > 4096) {
+      data.resize(4096);
+    }
+    check(data.data(), data.size());
+  }
+
+  std::printf("%llu inputs checked, seed %llu\n", iterations, seed);
+  return EXIT_SUCCESS;
+}
+
+#endif // USE_LIBFUZZER
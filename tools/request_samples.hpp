@@ -0,0 +1,98 @@
+/// Sample request heads for the request parser tools: what browsers and
+/// command line clients actually send, and pipelined series of them.
+
+#ifndef TOOLS_REQUEST_SAMPLES_HPP
+#define TOOLS_REQUEST_SAMPLES_HPP
+
+#include <string>
+#include <vector>
+
+namespace samples {
+
+struct sample
+{
+  const char* name;
+  std::string data;
+};
+
+inline std::string browser_request()
+{
+  return
+    "GET /assets/js/application.min.js?v=20161017 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/54.0.2840.71 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Referer: https://www.example.com/blog/2016/10/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, sdch, br\r\n"
+    "Accept-Language: en-US,en;q=0.8,ru;q=0.6\r\n"
+    "Cookie: _ga=GA1.2.1402351285.1476691200; _gid=GA1.2.1188454725.1476691200;"
+    " session=7f3c1e2a9b8d4c6f0e1d2c3b4a596877; theme=dark; "
+    "consent=analytics%2Cads\r\n"
+    "If-None-Match: \"58049a2c-1f4b3\"\r\n"
+    "If-Modified-Since: Mon, 17 Oct 2016 09:41:00 GMT\r\n"
+    "\r\n";
+}
+
+inline std::string curl_request()
+{
+  return
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/7.50.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+}
+
+inline std::string pipelined(std::string const& request, std::size_t count)
+{
+  std::string data;
+  for (std::size_t i = 0; i < count; ++i) {
+    data += request;
+  }
+  return data;
+}
+
+inline std::vector<sample> corpus()
+{
+  std::vector<sample> result;
+  sample browser = { "browser", browser_request() };
+  sample curl = { "curl", curl_request() };
+  sample pipelined_curl = { "pipelined curl x16", pipelined(curl_request(), 16) };
+  sample pipelined_browser = { "pipelined browser x4",
+                               pipelined(browser_request(), 4) };
+  result.push_back(browser);
+  result.push_back(curl);
+  result.push_back(pipelined_curl);
+  result.push_back(pipelined_browser);
+  return result;
+}
+
+/// Heads the parser must reject: control bytes in the method or the
+/// target, which would be copied into header lines of redirects, bad
+/// method tokens and versions other than HTTP/1.0 and HTTP/1.1.
+inline std::vector<sample> malformed()
+{
+  static const sample heads[] = {
+    { "LF in target", std::string("GET /x\nSet-Cookie: a/.. HTTP/1.1\r\n\r\n") },
+    { "CR LF in target", std::string("GET /x\r\nSet-Cookie: a HTTP/1.1\r\n\r\n") },
+    { "NUL in target", std::string("GET /a\0b HTTP/1.1\r\n\r\n", 21) },
+    { "TAB in target", std::string("GET /a\tb HTTP/1.1\r\n\r\n") },
+    { "DEL in target", std::string("GET /a\x7f HTTP/1.1\r\n\r\n") },
+    { "LF in method", std::string("GE\nT / HTTP/1.1\r\n\r\n") },
+    { "NUL in method", std::string("GE\0T / HTTP/1.1\r\n\r\n", 19) },
+    { "separator in method", std::string("GE(T / HTTP/1.1\r\n\r\n") },
+    { "LF in header name", std::string("GET / HTTP/1.1\r\nX\nY: 1\r\n\r\n") },
+    { "space in header name", std::string("GET / HTTP/1.1\r\nX Y: 1\r\n\r\n") },
+    { "version 9x", std::string("GET / HTTP/9x\r\n\r\n") },
+    { "version 2.0", std::string("GET / HTTP/2.0\r\n\r\n") },
+    { "version 1.10", std::string("GET / HTTP/1.10\r\n\r\n") },
+    { "lowercase version", std::string("GET / http/1.1\r\n\r\n") },
+  };
+  return std::vector<sample>(heads, heads + sizeof(heads) / sizeof(heads[0]));
+}
+
+} // namespace samples
+
+#endif // TOOLS_REQUEST_SAMPLES_HPP